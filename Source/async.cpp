@@ -0,0 +1,175 @@
+#include "async.hpp"
+#include "fiber.hpp"
+
+namespace cobalt {
+	struct scheduler::readyQueue {
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<execution*> executions;
+		bool closed = false;
+	};
+	
+	class scheduler::execution {
+	public:
+		scheduler& owner;
+		fiber f;
+		std::list<std::unique_ptr<execution> >::iterator position;
+		
+		execution(scheduler& owner, std::function<void()> body, size_t stackSize):
+			owner(owner),
+			f(std::move(body), stackSize)
+		{
+		}
+	};
+	
+	namespace details {
+		asyncState::asyncState():
+			_done(false)
+		{
+		}
+		
+		void asyncState::complete(variablePtr value, std::exception_ptr error) {
+			std::function<void()> continuation;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_done = true;
+				_value = std::move(value);
+				_error = std::move(error);
+				continuation = std::move(_continuation);
+			}
+			_completed.notify_all();
+			
+			if (continuation) {
+				continuation();
+			}
+		}
+		
+		bool asyncState::done() {
+			std::lock_guard<std::mutex> lock(_mutex);
+			return _done;
+		}
+		
+		void asyncState::then(std::function<void()> continuation) {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				if (!_done) {
+					_continuation = std::move(continuation);
+					return;
+				}
+			}
+			continuation();
+		}
+		
+		variablePtr asyncState::wait() {
+			std::unique_lock<std::mutex> lock(_mutex);
+			_completed.wait(lock, [this](){
+				return _done;
+			});
+			
+			if (_error) {
+				std::rethrow_exception(_error);
+			}
+			return _value;
+		}
+		
+		variablePtr await(const std::shared_ptr<asyncState>& state) {
+			if (scheduler::execution* e = scheduler::current()) {
+				if (!state->done()) {
+					e->owner.suspend(e, state);
+				}
+			}
+			return state->wait();
+		}
+		
+		bool yieldExecution() {
+			scheduler::execution* e = scheduler::current();
+			return e && e->owner.yield(e);
+		}
+	}
+	
+	scheduler::scheduler(size_t stackSize):
+		_ready(std::make_shared<readyQueue>()),
+		_stack_size(stackSize)
+	{
+	}
+	
+	scheduler::~scheduler() {
+		std::lock_guard<std::mutex> lock(_ready->mutex);
+		_ready->closed = true;
+	}
+	
+	void scheduler::spawn(std::function<void()> body) {
+		std::unique_ptr<execution> e = std::make_unique<execution>(*this, std::move(body), _stack_size);
+		execution* ptr = e.get();
+		ptr->position = _executions.insert(_executions.end(), std::move(e));
+		
+		std::lock_guard<std::mutex> lock(_ready->mutex);
+		_ready->executions.push_back(ptr);
+	}
+	
+	void scheduler::run() {
+		while (true) {
+			execution* e;
+			{
+				std::unique_lock<std::mutex> lock(_ready->mutex);
+				_ready->wake.wait(lock, [this](){
+					return !_ready->executions.empty() || _executions.empty();
+				});
+				
+				if (_ready->executions.empty()) {
+					return;
+				}
+				
+				e = _ready->executions.front();
+				_ready->executions.pop_front();
+			}
+			
+			resume(e);
+		}
+	}
+	
+	size_t scheduler::pending() const {
+		return _executions.size();
+	}
+	
+	scheduler::execution*& scheduler::current() {
+		thread_local execution* current_execution = nullptr;
+		return current_execution;
+	}
+	
+	void scheduler::resume(execution* e) {
+		execution* previous = current();
+		current() = e;
+		e->f.resume();
+		current() = previous;
+		
+		if (e->f.finished()) {
+			_executions.erase(e->position);
+		}
+	}
+	
+	void scheduler::suspend(execution* e, const std::shared_ptr<details::asyncState>& state) {
+		//the continuation may run on another thread, even before the execution yields,
+		//but the execution is only resumed by run on this one
+		state->then([ready=_ready, e](){
+			std::lock_guard<std::mutex> lock(ready->mutex);
+			if (!ready->closed) {
+				ready->executions.push_back(e);
+				ready->wake.notify_one();
+			}
+		});
+		e->f.yield();
+	}
+	
+	bool scheduler::yield(execution* e) {
+		{
+			std::lock_guard<std::mutex> lock(_ready->mutex);
+			if (_ready->executions.empty()) {
+				return false;
+			}
+			_ready->executions.push_back(e);
+		}
+		e->f.yield();
+		return true;
+	}
+}
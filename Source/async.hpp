@@ -0,0 +1,95 @@
+#ifndef async_hpp
+#define async_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include "variable.hpp"
+
+namespace cobalt {
+	namespace details {
+		//Completion shared by a promise and its future. It is completed once, from any
+		//thread.
+		class asyncState {
+			asyncState(const asyncState&) = delete;
+			void operator=(const asyncState&) = delete;
+		private:
+			std::mutex _mutex;
+			std::condition_variable _completed;
+			bool _done;
+			variablePtr _value;
+			std::exception_ptr _error;
+			std::function<void()> _continuation;
+		public:
+			asyncState();
+			
+			void complete(variablePtr value, std::exception_ptr error);
+			
+			bool done();
+			
+			//Runs continuation once the state is completed, at once if it already is.
+			void then(std::function<void()> continuation);
+			
+			//Blocks until the state is completed, then returns the value or rethrows
+			//the error.
+			variablePtr wait();
+		};
+		
+		//Returns the value of state once it is completed. The script execution
+		//running on this thread is suspended until then; a thread that does not run
+		//one of a scheduler blocks.
+		variablePtr await(const std::shared_ptr<asyncState>& state);
+		
+		//Lets the other executions that are ready run before the one running on this
+		//thread goes on. Returns false at once if no execution of a scheduler runs
+		//on this thread, or no other one is ready.
+		bool yieldExecution();
+	}
+	
+	//Runs script executions on a single thread, each with a stack of its own, and
+	//switches to another one while an execution awaits an external function or
+	//waits on a channel.
+	class scheduler {
+		scheduler(const scheduler&) = delete;
+		void operator=(const scheduler&) = delete;
+	private:
+		class execution;
+		struct readyQueue;
+		
+		std::list<std::unique_ptr<execution> > _executions;
+		std::shared_ptr<readyQueue> _ready;
+		size_t _stack_size;
+		
+		void resume(execution* e);
+		void suspend(execution* e, const std::shared_ptr<details::asyncState>& state);
+		bool yield(execution* e);
+		
+		//Execution running on this thread, or null.
+		static execution*& current();
+		
+		friend variablePtr details::await(const std::shared_ptr<details::asyncState>& state);
+		friend bool details::yieldExecution();
+	public:
+		//Executions get stacks of stackSize bytes, committed as they are used.
+		explicit scheduler(size_t stackSize = 8 * 1024 * 1024);
+		~scheduler();
+		
+		//Adds an execution that runs body, which must not throw. It starts on the next
+		//call to run.
+		void spawn(std::function<void()> body);
+		
+		//Runs the executions until all of them have finished, waiting for the
+		//completions they await. It is called from one thread at a time.
+		void run();
+		
+		//Number of executions that have not finished. Those left when the scheduler
+		//is destroyed are abandoned.
+		size_t pending() const;
+	};
+}
+
+#endif /* async_hpp */
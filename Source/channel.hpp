@@ -0,0 +1,181 @@
+#ifndef channel_hpp
+#define channel_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "async.hpp"
+#include "variable.hpp"
+#include "errors.hpp"
+#include "memoryAccount.hpp"
+
+namespace cobalt {
+	//Most values a channel holds, which keeps the ring of a channel that a script
+	//opens within a few tens of megabytes.
+	const size_t max_channel_capacity = size_t(1) << 20;
+	
+	//Bounded queue of values that any number of threads send to and receive from
+	//without locking. Each cell of the ring carries a sequence number that tells
+	//whether it is free to write, or ready to read, on the current lap.
+	template<typename T>
+	class channel {
+		channel(const channel&) = delete;
+		void operator=(const channel&) = delete;
+	private:
+		struct cell {
+			std::atomic<size_t> sequence;
+			T value;
+		};
+		
+		memoryAccountPtr _account;
+		std::unique_ptr<cell[]> _cells;
+		size_t _mask;
+		alignas(64) std::atomic<size_t> _send_pos;
+		alignas(64) std::atomic<size_t> _recv_pos;
+		
+		static size_t roundCapacity(size_t capacity) {
+			runtimeAssertion(capacity <= max_channel_capacity, "Channel capacity is too large");
+			//with a single cell, a value ready to read has the sequence number of a
+			//free cell on the next lap
+			size_t ret = 2;
+			while (ret < capacity) {
+				ret <<= 1;
+			}
+			return ret;
+		}
+		
+		//The ring is charged to the account active where the channel is created.
+		static memoryAccountPtr chargeRing(size_t capacity) {
+			memoryAccount* account = memoryAccount::active();
+			if (!account) {
+				return nullptr;
+			}
+			account->charge(capacity * sizeof(cell));
+			return account->acquire();
+		}
+		
+		//Lets the other executions of the scheduler running on this thread go first,
+		//as one of them may be the one to make progress possible. Without any, spins
+		//for a while, then gives up the time slice to the thread that will.
+		static void backoff(size_t& attempts) {
+			if (details::yieldExecution() || ++attempts < 64) {
+				return;
+			}
+			std::this_thread::yield();
+		}
+	public:
+		//Capacity is rounded up to a power of two, at least two, and must not exceed
+		//max_channel_capacity.
+		explicit channel(size_t capacity):
+			_account(chargeRing(roundCapacity(capacity))),
+			_cells(new cell[roundCapacity(capacity)]),
+			_mask(roundCapacity(capacity) - 1),
+			_send_pos(0),
+			_recv_pos(0)
+		{
+			for (size_t i = 0; i <= _mask; ++i) {
+				_cells[i].sequence.store(i, std::memory_order_relaxed);
+			}
+		}
+		
+		~channel() {
+			if (_account) {
+				_account->credit(capacity() * sizeof(cell));
+			}
+		}
+		
+		size_t capacity() const {
+			return _mask + 1;
+		}
+		
+		//Moves value into the channel, unless it is full.
+		bool trySend(T& value) {
+			size_t pos = _send_pos.load(std::memory_order_relaxed);
+			cell* c;
+			
+			while (true) {
+				c = &_cells[pos & _mask];
+				size_t sequence = c->sequence.load(std::memory_order_acquire);
+				intptr_t diff = intptr_t(sequence) - intptr_t(pos);
+				
+				if (diff == 0) {
+					if (_send_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = _send_pos.load(std::memory_order_relaxed);
+				}
+			}
+			
+			c->value = std::move(value);
+			c->sequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+		
+		//Moves the oldest value out of the channel into value, unless it is empty.
+		bool tryRecv(T& value) {
+			size_t pos = _recv_pos.load(std::memory_order_relaxed);
+			cell* c;
+			
+			while (true) {
+				c = &_cells[pos & _mask];
+				size_t sequence = c->sequence.load(std::memory_order_acquire);
+				intptr_t diff = intptr_t(sequence) - intptr_t(pos + 1);
+				
+				if (diff == 0) {
+					if (_recv_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						break;
+					}
+				} else if (diff < 0) {
+					return false;
+				} else {
+					pos = _recv_pos.load(std::memory_order_relaxed);
+				}
+			}
+			
+			value = std::move(c->value);
+			c->value = T();
+			c->sequence.store(pos + _mask + 1, std::memory_order_release);
+			return true;
+		}
+		
+		//Waits while the channel is full. An execution of a scheduler lets the others
+		//on its thread run meanwhile, so they may receive.
+		void send(T value) {
+			for (size_t attempts = 0; !trySend(value); backoff(attempts));
+		}
+		
+		//Waits while the channel is empty, letting the other executions of a
+		//scheduler run, as send does.
+		T recv() {
+			T ret;
+			for (size_t attempts = 0; !tryRecv(ret); backoff(attempts));
+			return ret;
+		}
+		
+		//Channel of the process with the name, created with capacity unless it
+		//exists. Channels of each value type have names of their own.
+		static std::shared_ptr<channel> named(const std::string& name, size_t capacity) {
+			static std::mutex mutex;
+			static std::unordered_map<std::string, std::shared_ptr<channel> > channels;
+			
+			std::lock_guard<std::mutex> lock(mutex);
+			std::shared_ptr<channel>& ret = channels[name];
+			if (!ret) {
+				ret = std::make_shared<channel>(capacity);
+			}
+			return ret;
+		}
+	};
+	
+	//Capacity of the channels that scripts use before any is given.
+	const size_t default_channel_capacity = 1024;
+}
+
+#endif /* channel_hpp */
@@ -0,0 +1,146 @@
+#include "closure.hpp"
+#include "compiler.hpp"
+#include "compilerContext.hpp"
+#include "cycleCollector.hpp"
+#include "expressionTree.hpp"
+#include "incompleteFunction.hpp"
+#include "runtimeContext.hpp"
+#include "tokeniser.hpp"
+
+namespace cobalt {
+	namespace {
+		void runLambda(const lambdaCode& code, runtimeContext& ctx, const std::vector<variablePtr>& captured) {
+			ctx.reserveFrame(code.frame_size);
+			for (size_t i = 0; i < captured.size(); ++i) {
+				ctx.local(int(i) + 1) = captured[i];
+			}
+			code.stmt->execute(ctx);
+			ctx.setFlow(flow::normalFlow());
+		}
+		
+		struct lambdaFunction {
+			std::shared_ptr<const lambdaCode> code;
+			
+			void operator()(runtimeContext& ctx) const {
+				runLambda(*code, ctx, {});
+			}
+		};
+		
+		class closureState: public functionState {
+		private:
+			std::shared_ptr<const lambdaCode> _code;
+			std::vector<variablePtr> _captured;
+		public:
+			closureState(std::shared_ptr<const lambdaCode> code, std::vector<variablePtr> captured):
+				_code(std::move(code)),
+				_captured(std::move(captured))
+			{
+			}
+			
+			~closureState() override {
+				releaseVariables(_captured);
+			}
+			
+			void call(runtimeContext& ctx) override {
+				std::shared_ptr<functionState> running = shared_from_this();
+				runLambda(*_code, ctx, _captured);
+			}
+			
+			const std::shared_ptr<const lambdaCode>& code() const {
+				return _code;
+			}
+			
+			void trace(const std::function<void(const variablePtr&)>& visit) const override {
+				for (const variablePtr& v : _captured) {
+					visit(v);
+				}
+			}
+		};
+	}
+	
+	std::shared_ptr<const lambdaCode> compileLambda(compilerContext& ctx, const lambdaLiteral& lambda) {
+		std::shared_ptr<lambdaCode> ret = std::make_shared<lambdaCode>();
+		
+		std::vector<const identifierInfo*> captured;
+		for (const lambdaLiteral::capture& c : lambda.captures) {
+			const identifierInfo* info = ctx.find(c.name.id);
+			captured.push_back(info);
+			ret->captures.push_back(lambdaCode::capture{info->index(), c.by_ref});
+		}
+		
+		auto _ = ctx.lambda();
+		
+		const functionType* ft = std::get_if<functionType>(lambda.typeID);
+		
+		for (size_t i = 0; i < lambda.params.size(); ++i) {
+			ctx.createParam(lambda.params[i].id, ft->param_type_id[i].typeID, ft->param_type_id[i].by_ref);
+		}
+		
+		//Calls of the lambda may write the captured variables, whether they are its
+		//own copies or shared with the creating frame.
+		for (size_t i = 0; i < captured.size(); ++i) {
+			ctx.bindLocal(lambda.captures[i].name.id, captured[i]->typeID(), ctx.reserveLocal(), true);
+		}
+		
+		compilerContext::sideEffectsMark mark = ctx.sideEffects();
+		
+		std::deque<token> tokens = lambda.body;
+		tokensIterator it(tokens);
+		
+		ret->stmt = compileFunctionBlock(ctx, it, ft->return_type_id);
+		ret->frame_size = ctx.frameSize();
+		ret->effects = ctx.effects();
+		ret->writes_captures = false;
+		for (size_t i = 0; i < captured.size(); ++i) {
+			ret->writes_captures = ret->writes_captures || ctx.isWrittenSince(mark, i + 1);
+		}
+		
+		return ret;
+	}
+	
+	function createClosure(const std::shared_ptr<const lambdaCode>& code, runtimeContext& ctx) {
+		if (code->captures.empty()) {
+			return lambdaFunction{code};
+		}
+		
+		std::vector<variablePtr> captured;
+		captured.reserve(code->captures.size());
+		for (const lambdaCode::capture& c : code->captures) {
+			const variablePtr& v = ctx.local(int(c.index));
+			captured.push_back(c.by_ref ? v : v->clone());
+		}
+		
+		return statefulFunction(std::make_shared<closureState>(code, std::move(captured)));
+	}
+	
+	bool isParallelSafe(const runtimeContext& ctx, const function& f) {
+		if (std::optional<size_t> idx = scriptFunctionIndex(f)) {
+			return !ctx.writesGlobals(*idx);
+		}
+		
+		const lambdaCode* code = nullptr;
+		if (const lambdaFunction* lf = f.target<lambdaFunction>()) {
+			code = lf->code.get();
+		} else if (const closureState* state = dynamic_cast<const closureState*>(functionStateOf(f))) {
+			code = state->code().get();
+		}
+		
+		if (!code || code->effects.writes_globals || code->effects.calls_values || code->writes_captures) {
+			return false;
+		}
+		
+		for (const lambdaCode::capture& c : code->captures) {
+			if (c.by_ref) {
+				return false;
+			}
+		}
+		
+		for (size_t callee : code->effects.callees) {
+			if (ctx.writesGlobals(callee)) {
+				return false;
+			}
+		}
+		
+		return true;
+	}
+}
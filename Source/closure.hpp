@@ -0,0 +1,49 @@
+#ifndef closure_hpp
+#define closure_hpp
+
+#include <memory>
+#include <vector>
+#include "compilerContext.hpp"
+#include "statement.hpp"
+#include "variable.hpp"
+
+namespace cobalt {
+	struct lambdaLiteral;
+	
+	//Body of a lambda, compiled within the function that creates it. Slots 1 to n
+	//of its frame hold the captured variables, in the order of the captures.
+	struct lambdaCode {
+		struct capture {
+			//Slot of the variable in the frame of the creating function.
+			size_t index;
+			bool by_ref;
+		};
+		shared_statement_ptr stmt;
+		size_t frame_size;
+		std::vector<capture> captures;
+		
+		//What the body does, besides what the functions it calls do.
+		functionEffects effects;
+		
+		//Whether the body writes a captured variable, which the copies of the
+		//function share.
+		bool writes_captures;
+	};
+	
+	//The captures must name local variables of the scope being compiled.
+	std::shared_ptr<const lambdaCode> compileLambda(compilerContext& ctx, const lambdaLiteral& lambda);
+	
+	//Function value of the lambda, created in the frame of ctx. Variables captured
+	//by reference are shared with that frame; those captured by value are copied,
+	//and the copy is shared by the copies of the function, so it keeps what calls
+	//write to it.
+	function createClosure(const std::shared_ptr<const lambdaCode>& code, runtimeContext& ctx);
+	
+	//Whether f may run on several threads at once: a script function or lambda
+	//that writes no globals, shares no variables with the frame that created it,
+	//and calls only functions that do the same. Other function values are not
+	//known to be safe.
+	bool isParallelSafe(const runtimeContext& ctx, const function& f);
+}
+
+#endif /* closure_hpp */
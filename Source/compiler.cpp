@@ -2,11 +2,18 @@
 #include "errors.hpp"
 #include "compilerContext.hpp"
 #include "expression.hpp"
+#include "expressionTree.hpp"
 #include "incompleteFunction.hpp"
 #include "tokeniser.hpp"
 #include "runtimeContext.hpp"
 #include "helpers.hpp"
 #include "pushBackStream.hpp"
+#include "native.hpp"
+#include <unordered_set>
+#include <algorithm>
+#include <optional>
+#include <cmath>
+#include <mutex>
 
 namespace cobalt {
 	namespace {
@@ -14,72 +21,58 @@ namespace cobalt {
 			size_t breakLevel;
 			bool can_continue;
 			typeHandle return_type_id;
+			typeHandle yield_type_id;
 			
 			possible_flow add_switch() {
-				return possible_flow{breakLevel+1, can_continue, return_type_id};
+				return possible_flow{breakLevel+1, can_continue, return_type_id, yield_type_id};
 			}
 			
 			possible_flow add_loop() {
-				return possible_flow{breakLevel+1, true, return_type_id};
+				return possible_flow{breakLevel+1, true, return_type_id, yield_type_id};
 			}
 			
+			//The body of a generator function yields its values and returns nothing.
 			static possible_flow in_function(typeHandle return_type_id) {
-				return possible_flow{0, false, return_type_id};
+				if (const generatorType* gt = std::get_if<generatorType>(return_type_id)) {
+					return possible_flow{0, false, typeRegistry::getVoidHandle(), gt->inner_type_id};
+				}
+				return possible_flow{0, false, return_type_id, nullptr};
 			}
 		};
 	
-		bool is_typename(const compilerContext&, const tokensIterator& it) {
-			return std::visit(overloaded{
-				[](reservedToken t) {
-					switch (t) {
-						case reservedToken::kw_number:
-						case reservedToken::kw_string:
-						case reservedToken::kw_void:
-						case reservedToken::open_square:
-							return true;
-						default:
-							return false;
-					}
-				},
-				[](const tokenValue&) {
-					return false;
-				}
-			}, it->getValue());
-		}
-	
 		error unexpected_syntax(const tokensIterator& it) {
 			return unexpectedSyntaxError(std::to_string(it->getValue()), it->getLineNumber(), it->getCharIndex());
 		}
 		
-		std::vector<expression<lvalue>::ptr> compile_variable_declaration(compilerContext& ctx, tokensIterator& it) {
-			typeHandle typeID = parseType(ctx, it);
+		struct variableDeclaration {
+			identifier name;
+			const identifierInfo* info;
+			expression<lvalue>::ptr init;
+		};
 		
-			if (typeID == typeRegistry::getVoidHandle()) {
-				throw syntaxError("Cannot declare void variable", it->getLineNumber(), it->getCharIndex());
-			}
+		std::vector<variableDeclaration> compile_variable_declaration(
+			compilerContext& ctx,
+			tokensIterator& it
+		) {
+			std::vector<variableDeclaration> ret;
 			
-			std::vector<expression<lvalue>::ptr> ret;
-			
-			do {
-				if (!ret.empty()) {
-					++it;
-				}
+			parseVariableDeclaration(ctx, it, [&](typeHandle typeID, const identifier& name, bool initialized) {
+				expression<lvalue>::ptr init = initialized ?
+					build_initialisation_expression(ctx, it, typeID, false) :
+					build_default_initialization(typeID);
+				
+				ret.push_back(variableDeclaration{name, ctx.createIdentifier(name.id, typeID), std::move(init)});
+			});
 			
-				std::string name = parseDeclarationName(ctx, it);
+			return ret;
+		}
+		
+		std::vector<expression<void>::ptr> compile_local_declaration(compilerContext& ctx, tokensIterator& it) {
+			std::vector<expression<void>::ptr> ret;
 			
-				if (it->hasValue(reservedToken::open_round)) {
-					++it;
-					ret.emplace_back(build_initialisation_expression(ctx, it, typeID, false));
-					parseTokenValue(ctx, it, reservedToken::close_round);
-				} else if (it->hasValue(reservedToken::assign)) {
-					++it;
-					ret.emplace_back(build_initialisation_expression(ctx, it, typeID, false));
-				} else {
-					ret.emplace_back(build_default_initialization(typeID));
-				}
-				
-				ctx.createIdentifier(std::move(name), typeID);
-			} while (it->hasValue(reservedToken::comma));
+			for (variableDeclaration& decl : compile_variable_declaration(ctx, it)) {
+				ret.emplace_back(build_local_initialization(decl.info->index(), std::move(decl.init)));
+			}
 			
 			return ret;
 		}
@@ -106,7 +99,13 @@ namespace cobalt {
 		
 		statement_ptr compile_return_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf);
 		
+		statement_ptr compile_yield_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf);
+		
 		statement_ptr compile_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf, bool in_switch) {
+			if (it->isContextualKeyword(reservedToken::kw_yield) && !ctx.find(it->getIdentifier().id)) {
+				return compile_yield_statement(ctx, it, pf);
+			}
+			
 			if (it->isReservedToken()) {
 				switch (it->getReservedToken()) {
 					case reservedToken::kw_for:
@@ -130,7 +129,7 @@ namespace cobalt {
 				}
 			}
 			
-			if (is_typename(ctx, it)) {
+			if (isTypename(it)) {
 				if (in_switch) {
 					throw syntaxError("Declarations in switch block are not allowed", it->getLineNumber(), it->getCharIndex());
 				} else {
@@ -151,30 +150,357 @@ namespace cobalt {
 			return ret;
 		}
 		
+		bool is_opening(const token& t) {
+			return
+				t.hasValue(reservedToken::open_round) ||
+				t.hasValue(reservedToken::open_square) ||
+				t.hasValue(reservedToken::open_curly);
+		}
+		
+		bool is_closing(const token& t) {
+			return
+				t.hasValue(reservedToken::close_round) ||
+				t.hasValue(reservedToken::close_square) ||
+				t.hasValue(reservedToken::close_curly);
+		}
+		
+		//Takes the tokens up to the first unbracketed terminator, which is kept at
+		//the end, so that they can be compiled after the code that follows them.
+		std::deque<token> buffer_tokens(tokensIterator& it, reservedToken terminator) {
+			std::deque<token> ret;
+			
+			for (int nesting = 0; !it->isEof() && (nesting || (!it->hasValue(terminator) && !is_closing(*it))); ++it) {
+				if (is_opening(*it)) {
+					++nesting;
+				} else if (is_closing(*it)) {
+					--nesting;
+				}
+				ret.push_back(*it);
+			}
+			
+			ret.push_back(*it);
+			
+			if (it->hasValue(terminator)) {
+				++it;
+			}
+			
+			return ret;
+		}
+		
+		std::deque<token> buffer_block(tokensIterator& it) {
+			std::deque<token> ret;
+			
+			ret.push_back(*it);
+			++it;
+			
+			for (token& t : buffer_tokens(it, reservedToken::close_curly)) {
+				ret.push_back(std::move(t));
+			}
+			
+			return ret;
+		}
+		
+		bool is_comparison(const token& t) {
+			if (!t.isReservedToken()) {
+				return false;
+			}
+			
+			switch (t.getReservedToken()) {
+				case reservedToken::eq:
+				case reservedToken::ne:
+				case reservedToken::lt:
+				case reservedToken::gt:
+				case reservedToken::le:
+				case reservedToken::ge:
+					return true;
+				default:
+					return false;
+			}
+		}
+		
+		//Whether tokens[begin, end) is arithmetic that the code compiled since mark
+		//cannot change. Globals are out, as any call might assign them, and so are
+		//references if there are calls, since they may refer to globals.
+		bool is_invariant(
+			const compilerContext& ctx,
+			const std::deque<token>& tokens,
+			size_t begin,
+			size_t end,
+			const compilerContext::sideEffectsMark& mark
+		) {
+			for (size_t i = begin; i < end; ++i) {
+				const token& t = tokens[i];
+				
+				if (t.isIdentifier()) {
+					const identifierInfo* info = ctx.find(t.getIdentifier().id);
+					if (
+						!info ||
+						info->getScope() != identifierScope::local_variable ||
+						info->typeID() != typeRegistry::getNumberHandle() ||
+						ctx.isWrittenSince(mark, info->index()) ||
+						(ctx.isReference(info) && ctx.hasCallsSince(mark))
+					) {
+						return false;
+					}
+				} else if (t.isReservedToken()) {
+					switch (t.getReservedToken()) {
+						case reservedToken::add:
+						case reservedToken::sub:
+						case reservedToken::mul:
+						case reservedToken::div:
+						case reservedToken::idiv:
+						case reservedToken::mod:
+						case reservedToken::open_round:
+						case reservedToken::close_round:
+							break;
+						default:
+							return false;
+					}
+				} else if (!t.isNumber()) {
+					return false;
+				}
+			}
+			
+			return true;
+		}
+		
+		//A loop condition that compares a variable with some arithmetic, as in
+		//'i < n - 1', gets a slot for the arithmetic, reserved before the body so
+		//that the body doesn't reuse it.
+		std::optional<size_t> reserve_bound_slot(compilerContext& ctx, const std::deque<token>& tokens) {
+			if (tokens.size() > 4 && tokens[0].isIdentifier() && is_comparison(tokens[1])) {
+				return ctx.reserveLocal();
+			}
+			return std::nullopt;
+		}
+		
+		//Compiles a loop condition that ends with terminator. If the arithmetic that
+		//got a slot from reserve_bound_slot turns out not to change in the loop, it
+		//is stored in the slot once, by an expression added to entry.
+		expression<number>::ptr compile_loop_condition(
+			compilerContext& ctx,
+			std::deque<token> tokens,
+			reservedToken terminator,
+			std::optional<size_t> slot,
+			const compilerContext::sideEffectsMark& mark,
+			std::vector<expression<void>::ptr>& entry
+		) {
+			if (slot && is_invariant(ctx, tokens, 2, tokens.size() - 1, mark)) {
+				const identifierInfo* info = ctx.find(tokens[0].getIdentifier().id);
+				
+				if (info && info->typeID() == typeRegistry::getNumberHandle()) {
+					size_t idx = *slot;
+					identifier bound = ctx.intern("@bound");
+					ctx.bindLocal(bound.id, typeRegistry::getNumberHandle(), idx, false);
+					
+					std::deque<token> invariant(tokens.begin() + 2, tokens.end());
+					tokensIterator invariantIt(invariant);
+					
+					entry.push_back(build_local_initialization(
+						idx,
+						build_initialisation_expression(ctx, invariantIt, typeRegistry::getNumberHandle(), false)
+					));
+					parseTokenValue(ctx, invariantIt, terminator);
+					
+					token first = tokens[2];
+					tokens.erase(tokens.begin() + 2, tokens.end() - 1);
+					tokens.insert(tokens.begin() + 2, token(bound, first.getLineNumber(), first.getCharIndex()));
+				}
+			}
+			
+			tokensIterator it(tokens);
+			expression<number>::ptr ret = build_number_expression(ctx, it);
+			parseTokenValue(ctx, it, terminator);
+			return ret;
+		}
+		
+		//Recognizes 'for (i = c; i < sizeof(a); ++i)', where c is a non-negative
+		//literal, and returns the slots of the local array a and the local number i.
+		//The loop body has yet to be checked not to assign either of them.
+		std::optional<std::pair<size_t, size_t> > find_counting_loop(
+			const compilerContext& ctx,
+			const std::deque<token>& init,
+			const std::deque<token>& cond,
+			const std::deque<token>& step
+		) {
+			auto find_local = [&](const token& t) -> const identifierInfo* {
+				if (!t.isIdentifier()) {
+					return nullptr;
+				}
+				const identifierInfo* info = ctx.find(t.getIdentifier().id);
+				return info && info->getScope() == identifierScope::local_variable && !ctx.isReference(info) ? info : nullptr;
+			};
+			
+			const identifierInfo* counter = cond.size() > 1 ? find_local(cond[0]) : nullptr;
+			
+			if (!counter || counter->typeID() != typeRegistry::getNumberHandle() || !cond[1].hasValue(reservedToken::lt)) {
+				return std::nullopt;
+			}
+			
+			auto is_counter = [&](const token& t) {
+				return t.isIdentifier() && t.getIdentifier().id == cond[0].getIdentifier().id;
+			};
+			
+			size_t n = init.size();
+			
+			if (!(
+				(n == 4 || (n == 5 && init[0].hasValue(reservedToken::kw_number))) &&
+				is_counter(init[n-4]) &&
+				init[n-3].hasValue(reservedToken::assign) &&
+				init[n-2].isNumber() && init[n-2].getNumber() >= 0
+			)) {
+				return std::nullopt;
+			}
+			
+			n = step.size();
+			
+			if (!(
+				(n == 3 && is_counter(step[1]) && step[0].hasValue(reservedToken::inc)) ||
+				(n == 3 && is_counter(step[0]) && step[1].hasValue(reservedToken::inc)) || (
+					n == 4 && is_counter(step[0]) && step[1].hasValue(reservedToken::add_assign) &&
+					step[2].isNumber() && step[2].getNumber() > 0
+				)
+			)) {
+				return std::nullopt;
+			}
+			
+			n = cond.size();
+			
+			if (n > 3 && cond[n-3].hasValue(reservedToken::sub) && cond[n-2].isNumber() && cond[n-2].getNumber() >= 0) {
+				n -= 2;
+			}
+			
+			const token* arr_token = nullptr;
+			
+			if (n == 5 && cond[2].hasValue(reservedToken::kw_sizeof)) {
+				arr_token = &cond[3];
+			} else if (
+				n == 7 && cond[2].hasValue(reservedToken::kw_sizeof) &&
+				cond[3].hasValue(reservedToken::open_round) && cond[5].hasValue(reservedToken::close_round)
+			) {
+				arr_token = &cond[4];
+			}
+			
+			const identifierInfo* arr = arr_token ? find_local(*arr_token) : nullptr;
+			
+			if (!arr || !std::holds_alternative<arrayType>(*arr->typeID())) {
+				return std::nullopt;
+			}
+			
+			return std::make_pair(arr->index(), counter->index());
+		}
+		
+		//Counts the iterations of a loop in the profile of the function running it.
+		statement_ptr profile_loop_body(compilerContext& ctx, statement_ptr block) {
+			if (std::optional<size_t> index = ctx.profiledFunction()) {
+				return createProfiledStatement(*index, std::move(block));
+			}
+			return block;
+		}
+		
+		//for (T x in g) runs the block for each value that the generator g yields.
+		statement_ptr compile_for_in_statement(compilerContext& ctx, std::deque<token> header, tokensIterator& it, possible_flow pf) {
+			tokensIterator headerIt(header);
+			
+			typeHandle typeID = parseType(ctx, headerIt);
+			identifier name = parseDeclarationName(ctx, headerIt);
+			if (!headerIt->isContextualKeyword(reservedToken::kw_in)) {
+				throw expectedSyntaxError(std::to_string(reservedToken::kw_in), headerIt->getLineNumber(), headerIt->getCharIndex());
+			}
+			++headerIt;
+			
+			expression<lvalue>::ptr gen = build_initialisation_expression(
+				ctx, headerIt, ctx.getHandle(generatorType{typeID}), false
+			);
+			parseTokenValue(ctx, headerIt, reservedToken::close_round);
+			
+			//the body of the generator runs as the loop pulls its values
+			ctx.markCall(std::nullopt);
+			
+			size_t idx = ctx.createIdentifier(name.id, typeID)->index();
+			
+			statement_ptr block = profile_loop_body(ctx, compile_block_statement(ctx, it, pf));
+			
+			return createForInStatement(idx, std::move(gen), std::move(block));
+		}
+		
 		statement_ptr compile_for_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf) {
 			auto _ = ctx.scope();
 		
 			parseTokenValue(ctx, it, reservedToken::kw_for);
 			parseTokenValue(ctx, it, reservedToken::open_round);
 			
-			std::vector<expression<lvalue>::ptr> decls;
+			std::deque<token> init = buffer_tokens(it, reservedToken::semicolon);
+			
+			if (init.back().hasValue(reservedToken::close_round)) {
+				++it;
+				return compile_for_in_statement(ctx, std::move(init), it, pf);
+			}
+			
+			std::deque<token> cond = buffer_tokens(it, reservedToken::semicolon);
+			std::deque<token> step = buffer_tokens(it, reservedToken::close_round);
+			
+			std::vector<expression<void>::ptr> decls;
 			expression<void>::ptr expr1;
 			
-			if (is_typename(ctx, it)) {
-				decls = compile_variable_declaration(ctx, it);
+			{
+				std::deque<token> tokens = init;
+				tokensIterator initIt(tokens);
+				
+				if (isTypename(initIt)) {
+					decls = compile_local_declaration(ctx, initIt);
+				} else {
+					expr1 = build_void_expression(ctx, initIt);
+				}
+				
+				parseTokenValue(ctx, initIt, reservedToken::semicolon);
+			}
+			
+			//The condition and step are compiled last, when it is known what the body
+			//assigns. A counting loop over an array compiles the body assuming that it
+			//does not assign the array or the counter, and again if it turns out to.
+			std::optional<size_t> slot = reserve_bound_slot(ctx, cond);
+			
+			compilerContext::sideEffectsMark mark = ctx.sideEffects();
+			
+			statement_ptr block;
+			
+			std::optional<std::pair<size_t, size_t> > counting = find_counting_loop(ctx, init, cond, step);
+			
+			if (counting && it->hasValue(reservedToken::open_curly)) {
+				std::deque<token> body = buffer_block(it);
+				
+				{
+					std::deque<token> tokens = body;
+					tokensIterator bodyIt(tokens);
+					auto in_bounds = ctx.assumeInBounds(counting->first, counting->second);
+					block = compile_block_statement(ctx, bodyIt, pf);
+				}
+				
+				if (ctx.isWrittenSince(mark, counting->first) || ctx.isWrittenSince(mark, counting->second)) {
+					tokensIterator bodyIt(body);
+					block = compile_block_statement(ctx, bodyIt, pf);
+				}
 			} else {
-				expr1 = build_void_expression(ctx, it);
+				block = compile_block_statement(ctx, it, pf);
 			}
-		
-			parseTokenValue(ctx, it, reservedToken::semicolon);
 			
-			expression<number>::ptr expr2 = build_number_expression(ctx, it);
-			parseTokenValue(ctx, it, reservedToken::semicolon);
+			block = profile_loop_body(ctx, std::move(block));
 			
-			expression<void>::ptr expr3 = build_void_expression(ctx, it);
-			parseTokenValue(ctx, it, reservedToken::close_round);
+			tokensIterator stepIt(step);
+			expression<void>::ptr expr3 = build_void_expression(ctx, stepIt);
+			parseTokenValue(ctx, stepIt, reservedToken::close_round);
 			
-			statement_ptr block = compile_block_statement(ctx, it, pf);
+			std::vector<expression<void>::ptr> entry;
+			
+			expression<number>::ptr expr2 = compile_loop_condition(ctx, std::move(cond), reservedToken::semicolon, slot, mark, entry);
+			
+			if (!entry.empty()) {
+				if (decls.empty()) {
+					decls.push_back(std::move(expr1));
+				}
+				std::move(entry.begin(), entry.end(), std::back_inserter(decls));
+			}
 			
 			if (!decls.empty()) {
 				return createForStatement(std::move(decls), std::move(expr2), std::move(expr3), std::move(block));
@@ -184,21 +510,36 @@ namespace cobalt {
 		}
 		
 		statement_ptr compile_while_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf) {
+			auto _ = ctx.scope();
+			
 			parseTokenValue(ctx, it, reservedToken::kw_while);
 
 			parseTokenValue(ctx, it, reservedToken::open_round);
-			expression<number>::ptr expr = build_number_expression(ctx, it);
-			parseTokenValue(ctx, it, reservedToken::close_round);
+			std::deque<token> cond = buffer_tokens(it, reservedToken::close_round);
+			std::optional<size_t> slot = reserve_bound_slot(ctx, cond);
+			
+			compilerContext::sideEffectsMark mark = ctx.sideEffects();
+			
+			statement_ptr block = profile_loop_body(ctx, compile_block_statement(ctx, it, pf));
+			
+			std::vector<expression<void>::ptr> entry;
 			
-			statement_ptr block = compile_block_statement(ctx, it, pf);
+			expression<number>::ptr expr = compile_loop_condition(ctx, std::move(cond), reservedToken::close_round, slot, mark, entry);
 			
-			return createWhileStatement(std::move(expr), std::move(block));
+			if (entry.empty()) {
+				return createWhileStatement(std::move(expr), std::move(block));
+			}
+			
+			std::vector<statement_ptr> statements;
+			statements.push_back(createLocalDeclarationState(std::move(entry)));
+			statements.push_back(createWhileStatement(std::move(expr), std::move(block)));
+			return createBlockStatement(std::move(statements));
 		}
 		
 		statement_ptr compile_do_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf) {
 			parseTokenValue(ctx, it, reservedToken::kw_do);
 			
-			statement_ptr block = compile_block_statement(ctx, it, pf);
+			statement_ptr block = profile_loop_body(ctx, compile_block_statement(ctx, it, pf));
 			
 			parseTokenValue(ctx, it, reservedToken::kw_while);
 			
@@ -215,10 +556,10 @@ namespace cobalt {
 			
 			parseTokenValue(ctx, it, reservedToken::open_round);
 			
-			std::vector<expression<lvalue>::ptr> decls;
+			std::vector<expression<void>::ptr> decls;
 			
-			if (is_typename(ctx, it)) {
-				decls = compile_variable_declaration(ctx, it);
+			if (isTypename(it)) {
+				decls = compile_local_declaration(ctx, it);
 				parseTokenValue(ctx, it, reservedToken::semicolon);
 			}
 			
@@ -247,16 +588,47 @@ namespace cobalt {
 			return createIfStatement(std::move(decls), std::move(exprs), std::move(stmts));
 		}
 		
-		 statement_ptr compile_switch_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf) {
+		const size_t max_jump_table_size = 65536;
+		const size_t max_binary_search_cases = 64;
+		
+		//Dense integer labels index a table directly, small sparse sets use a
+		//branchless binary search and everything else falls back to hashing.
+		switch_lowering choose_switch_lowering(const std::vector<std::pair<number, size_t> >& cases) {
+			if (cases.empty()) {
+				return switch_lowering::jump_table;
+			}
+			
+			bool integral = true;
+			number lo = cases[0].first;
+			number hi = cases[0].first;
+			
+			for (const std::pair<number, size_t>& c : cases) {
+				integral = integral && c.first == std::floor(c.first);
+				lo = std::min(lo, c.first);
+				hi = std::max(hi, c.first);
+			}
+			
+			if (integral && hi - lo < max_jump_table_size && hi - lo < 4 * cases.size()) {
+				return switch_lowering::jump_table;
+			}
+			
+			if (cases.size() <= max_binary_search_cases) {
+				return switch_lowering::binary_search;
+			}
+			
+			return switch_lowering::hash_table;
+		}
+		
+		statement_ptr compile_switch_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf) {
 		 	auto _ = ctx.scope();
 			parseTokenValue(ctx, it, reservedToken::kw_switch);
 			
 			parseTokenValue(ctx, it, reservedToken::open_round);
 			
-			std::vector<expression<lvalue>::ptr> decls;
+			std::vector<expression<void>::ptr> decls;
 			
-			if (is_typename(ctx, it)) {
-				decls = compile_variable_declaration(ctx, it);
+			if (isTypename(it)) {
+				decls = compile_local_declaration(ctx, it);
 				parseTokenValue(ctx, it, reservedToken::semicolon);
 			}
 			
@@ -264,24 +636,21 @@ namespace cobalt {
 			parseTokenValue(ctx, it, reservedToken::close_round);
 			
 			std::vector<statement_ptr> stmts;
-			std::unordered_map<number, size_t> cases;
+			std::vector<std::pair<number, size_t> > cases;
+			std::unordered_set<number> labels;
 			size_t dflt = size_t(-1);
 			
 			parseTokenValue(ctx, it, reservedToken::open_curly);
 			
 			while (!it->hasValue(reservedToken::close_curly)) {
-				if (it->hasValue(reservedToken::kw_case)) {
-					++it;
-					if (!it->isNumber()) {
-						throw unexpected_syntax(it);
+				if (isSwitchLabel(it)) {
+					if (std::optional<number> label = parseSwitchLabel(ctx, it)) {
+						if (labels.insert(*label).second) {
+							cases.emplace_back(*label, stmts.size());
+						}
+					} else {
+						dflt = stmts.size();
 					}
-					cases.emplace(it->getNumber(), stmts.size());
-					++it;
-					parseTokenValue(ctx, it, reservedToken::colon);
-				} else if (it->hasValue(reservedToken::kw_default)) {
-					++it;
-					dflt = stmts.size();
-					parseTokenValue(ctx, it, reservedToken::colon);
 				} else {
 					stmts.emplace_back(compile_statement(ctx, it, pf, true));
 				}
@@ -293,40 +662,21 @@ namespace cobalt {
 				dflt = stmts.size();
 			}
 			
-			return createSwitchStatement(std::move(decls), std::move(expr), std::move(stmts), std::move(cases), dflt);
+			switch_lowering lowering = choose_switch_lowering(cases);
+			
+			return createSwitchStatement(
+				std::move(decls), std::move(expr), std::move(stmts), std::move(cases), dflt, lowering
+			);
 		}
 	
 		statement_ptr compile_var_statement(compilerContext& ctx, tokensIterator& it) {
-			std::vector<expression<lvalue>::ptr> decls = compile_variable_declaration(ctx, it);
+			std::vector<expression<void>::ptr> decls = compile_local_declaration(ctx, it);
 			parseTokenValue(ctx, it, reservedToken::semicolon);
 			return createLocalDeclarationState(std::move(decls));
 		}
 		
 		statement_ptr compile_break_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf) {
-			if (pf.breakLevel == 0) {
-				throw unexpected_syntax(it);
-			}
-			
-			parseTokenValue(ctx, it, reservedToken::kw_break);
-			
-			double breakLevel;
-			
-			if (it->isNumber()) {
-				breakLevel = it->getNumber();
-			
-				if (breakLevel < 1 || breakLevel != int(breakLevel) || breakLevel > pf.breakLevel) {
-					throw syntaxError("Invalid break value", it->getLineNumber(), it->getCharIndex());
-				}
-				
-				++it;
-			} else {
-				breakLevel = 1;
-			}
-			
-			
-			parseTokenValue(ctx, it, reservedToken::semicolon);
-			
-			return createBreakStatement(int(breakLevel));
+			return createBreakStatement(int(parseBreakStatement(ctx, it, pf.breakLevel)));
 		}
 		
 		statement_ptr compile_continue_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf){
@@ -345,13 +695,24 @@ namespace cobalt {
 				parseTokenValue(ctx, it, reservedToken::semicolon);
 				return createReturnVoidStatement();
 			} else {
-				expression<lvalue>::ptr expr = build_initialisation_expression(ctx, it, pf.return_type_id, true);
+				expression<void>::ptr expr = build_return_expression(ctx, it, pf.return_type_id);
 				parseTokenValue(ctx, it, reservedToken::semicolon);
 				return createReturnStatement(std::move(expr));
 			}
 		}
 		
 		
+		statement_ptr compile_yield_statement(compilerContext& ctx, tokensIterator& it, possible_flow pf){
+			if (!pf.yield_type_id) {
+				throw syntaxError("yield outside of a generator function", it->getLineNumber(), it->getCharIndex());
+			}
+			
+			++it;
+			expression<lvalue>::ptr expr = build_initialisation_expression(ctx, it, pf.yield_type_id, false);
+			parseTokenValue(ctx, it, reservedToken::semicolon);
+			return createYieldStatement(std::move(expr));
+		}
+		
 		std::vector<statement_ptr> compile_block_contents(compilerContext& ctx, tokensIterator& it, possible_flow pf) {
 			std::vector<statement_ptr> ret;
 			
@@ -375,8 +736,240 @@ namespace cobalt {
 			std::vector<statement_ptr> block = compile_block_contents(ctx, it, pf);
 			return createBlockStatement(std::move(block));
 		}
+		
+		//Hot functions are inlined into others with this many times the inline budget.
+		const size_t hot_inline_factor = 4;
+		
+		//Keeps the state of compiling a module, to compile its functions again once
+		//they get hot. The new bodies inline more, and read the number and string
+		//globals that no code writes as constants while a single context runs them.
+		//Contexts of modules sharing the program may call it from several threads.
+		class hotFunctionCompiler: public optimizer {
+		private:
+			std::shared_ptr<symbolTable> _symbols;
+			compilerContext _ctx;
+			std::vector<incompleteFunction> _functions;
+			std::vector<typeHandle> _globals;
+			size_t _externals;
+			std::vector<size_t> _optimized;
+			size_t _contexts;
+			std::mutex _mutex;
+		public:
+			hotFunctionCompiler(std::shared_ptr<symbolTable> symbols, size_t externals):
+				_symbols(std::move(symbols)),
+				_ctx(*_symbols),
+				_externals(externals),
+				_contexts(0)
+			{
+			}
+			
+			compilerContext& context() {
+				return _ctx;
+			}
+			
+			std::vector<incompleteFunction>& functions() {
+				return _functions;
+			}
+			
+			void addGlobal(typeHandle typeID) {
+				_globals.push_back(typeID);
+			}
+			
+			void addHotInlineCandidates(size_t inline_budget) {
+				for (size_t i = 0; i < _functions.size(); ++i) {
+					if (_functions[i].canInline(inline_budget * hot_inline_factor)) {
+						_ctx.addInlineCandidate(_externals + i, &_functions[i]);
+					}
+				}
+			}
+			
+			void optimize(runtimeContext& ctx, size_t functionIndex) override {
+				std::lock_guard<std::mutex> lock(_mutex);
+				
+				//another context sharing the functions got there first
+				if (std::find(_optimized.begin(), _optimized.end(), functionIndex) != _optimized.end()) {
+					return;
+				}
+				
+				std::unordered_map<size_t, variablePtr> constants;
+				
+				for (size_t i = 0; _contexts == 1 && i < _globals.size() && i < ctx.globalsCount(); ++i) {
+					if (
+						(_globals[i] == typeRegistry::getNumberHandle() || _globals[i] == typeRegistry::getStringHandle()) &&
+						!_ctx.isGlobalWritten(i)
+					) {
+						constants.emplace(i, ctx.global(int(i)));
+					}
+				}
+				
+				_ctx.setConstantGlobals(std::move(constants));
+				
+				_functions[functionIndex - _externals].recompile(_ctx);
+				_optimized.push_back(functionIndex);
+			}
+			
+			void reset() override {
+				std::lock_guard<std::mutex> lock(_mutex);
+				
+				//shared bodies hold no constants, and the other contexts would not
+				//optimize them again
+				if (_contexts > 1) {
+					return;
+				}
+				
+				for (size_t functionIndex : _optimized) {
+					_functions[functionIndex - _externals].restore();
+				}
+				_optimized.clear();
+			}
+			
+			void attach() override {
+				std::lock_guard<std::mutex> lock(_mutex);
+				
+				if (++_contexts == 2) {
+					for (size_t functionIndex : _optimized) {
+						_functions[functionIndex - _externals].restore();
+					}
+					_optimized.clear();
+				}
+			}
+			
+			void detach() override {
+				std::lock_guard<std::mutex> lock(_mutex);
+				--_contexts;
+			}
+		};
 	}
 
+	bool isTypename(const tokensIterator& it) {
+		return std::visit(overloaded{
+			[](reservedToken t) {
+				switch (t) {
+					case reservedToken::kw_number:
+					case reservedToken::kw_string:
+					case reservedToken::kw_void:
+					case reservedToken::open_square:
+						return true;
+					default:
+						return false;
+				}
+			},
+			[](const tokenValue&) {
+				return false;
+			}
+		}, it->getValue());
+	}
+	
+	void parseVariableDeclaration(
+		compilerContext& ctx,
+		tokensIterator& it,
+		const std::function<void(typeHandle typeID, const identifier& name, bool initialized)>& declare
+	) {
+		typeHandle typeID = parseType(ctx, it);
+		
+		if (typeID == typeRegistry::getVoidHandle()) {
+			throw syntaxError("Cannot declare void variable", it->getLineNumber(), it->getCharIndex());
+		}
+		
+		bool first = true;
+		
+		do {
+			if (!first) {
+				++it;
+			}
+			first = false;
+			
+			identifier name = parseDeclarationName(ctx, it);
+			
+			if (it->hasValue(reservedToken::open_round)) {
+				++it;
+				declare(typeID, name, true);
+				parseTokenValue(ctx, it, reservedToken::close_round);
+			} else if (it->hasValue(reservedToken::assign)) {
+				++it;
+				declare(typeID, name, true);
+			} else {
+				declare(typeID, name, false);
+			}
+		} while (it->hasValue(reservedToken::comma));
+	}
+	
+	bool isSwitchLabel(const tokensIterator& it) {
+		return it->hasValue(reservedToken::kw_case) || it->hasValue(reservedToken::kw_default);
+	}
+	
+	std::optional<number> parseSwitchLabel(compilerContext& ctx, tokensIterator& it) {
+		if (it->hasValue(reservedToken::kw_default)) {
+			++it;
+			parseTokenValue(ctx, it, reservedToken::colon);
+			return std::nullopt;
+		}
+		
+		parseTokenValue(ctx, it, reservedToken::kw_case);
+		
+		if (!it->isNumber()) {
+			throw unexpected_syntax(it);
+		}
+		
+		number ret = it->getNumber();
+		++it;
+		parseTokenValue(ctx, it, reservedToken::colon);
+		return ret;
+	}
+	
+	size_t parseBreakStatement(compilerContext& ctx, tokensIterator& it, size_t depth) {
+		if (depth == 0) {
+			throw unexpected_syntax(it);
+		}
+		
+		parseTokenValue(ctx, it, reservedToken::kw_break);
+		
+		double breakLevel = 1;
+		
+		if (it->isNumber()) {
+			breakLevel = it->getNumber();
+			
+			if (breakLevel < 1 || breakLevel != int(breakLevel) || breakLevel > depth) {
+				throw syntaxError("Invalid break value", it->getLineNumber(), it->getCharIndex());
+			}
+			
+			++it;
+		}
+		
+		parseTokenValue(ctx, it, reservedToken::semicolon);
+		
+		return size_t(breakLevel);
+	}
+	
+	std::vector<functionDeclaration> declareExternalFunctions(
+		compilerContext& ctx,
+		symbolTable& symbols,
+		const std::vector<std::pair<std::string, function> >& external_functions
+	) {
+		std::vector<functionDeclaration> ret;
+		
+		for (const std::pair<std::string, function>& p : external_functions) {
+			get_character get = [i = size_t(0), &p]() mutable {
+				if (i < p.first.size()){
+					return int(p.first[i++]);
+				} else {
+					return -1;
+				}
+			};
+			
+			push_back_stream stream(&get);
+			
+			tokensIterator function_it(stream, symbols);
+			
+			functionDeclaration decl = parseFunctionDeclaration(ctx, function_it);
+			
+			ctx.createExternalFunction(decl.name.id, decl.typeID);
+			ret.push_back(std::move(decl));
+		}
+		
+		return ret;
+	}
+	
 	void parseTokenValue(compilerContext&, tokensIterator& it, const tokenValue& value) {
 		if (it->hasValue(value)) {
 			++it;
@@ -385,15 +978,15 @@ namespace cobalt {
 		throw expectedSyntaxError(std::to_string(value), it->getLineNumber(), it->getCharIndex());
 	}
 	
-	std::string parseDeclarationName(compilerContext& ctx, tokensIterator& it) {
+	identifier parseDeclarationName(compilerContext& ctx, tokensIterator& it) {
 		if (!it->isIdentifier()) {
 			throw unexpected_syntax(it);
 		}
 
-		std::string ret = it->getIdentifier().name;
+		identifier ret = it->getIdentifier();
 		
-		if (!ctx.canDeclare(ret)) {
-			throw alreadyDeclaredError(ret, it->getLineNumber(), it->getCharIndex());
+		if (!ctx.canDeclare(ret.id)) {
+			throw alreadyDeclaredError(ret.name, it->getLineNumber(), it->getCharIndex());
 		}
 
 		++it;
@@ -401,70 +994,100 @@ namespace cobalt {
 		return ret;
 	}
 
-	typeHandle parseType(compilerContext& ctx, tokensIterator& it) {
-		if (!it->isReservedToken()) {
-			throw unexpected_syntax(it);
+	namespace {
+		typeHandle parse_base_type(compilerContext& ctx, tokensIterator& it) {
+			if (!it->isReservedToken()) {
+				throw unexpected_syntax(it);
+			}
+			
+			switch (it->getReservedToken()) {
+				case reservedToken::kw_void:
+					++it;
+					return ctx.getHandle(simpleType::nothing);
+				case reservedToken::kw_number:
+					++it;
+					return ctx.getHandle(simpleType::number);
+				case reservedToken::kw_string:
+					++it;
+					return ctx.getHandle(simpleType::string);
+				case reservedToken::open_square:
+					{
+						tupleType tt;
+						++it;
+						while (!it->hasValue(reservedToken::close_square)) {
+							if (!tt.inner_type_id.empty()) {
+								parseTokenValue(ctx, it, reservedToken::comma);
+							}
+							tt.inner_type_id.push_back(parseType(ctx, it));
+						}
+						++it;
+						return ctx.getHandle(std::move(tt));
+					}
+				default:
+					throw unexpected_syntax(it);
+			}
 		}
 		
-		typeHandle t = nullptr;
+		//Array or dictionary of t, with it just after the opening bracket.
+		typeHandle parse_square_suffix(compilerContext& ctx, tokensIterator& it, typeHandle t) {
+			if (it->hasValue(reservedToken::kw_number)) {
+				parseTokenValue(ctx, ++it, reservedToken::close_square);
+				return ctx.getHandle(dictionaryType{typeRegistry::getNumberHandle(), t});
+			} else if (it->hasValue(reservedToken::kw_string)) {
+				parseTokenValue(ctx, ++it, reservedToken::close_square);
+				return ctx.getHandle(dictionaryType{typeRegistry::getStringHandle(), t});
+			} else {
+				parseTokenValue(ctx, it, reservedToken::close_square);
+				return ctx.getHandle(arrayType{t});
+			}
+		}
 		
-		switch (it->getReservedToken()) {
-			case reservedToken::kw_void:
-				t = ctx.getHandle(simpleType::nothing);
-				++it;
-				break;
-			case reservedToken::kw_number:
-				t = ctx.getHandle(simpleType::number);
-				++it;
-				break;
-			case reservedToken::kw_string:
-				t = ctx.getHandle(simpleType::string);
-				++it;
-				break;
-			case reservedToken::open_square:
-				{
-					tupleType tt;
+		//Parameter list of a function type, with it just after the opening
+		//parenthesis. Names of the parameters are collected into names if given.
+		functionType parse_params(compilerContext& ctx, tokensIterator& it, typeHandle return_type_id, std::vector<identifier>* names) {
+			functionType ft;
+			ft.return_type_id = return_type_id;
+			while (!it->hasValue(reservedToken::close_round)) {
+				if (!ft.param_type_id.empty()) {
+					parseTokenValue(ctx, it, reservedToken::comma);
+				}
+				typeHandle param_type = parseType(ctx, it);
+				if (it->hasValue(reservedToken::bitwise_and)) {
+					ft.param_type_id.push_back({param_type, true});
 					++it;
-					while (!it->hasValue(reservedToken::close_square)) {
-						if (!tt.inner_type_id.empty()) {
-							parseTokenValue(ctx, it, reservedToken::comma);
+				} else {
+					ft.param_type_id.push_back({param_type, false});
+				}
+				if (names && it->isIdentifier()) {
+					identifier name = it->getIdentifier();
+					for (const identifier& prev : *names) {
+						if (prev.id == name.id) {
+							throw alreadyDeclaredError(name.name, it->getLineNumber(), it->getCharIndex());
 						}
-						tt.inner_type_id.push_back(parseType(ctx, it));
 					}
+					names->push_back(name);
 					++it;
-					t = ctx.getHandle(std::move(tt));
 				}
-				break;
-			default:
-				throw unexpected_syntax(it);
+			}
+			++it;
+			return ft;
 		}
+	}
+	
+	typeHandle parseType(compilerContext& ctx, tokensIterator& it) {
+		typeHandle t = parse_base_type(ctx, it);
 		
 		while (it->isReservedToken()) {
 			switch (it->getReservedToken()) {
 				case reservedToken::open_square:
-					parseTokenValue(ctx, ++it, reservedToken::close_square);
-					t = ctx.getHandle(arrayType{t});
+					t = parse_square_suffix(ctx, ++it, t);
+					break;
+				case reservedToken::mul:
+					++it;
+					t = ctx.getHandle(generatorType{t});
 					break;
 				case reservedToken::open_round:
-					{
-						functionType ft;
-						ft.return_type_id = t;
-						++it;
-						while (!it->hasValue(reservedToken::close_round)) {
-							if (!ft.param_type_id.empty()) {
-								parseTokenValue(ctx, it, reservedToken::comma);
-							}
-							typeHandle param_type = parseType(ctx, it);
-							if (it->hasValue(reservedToken::bitwise_and)) {
-								ft.param_type_id.push_back({param_type, true});
-								++it;
-							} else {
-								ft.param_type_id.push_back({param_type, false});
-							}
-						}
-						++it;
-						t = ctx.getHandle(ft);
-					}
+					t = ctx.getHandle(parse_params(ctx, ++it, t, nullptr));
 					break;
 				default:
 					return t;
@@ -474,43 +1097,207 @@ namespace cobalt {
 		return t;
 	}
 	
+	std::shared_ptr<const lambdaLiteral> parseLambda(compilerContext& ctx, tokensIterator& it) {
+		size_t line_number = it->getLineNumber();
+		size_t char_index = it->getCharIndex();
+		
+		parseTokenValue(ctx, it, reservedToken::kw_function);
+		
+		std::shared_ptr<lambdaLiteral> ret = std::make_shared<lambdaLiteral>();
+		
+		//The type reads as a function type whose last parameter list, the one
+		//followed by the captures or the body, names the parameters.
+		typeHandle t = parse_base_type(ctx, it);
+		bool has_captures = false;
+		
+		while (!ret->typeID) {
+			if (it->hasValue(reservedToken::open_square)) {
+				t = parse_square_suffix(ctx, ++it, t);
+			} else if (it->hasValue(reservedToken::mul)) {
+				++it;
+				t = ctx.getHandle(generatorType{t});
+			} else if (it->hasValue(reservedToken::open_round)) {
+				std::vector<identifier> names;
+				functionType ft = parse_params(ctx, ++it, t, &names);
+				
+				if (it->hasValue(reservedToken::open_square)) {
+					++it;
+					has_captures = it->isIdentifier() || it->hasValue(reservedToken::bitwise_and);
+					if (!has_captures) {
+						if (!names.empty()) {
+							throw unexpected_syntax(it);
+						}
+						t = parse_square_suffix(ctx, it, ctx.getHandle(ft));
+						continue;
+					}
+				} else if (!it->hasValue(reservedToken::open_curly)) {
+					if (!names.empty()) {
+						throw unexpected_syntax(it);
+					}
+					t = ctx.getHandle(ft);
+					continue;
+				}
+				
+				if (!names.empty() && names.size() != ft.param_type_id.size()) {
+					throw syntaxError("Either all parameters of a lambda are named or none are", line_number, char_index);
+				}
+				if (std::holds_alternative<generatorType>(*ft.return_type_id)) {
+					throw semanticError("Lambdas cannot be generators", line_number, char_index);
+				}
+				for (size_t i = names.size(); i < ft.param_type_id.size(); ++i) {
+					names.push_back(ctx.intern("@" + std::to_string(i)));
+				}
+				ret->typeID = ctx.getHandle(ft);
+				ret->params = std::move(names);
+			} else {
+				throw unexpected_syntax(it);
+			}
+		}
+		
+		while (has_captures) {
+			bool by_ref = false;
+			if (it->hasValue(reservedToken::bitwise_and)) {
+				by_ref = true;
+				++it;
+			}
+			if (!it->isIdentifier()) {
+				throw unexpected_syntax(it);
+			}
+			identifier name = it->getIdentifier();
+			for (const identifier& param : ret->params) {
+				if (param.id == name.id) {
+					throw alreadyDeclaredError(name.name, it->getLineNumber(), it->getCharIndex());
+				}
+			}
+			for (const lambdaLiteral::capture& c : ret->captures) {
+				if (c.name.id == name.id) {
+					throw alreadyDeclaredError(name.name, it->getLineNumber(), it->getCharIndex());
+				}
+			}
+			ret->captures.push_back(lambdaLiteral::capture{name, by_ref});
+			++it;
+			if (it->hasValue(reservedToken::close_square)) {
+				++it;
+				break;
+			}
+			parseTokenValue(ctx, it, reservedToken::comma);
+		}
+		
+		if (!it->hasValue(reservedToken::open_curly)) {
+			throw unexpected_syntax(it);
+		}
+		
+		//The body is compiled when the expression is built. Its tokens are kept up
+		//to the closing brace, where it is left.
+		for (size_t nesting = 0;; ++it) {
+			if (it->isEof()) {
+				throw unexpectedSyntaxError("end of file", it->getLineNumber(), it->getCharIndex());
+			}
+			if (it->hasValue(reservedToken::open_curly)) {
+				++nesting;
+			} else if (it->hasValue(reservedToken::close_curly)) {
+				--nesting;
+			}
+			ret->body.push_back(*it);
+			if (nesting == 0) {
+				break;
+			}
+		}
+		
+		return ret;
+	}
+	
+	std::string layoutLine(typeHandle typeID, std::string_view name) {
+		return std::string(name) + ": " + std::to_string(typeID) + "\n";
+	}
+	
+	namespace {
+		//Whether values of the type only hold data, which means the same in any
+		//program, and no functions, which refer to the program they come from.
+		bool holds_only_data(typeHandle t) {
+			if (const arrayType* at = std::get_if<arrayType>(t)) {
+				return holds_only_data(at->inner_type_id);
+			}
+			if (const tupleType* tt = std::get_if<tupleType>(t)) {
+				return std::all_of(tt->inner_type_id.begin(), tt->inner_type_id.end(), holds_only_data);
+			}
+			if (const dictionaryType* dt = std::get_if<dictionaryType>(t)) {
+				return holds_only_data(dt->key_type_id) && holds_only_data(dt->inner_type_id);
+			}
+			return std::holds_alternative<simpleType>(*t);
+		}
+	}
+	
 	shared_statement_ptr compileFunctionBlock(compilerContext& ctx, tokensIterator& it, typeHandle return_type_id) {
-		std::vector<statement_ptr> block = compile_block_contents(ctx, it, possible_flow::in_function(return_type_id));
-		if (return_type_id != typeRegistry::getVoidHandle()) {
-			block.emplace_back(createReturnStatement(build_default_initialization(return_type_id)));
+		possible_flow pf = possible_flow::in_function(return_type_id);
+		std::vector<statement_ptr> block = compile_block_contents(ctx, it, pf);
+		if (pf.return_type_id != typeRegistry::getVoidHandle()) {
+			//Slot 0 of the frame holds the return value.
+			block.emplace_back(createReturnStatement(build_local_initialization(0, build_default_initialization(return_type_id))));
 		}
 		return createSharedBlockStatement(std::move(block));
 	}
 	
-	runtimeContext compile(
+	statement_ptr compileInlineBody(compilerContext& ctx, tokensIterator& it, typeHandle return_type_id) {
+		parseTokenValue(ctx, it, reservedToken::open_curly);
+		
+		std::vector<statement_ptr> block;
+		while (!it->hasValue(reservedToken::kw_return) && !it->hasValue(reservedToken::close_curly)) {
+			block.push_back(compile_statement(ctx, it, possible_flow::in_function(return_type_id), false));
+		}
+		
+		return createBlockStatement(std::move(block));
+	}
+	
+	struct functionBodies {
+		struct entry {
+			compiledBody body;
+			functionEffects effects;
+			//Serialized tokens of the function, and of the functions that the body
+			//may have inlined, by index. They are compared when a fingerprint
+			//matches, as fingerprints may collide.
+			std::string tokens;
+			std::vector<std::pair<size_t, std::string> > inlined;
+		};
+		
+		//Declarations and settings that the bodies were compiled against.
+		std::string declarations;
+		
+		//By fingerprint of the function, its index and the declarations.
+		std::unordered_map<uint64_t, entry> entries;
+	};
+	
+	std::shared_ptr<const program> compile(
 		tokensIterator& it,
+		std::shared_ptr<symbolTable> symbols,
 		const std::vector<std::pair<std::string, function> >& external_functions,
-		std::vector<std::string> public_declarations
+		std::vector<std::string> public_declarations,
+		size_t inline_budget,
+		size_t hot_threshold,
+		const std::vector<const nativeModule*>& native_modules,
+		const functionBodies* previous
 	) {
-		compilerContext ctx;
+		std::unique_ptr<hotFunctionCompiler> compiler = std::make_unique<hotFunctionCompiler>(
+			symbols, external_functions.size()
+		);
 		
-		for (const std::pair<std::string, function>& p : external_functions) {
-			get_character get = [i = 0, &p]() mutable {
-				if (i < p.first.size()){
-					return int(p.first[i++]);
-				} else {
-					return -1;
-				}
-			};
-			
-			push_back_stream stream(&get);
-			
-			tokensIterator function_it(stream);
+		compilerContext& ctx = compiler->context();
 		
-			functionDeclaration decl = parseFunctionDeclaration(ctx, function_it);
-			
-			ctx.createFunction(decl.name, decl.typeID);
+		std::string layout;
+		
+		//The layout, with the names of the globals, which function bodies are
+		//compiled against
+		std::string declarations;
+		
+		for (const functionDeclaration& decl : declareExternalFunctions(ctx, *symbols, external_functions)) {
+			layout += layoutLine(decl.typeID, decl.name.name);
+			declarations += layoutLine(decl.typeID, decl.name.name);
 		}
 		
-		std::unordered_map<std::string, typeHandle> public_function_types;
+		std::unordered_map<symbolId, typeHandle> public_function_types;
 		
 		for (const std::string& f : public_declarations) {
-			get_character get = [i = 0, &f]() mutable {
+			get_character get = [i = size_t(0), &f]() mutable {
 				if (i < f.size()){
 					return int(f[i++]);
 				} else {
@@ -520,16 +1307,17 @@ namespace cobalt {
 			
 			push_back_stream stream(&get);
 			
-			tokensIterator function_it(stream);
+			tokensIterator function_it(stream, *symbols);
 		
 			functionDeclaration decl = parseFunctionDeclaration(ctx, function_it);
 			
-			public_function_types.emplace(decl.name, decl.typeID);
+			public_function_types.emplace(decl.name.id, decl.typeID);
 		}
 
 		std::vector<expression<lvalue>::ptr> initializers;
+		std::vector<std::string> globals;
 		
-		std::vector<incompleteFunction> incomplete_functions;
+		std::vector<incompleteFunction>& incomplete_functions = compiler->functions();
 		std::unordered_map<std::string, size_t> public_functions;
 		
 		while (it) {
@@ -550,9 +1338,11 @@ namespace cobalt {
 						size_t lineNumber = it->getLineNumber();
 						size_t charIndex = it->getCharIndex();
 						const incompleteFunction& f = incomplete_functions.emplace_back(ctx, it);
+						layout += layoutLine(f.getDecl().typeID, f.getDecl().name.name);
+						declarations += layoutLine(f.getDecl().typeID, f.getDecl().name.name);
 						
 						if (public_function) {
-							auto it = public_function_types.find(f.getDecl().name);
+							auto it = public_function_types.find(f.getDecl().name.id);
 						
 							if (it != public_function_types.end() && it->second != f.getDecl().typeID) {
 								throw semanticError(
@@ -560,20 +1350,24 @@ namespace cobalt {
 									lineNumber,
 									charIndex
 								);
-							} else {
+							} else if (it != public_function_types.end()) {
 								public_function_types.erase(it);
 							}
 						
 							public_functions.emplace(
-								f.getDecl().name,
+								std::string(f.getDecl().name.name),
 								external_functions.size() + incomplete_functions.size() - 1
 							);
 						}
 						break;
 					}
 				default:
-					for (expression<lvalue>::ptr& expr : compile_variable_declaration(ctx, it)) {
-						initializers.push_back(std::move(expr));
+					for (variableDeclaration& decl : compile_variable_declaration(ctx, it)) {
+						layout += layoutLine(decl.info->typeID(), "");
+						declarations += layoutLine(decl.info->typeID(), decl.name.name);
+						compiler->addGlobal(decl.info->typeID());
+						globals.push_back(holds_only_data(decl.info->typeID()) ? layoutLine(decl.info->typeID(), decl.name.name) : "");
+						initializers.push_back(std::move(decl.init));
 					}
 					parseTokenValue(ctx, it, reservedToken::semicolon);
 					break;
@@ -582,24 +1376,161 @@ namespace cobalt {
 		
 		if (!public_function_types.empty()) {
 			throw semanticError(
-				"Public function '" + public_function_types.begin()->first + "' is not defined.",
+				"Public function '" + std::string(symbols->name(public_function_types.begin()->first)) + "' is not defined.",
 				it->getLineNumber(),
 				it->getCharIndex()
 			);
 		}
 		
-		std::vector<function> functions;
+		std::shared_ptr<program> ret = std::make_shared<program>();
+		std::vector<function>& functions = ret->functions;
 		
-		functions.reserve(external_functions.size() + incomplete_functions.size());
+		functions.reserve(incomplete_functions.size());
 		
-		for (const std::pair<std::string, function>& p : external_functions) {
-			functions.emplace_back(p.second);
+		//Native code generated for the same layout replaces the interpreted functions.
+		std::unordered_map<std::string_view, void (*)(runtimeContext&)> native_functions;
+		
+		for (const nativeModule* m : native_modules) {
+			if (m->layout == layout) {
+				for (const nativeFunction* f = m->functions; f->name; ++f) {
+					native_functions.emplace(f->name, f->f);
+				}
+			}
+		}
+		
+		std::vector<bool> inlinable(incomplete_functions.size(), false);
+		std::vector<std::string> tokens;
+		
+		for (size_t i = 0; i < incomplete_functions.size(); ++i) {
+			if (
+				incomplete_functions[i].canInline(inline_budget) &&
+				!native_functions.count(incomplete_functions[i].getDecl().name.name)
+			) {
+				ctx.addInlineCandidate(external_functions.size() + i, &incomplete_functions[i]);
+				inlinable[i] = true;
+			}
+			tokens.push_back(incomplete_functions[i].serializedTokens());
 		}
 		
-		for (incompleteFunction& f : incomplete_functions) {
-			functions.emplace_back(f.compile(ctx));
+		//Native code may write globals that the compiler never sees written, so
+		//modules using it are not recompiled.
+		bool profiled = hot_threshold != 0 && native_functions.empty();
+		
+		//A function may write globals if it does so itself, or calls one that does.
+		//Native functions and function values may do anything.
+		std::vector<bool> global_writers(external_functions.size(), false);
+		std::vector<std::vector<size_t> > callees(external_functions.size());
+		
+		//A body is compiled again only if the tokens of the function, the
+		//declarations, the settings, or the tokens of a function it may inline
+		//have changed since the previous program.
+		std::shared_ptr<functionBodies> bodies = std::make_shared<functionBodies>();
+		bodies->declarations = declarations + std::to_string(inline_budget) + (profiled ? " profiled" : "");
+		
+		uint64_t declarations_hash = fnv1a(fnv_offset_basis, bodies->declarations.data(), bodies->declarations.size());
+		
+		if (previous && previous->declarations != bodies->declarations) {
+			previous = nullptr;
 		}
 		
-		return runtimeContext(std::move(initializers), std::move(functions), std::move(public_functions));
+		for (size_t i = 0; i < incomplete_functions.size(); ++i) {
+			incompleteFunction& f = incomplete_functions[i];
+			auto native = native_functions.find(f.getDecl().name.name);
+			
+			if (native != native_functions.end()) {
+				functions.emplace_back(native->second);
+				global_writers.push_back(true);
+				callees.emplace_back();
+			} else {
+				uint64_t fingerprint = fnv1a(declarations_hash, &i, sizeof(i));
+				fingerprint = fnv1a(fingerprint, tokens[i].data(), tokens[i].size());
+				
+				const functionBodies::entry* compiled = nullptr;
+				
+				if (previous) {
+					auto found = previous->entries.find(fingerprint);
+					if (found != previous->entries.end() && found->second.tokens == tokens[i] && std::all_of(
+						found->second.inlined.begin(),
+						found->second.inlined.end(),
+						[&](const std::pair<size_t, std::string>& callee) {
+							return tokens[callee.first - external_functions.size()] == callee.second;
+						}
+					)) {
+						compiled = &found->second;
+					}
+				}
+				
+				ctx.profileFunction(profiled ? std::optional<size_t>(external_functions.size() + i) : std::nullopt);
+				
+				if (compiled) {
+					functions.emplace_back(f.compile(ctx, &compiled->body));
+					ctx.replayEffects(compiled->effects);
+				} else {
+					functions.emplace_back(f.compile(ctx));
+				}
+				
+				const functionEffects& effects = ctx.effects();
+				global_writers.push_back(effects.writes_globals || effects.calls_values);
+				callees.push_back(effects.callees);
+				
+				functionBodies::entry& e = bodies->entries[fingerprint];
+				e.body = f.body();
+				e.effects = effects;
+				e.tokens = tokens[i];
+				for (size_t callee : effects.callees) {
+					if (callee >= external_functions.size() && inlinable[callee - external_functions.size()]) {
+						e.inlined.emplace_back(callee, tokens[callee - external_functions.size()]);
+					}
+				}
+			}
+		}
+		
+		ctx.profileFunction(std::nullopt);
+		
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (size_t i = 0; i < global_writers.size(); ++i) {
+				if (!global_writers[i] && std::any_of(callees[i].begin(), callees[i].end(), [&](size_t callee) {
+					return global_writers[callee];
+				})) {
+					global_writers[i] = true;
+					changed = true;
+				}
+			}
+		}
+		
+		if (profiled) {
+			compiler->addHotInlineCandidates(inline_budget);
+			ret->opt = std::move(compiler);
+		}
+		
+		ret->initializers = std::make_shared<const std::vector<expression<lvalue>::ptr> >(std::move(initializers));
+		ret->public_functions = std::move(public_functions);
+		ret->global_writers = std::move(global_writers);
+		ret->globals = std::move(globals);
+		ret->hot_threshold = profiled ? hot_threshold : 0;
+		ret->bodies = std::move(bodies);
+		return ret;
+	}
+	
+	runtimeContext createContext(
+		const program& p,
+		const std::vector<std::pair<std::string, function> >& external_functions,
+		memoryAccountPtr account,
+		const std::vector<variablePtr>& kept
+	) {
+		std::vector<function> functions;
+		
+		functions.reserve(external_functions.size() + p.functions.size());
+		
+		for (const std::pair<std::string, function>& e : external_functions) {
+			functions.emplace_back(e.second);
+		}
+		
+		functions.insert(functions.end(), p.functions.begin(), p.functions.end());
+		
+		runtimeContext ret(p.initializers, std::move(functions), p.public_functions, p.opt, p.hot_threshold, std::move(account), kept);
+		ret.setGlobalWriters(p.global_writers);
+		return ret;
 	}
 }
@@ -4,30 +4,121 @@
 #include "types.hpp"
 #include "tokens.hpp"
 #include "statement.hpp"
+#include "runtimeContext.hpp"
 
 #include <vector>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 
 namespace cobalt {
 	class compilerContext;
+	class symbolTable;
 	class tokensIterator;
-	class runtimeContext;
+	struct functionDeclaration;
+	struct nativeModule;
+	struct functionBodies;
+	struct lambdaLiteral;
 	
 	using function = std::function<void(runtimeContext&)>;
 
-	runtimeContext compile(
+	//Module compiled apart from its external functions. Functions are indexed
+	//after the externals. It is not changed once compiled, so modules that
+	//load the same source with the same external declarations share it.
+	struct program {
+		std::shared_ptr<const std::vector<expression<lvalue>::ptr> > initializers;
+		std::vector<function> functions;
+		std::unordered_map<std::string, size_t> public_functions;
+		std::vector<bool> global_writers;
+		//Name and type of each global that a later program of the module may keep,
+		//or an empty string.
+		std::vector<std::string> globals;
+		std::shared_ptr<optimizer> opt;
+		size_t hot_threshold = 0;
+		std::shared_ptr<const functionBodies> bodies;
+	};
+	
+	//With a nonzero hot_threshold, contexts of the returned program profile the
+	//functions and compile them again once they get hot, which needs the symbols.
+	//Only the declarations of external_functions are used. Function bodies of the
+	//previous program of the module are reused where the function, and all it is
+	//compiled against, is unchanged.
+	std::shared_ptr<const program> compile(
 		tokensIterator& it,
+		std::shared_ptr<symbolTable> symbols,
+		const std::vector<std::pair<std::string, function> >& external_functions,
+		std::vector<std::string> public_declarations,
+		size_t inline_budget,
+		size_t hot_threshold,
+		const std::vector<const nativeModule*>& native_modules,
+		const functionBodies* previous = nullptr
+	);
+	
+	//Context that runs p, calling external_functions, which must have the
+	//declarations p was compiled with. What it creates is charged to account.
+	//Globals that kept holds a variable for at their index take it instead of
+	//running their initializers.
+	runtimeContext createContext(
+		const program& p,
 		const std::vector<std::pair<std::string, function> >& external_functions,
-		std::vector<std::string> public_declarations
+		memoryAccountPtr account = nullptr,
+		const std::vector<variablePtr>& kept = {}
 	);
 	
+	//Line of the layout of a module, which lists its functions and globals in the
+	//order that gives them their indices. Globals are listed without a name.
+	std::string layoutLine(typeHandle typeID, std::string_view name);
+	
 	typeHandle parseType(compilerContext& ctx, tokensIterator& it);
+	
+	//Whether the token starts a type, and so a declaration where a statement is
+	//expected.
+	bool isTypename(const tokensIterator& it);
+	
+	//Declaration of variables of one type, up to the token after the last one.
+	//declare is called for each variable, in order, with whether an initializer
+	//follows, which it then has to parse.
+	void parseVariableDeclaration(
+		compilerContext& ctx,
+		tokensIterator& it,
+		const std::function<void(typeHandle typeID, const identifier& name, bool initialized)>& declare
+	);
+	
+	//Whether the token starts a case or default label of a switch statement.
+	bool isSwitchLabel(const tokensIterator& it);
+	
+	//Label of a switch statement, up to its colon: the number of a case, or
+	//nothing for the default.
+	std::optional<number> parseSwitchLabel(compilerContext& ctx, tokensIterator& it);
+	
+	//Number of nested loops and switches, at most depth, that a break statement
+	//leaves, parsed up to its semicolon.
+	size_t parseBreakStatement(compilerContext& ctx, tokensIterator& it, size_t depth);
+	
+	//Declares the external functions of a module in ctx, parsed as the module
+	//declares them.
+	std::vector<functionDeclaration> declareExternalFunctions(
+		compilerContext& ctx,
+		symbolTable& symbols,
+		const std::vector<std::pair<std::string, function> >& external_functions
+	);
+	
+	//Lambda, from the function keyword up to the closing brace of its body, where
+	//it is left.
+	std::shared_ptr<const lambdaLiteral> parseLambda(compilerContext& ctx, tokensIterator& it);
 
-	std::string parseDeclarationName(compilerContext& ctx, tokensIterator& it);
+	identifier parseDeclarationName(compilerContext& ctx, tokensIterator& it);
 	
 	void parseTokenValue(compilerContext& ctx, tokensIterator& it, const tokenValue& value);
 	
 	shared_statement_ptr compileFunctionBlock(compilerContext& ctx, tokensIterator& it, typeHandle return_type_id);
+	
+	//Compiles the body of a function being inlined, up to its final return
+	//statement or closing brace, whichever comes first.
+	statement_ptr compileInlineBody(compilerContext& ctx, tokensIterator& it, typeHandle return_type_id);
 }
 
 #endif /* compiler_hpp */
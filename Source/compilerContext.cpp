@@ -1,4 +1,5 @@
 #include "compilerContext.hpp"
+#include <algorithm>
 
 namespace cobalt{
 	identifierInfo::identifierInfo(typeHandle typeID, size_t index, identifierScope scope) :
@@ -20,15 +21,19 @@ namespace cobalt{
 		return _scope;
 	}
 
-	const identifierInfo* identifierLookup::insertIdentifier(std::string name, typeHandle typeID, size_t index, identifierScope scope) {
-		return &_identifiers.emplace(std::move(name), identifierInfo(typeID, index, scope)).first->second;
+	const identifierInfo* identifierLookup::insertIdentifier(symbolId name, typeHandle typeID, size_t index, identifierScope scope) {
+		return &_identifiers.emplace(name, identifierInfo(typeID, index, scope)).first->second;
+	}
+	
+	void identifierLookup::eraseIdentifier(symbolId name) {
+		_identifiers.erase(name);
 	}
 	
 	size_t identifierLookup::identifiersSize() const {
 		return _identifiers.size();
 	}
 
-	const identifierInfo* identifierLookup::find(const std::string& name) const {
+	const identifierInfo* identifierLookup::find(symbolId name) const {
 		if (auto it = _identifiers.find(name); it != _identifiers.end()) {
 			return &it->second;
 		} else {
@@ -36,33 +41,42 @@ namespace cobalt{
 		}
 	}
 	
-	bool identifierLookup::canDeclare(const std::string& name) const {
+	bool identifierLookup::canDeclare(symbolId name) const {
 		return _identifiers.find(name) == _identifiers.end();
 	}
 	
 	identifierLookup::~identifierLookup() {
 	}
 
-	const identifierInfo* globalVariableLookup::createIdentifier(std::string name, typeHandle typeID) {
-		return insertIdentifier(std::move(name), typeID, identifiersSize(), identifierScope::global_variable);
+	const identifierInfo* globalVariableLookup::createIdentifier(symbolId name, typeHandle typeID) {
+		return insertIdentifier(name, typeID, identifiersSize(), identifierScope::global_variable);
 	}
 
-	localVariableLookup::localVariableLookup(std::unique_ptr<localVariableLookup> parent_lookup) :
+	localVariableLookup::localVariableLookup(std::unique_ptr<localVariableLookup> parent_lookup, bool isolated) :
 		_parent(std::move(parent_lookup)),
-		_next_identifier_index(_parent ? _parent->_next_identifier_index : 1)
+		_next_identifier_index(_parent ? _parent->_next_identifier_index : 1),
+		_isolated(isolated)
 	{
 	}
 	
-	const identifierInfo* localVariableLookup::find(const std::string& name) const {
+	const identifierInfo* localVariableLookup::find(symbolId name) const {
 		if (const identifierInfo* ret = identifierLookup::find(name)) {
 			return ret;
 		} else {
-			return _parent ? _parent->find(name) : nullptr;
+			return _parent && !_isolated ? _parent->find(name) : nullptr;
 		}
 	}
 
-	const identifierInfo* localVariableLookup::createIdentifier(std::string name, typeHandle typeID) {
-		return insertIdentifier(std::move(name), typeID, _next_identifier_index++, identifierScope::local_variable);
+	const identifierInfo* localVariableLookup::createIdentifier(symbolId name, typeHandle typeID) {
+		return insertIdentifier(name, typeID, _next_identifier_index++, identifierScope::local_variable);
+	}
+	
+	const identifierInfo* localVariableLookup::bindIdentifier(symbolId name, typeHandle typeID, size_t index) {
+		return insertIdentifier(name, typeID, index, identifierScope::local_variable);
+	}
+	
+	size_t localVariableLookup::reserveIndex() {
+		return _next_identifier_index++;
 	}
 	
 	std::unique_ptr<localVariableLookup> localVariableLookup::detach_parent() {
@@ -75,16 +89,29 @@ namespace cobalt{
 	{
 	}
 	
-	const identifierInfo* paramLookup::createParam(std::string name, typeHandle typeID) {
-		return insertIdentifier(std::move(name), typeID, _next_param_index--, identifierScope::local_variable);
+	const identifierInfo* paramLookup::createParam(symbolId name, typeHandle typeID) {
+		return insertIdentifier(name, typeID, _next_param_index--, identifierScope::local_variable);
+	}
+	
+	functionLookup::functionLookup() :
+		_next_index(0)
+	{
+	}
+	
+	const identifierInfo* functionLookup::createIdentifier(symbolId name, typeHandle typeID) {
+		return insertIdentifier(name, typeID, _next_index++, identifierScope::function);
 	}
 	
-	const identifierInfo* functionLookup::createIdentifier(std::string name, typeHandle typeID) {
-		return insertIdentifier(std::move(name), typeID, identifiersSize(), identifierScope::function);
+	void functionLookup::hide(symbolId name) {
+		eraseIdentifier(name);
 	}
 
-	compilerContext::compilerContext() :
-		_params(nullptr)
+	compilerContext::compilerContext(symbolTable& symbols) :
+		_symbols(symbols),
+		_params(nullptr),
+		_frame_size(1),
+		_calls(0),
+		_effects{false, false, {}, {}}
 	{
 	}
 	
@@ -92,7 +119,15 @@ namespace cobalt{
 		return _types.getHandle(t);
 	}
 	
-	const identifierInfo* compilerContext::find(const std::string& name) const {
+	identifier compilerContext::intern(std::string name) {
+		return _symbols.intern(std::move(name));
+	}
+	
+	std::string_view compilerContext::name(symbolId id) const {
+		return _symbols.name(id);
+	}
+	
+	const identifierInfo* compilerContext::find(symbolId name) const {
 		if (_locals) {
 			if (const identifierInfo* ret = _locals->find(name)) {
 				return ret;
@@ -104,30 +139,54 @@ namespace cobalt{
 		return _globals.find(name);
 	}
 	
-	const identifierInfo* compilerContext::createIdentifier(std::string name, typeHandle typeID) {
+	const identifierInfo* compilerContext::createIdentifier(symbolId name, typeHandle typeID) {
 		if (_locals) {
-			return _locals->createIdentifier(std::move(name), typeID);
+			const identifierInfo* ret = _locals->createIdentifier(name, typeID);
+			_frame_size = std::max(_frame_size, ret->index() + 1);
+			return ret;
 		} else {
-			return _globals.createIdentifier(std::move(name), typeID);
+			shadowExternal(name);
+			return _globals.createIdentifier(name, typeID);
 		}
 	}
 	
-	const identifierInfo* compilerContext::createParam(std::string name, typeHandle typeID) {
-		return _params->createParam(name, typeID);
+	const identifierInfo* compilerContext::createParam(symbolId name, typeHandle typeID, bool reference) {
+		const identifierInfo* ret = _params->createParam(name, typeID);
+		if (reference) {
+			_references.insert(ret);
+		}
+		return ret;
 	}
 	
-	const identifierInfo* compilerContext::createFunction(std::string name, typeHandle typeID) {
+	const identifierInfo* compilerContext::createFunction(symbolId name, typeHandle typeID) {
+		shadowExternal(name);
 		return _functions.createIdentifier(name, typeID);
 	}
 	
-	void compilerContext::enterScope() {
-		_locals = std::make_unique<localVariableLookup>(std::move(_locals));
+	const identifierInfo* compilerContext::createExternalFunction(symbolId name, typeHandle typeID) {
+		shadowExternal(name);
+		_externals.insert(name);
+		return _functions.createIdentifier(name, typeID);
+	}
+	
+	void compilerContext::shadowExternal(symbolId name) {
+		if (_externals.erase(name)) {
+			_functions.hide(name);
+		}
+	}
+	
+	void compilerContext::enterScope(bool isolated) {
+		_locals = std::make_unique<localVariableLookup>(std::move(_locals), isolated);
 	}
 	
 	void compilerContext::enterFunction() {
 		std::unique_ptr<paramLookup> params = std::make_unique<paramLookup>();
 		_params = params.get();
 		_locals = std::move(params);
+		_frame_size = 1;
+		_written_locals.clear();
+		_references.clear();
+		_effects = functionEffects{false, false, {}, {}};
 	}
 	
 	void compilerContext::leaveScope() {
@@ -138,22 +197,162 @@ namespace cobalt{
 		_locals = _locals->detach_parent();
 	}
 	
-	bool compilerContext::canDeclare(const std::string& name) const {
-		return _locals ? _locals->canDeclare(name) : (_globals.canDeclare(name) && _functions.canDeclare(name));
+	bool compilerContext::canDeclare(symbolId name) const {
+		return _locals ? _locals->canDeclare(name) : (
+			_globals.canDeclare(name) && (_functions.canDeclare(name) || _externals.count(name) != 0)
+		);
+	}
+	
+	size_t compilerContext::frameSize() const {
+		return _frame_size;
+	}
+	
+	size_t compilerContext::reserveLocal() {
+		size_t ret = _locals->reserveIndex();
+		_frame_size = std::max(_frame_size, ret + 1);
+		return ret;
+	}
+	
+	const identifierInfo* compilerContext::bindLocal(symbolId name, typeHandle typeID, size_t index, bool reference) {
+		const identifierInfo* ret = _locals->bindIdentifier(name, typeID, index);
+		if (reference) {
+			_references.insert(ret);
+		}
+		return ret;
+	}
+	
+	bool compilerContext::isReference(const identifierInfo* info) const {
+		return _references.count(info) != 0;
+	}
+	
+	void compilerContext::markCapturedByReference(symbolId name) {
+		if (const identifierInfo* info = _locals ? _locals->find(name) : nullptr) {
+			_written_locals.push_back(info->index());
+			_references.insert(info);
+		}
+	}
+	
+	void compilerContext::addInlineCandidate(size_t functionIndex, incompleteFunction* f) {
+		_inline_candidates.emplace(functionIndex, f);
+	}
+	
+	incompleteFunction* compilerContext::findInlineCandidate(size_t functionIndex) const {
+		const size_t max_expansion_depth = 4;
+		
+		if (!_locals || _expanding.size() > max_expansion_depth) {
+			return nullptr;
+		}
+		
+		auto it = _inline_candidates.find(functionIndex);
+		
+		if (it == _inline_candidates.end() || std::count(_expanding.begin(), _expanding.end(), it->second)) {
+			return nullptr;
+		}
+		
+		return it->second;
+	}
+	
+	void compilerContext::markWritten(symbolId name) {
+		if (_locals) {
+			if (const identifierInfo* info = _locals->find(name)) {
+				_written_locals.push_back(info->index());
+				return;
+			}
+		}
+		if (const identifierInfo* info = find(name); info && info->getScope() == identifierScope::global_variable) {
+			_written_globals.insert(info->index());
+			_effects.writes_globals = true;
+			_effects.written_globals.push_back(info->index());
+		}
+	}
+	
+	bool compilerContext::isGlobalWritten(size_t index) const {
+		return _written_globals.count(index) != 0;
+	}
+	
+	void compilerContext::setConstantGlobals(std::unordered_map<size_t, variablePtr> constants) {
+		_constant_globals = std::move(constants);
+	}
+	
+	const variablePtr* compilerContext::findConstantGlobal(size_t index) const {
+		auto it = _constant_globals.find(index);
+		return it == _constant_globals.end() ? nullptr : &it->second;
+	}
+	
+	void compilerContext::profileFunction(std::optional<size_t> functionIndex) {
+		_profiled_function = functionIndex;
+	}
+	
+	std::optional<size_t> compilerContext::profiledFunction() const {
+		return _profiled_function;
+	}
+	
+	void compilerContext::markCall(std::optional<size_t> functionIndex) {
+		++_calls;
+		if (functionIndex) {
+			_effects.callees.push_back(*functionIndex);
+		} else {
+			_effects.calls_values = true;
+		}
+	}
+	
+	void compilerContext::markGlobalElement() {
+		_effects.writes_globals = true;
+	}
+	
+	const functionEffects& compilerContext::effects() const {
+		return _effects;
+	}
+	
+	void compilerContext::replayEffects(const functionEffects& effects) {
+		_effects = effects;
+		_written_globals.insert(effects.written_globals.begin(), effects.written_globals.end());
+	}
+	
+	compilerContext::sideEffectsMark compilerContext::sideEffects() const {
+		return sideEffectsMark{_written_locals.size(), _calls};
+	}
+	
+	bool compilerContext::isWrittenSince(const sideEffectsMark& mark, size_t index) const {
+		return std::find(_written_locals.begin() + mark.writes, _written_locals.end(), index) != _written_locals.end();
+	}
+	
+	bool compilerContext::hasCallsSince(const sideEffectsMark& mark) const {
+		return _calls != mark.calls;
+	}
+	
+	compilerContext::inBoundsRaii compilerContext::assumeInBounds(size_t arrayIndex, size_t index) {
+		return inBoundsRaii(*this, arrayIndex, index);
+	}
+	
+	bool compilerContext::isInBounds(size_t arrayIndex, size_t index) const {
+		return std::count(_in_bounds.begin(), _in_bounds.end(), std::make_pair(arrayIndex, index)) != 0;
 	}
 	
 	compilerContext::scopeRaii compilerContext::scope() {
-		return scopeRaii(*this);
+		return scopeRaii(*this, false);
+	}
+	
+	compilerContext::lambdaRaii compilerContext::lambda() {
+		return lambdaRaii(*this);
+	}
+	
+	compilerContext::scopeRaii compilerContext::inlineScope() {
+		return scopeRaii(*this, true);
+	}
+	
+	compilerContext::expansionRaii compilerContext::expand(const incompleteFunction* f) {
+		return expansionRaii(*this, f);
 	}
 	
 	compilerContext::functionRaii compilerContext::function() {
 		return functionRaii(*this);
 	}
 	
-	compilerContext::scopeRaii::scopeRaii(compilerContext& context):
+	compilerContext::scopeRaii::scopeRaii(compilerContext& context, bool isolated):
 		_context(context)
 	{
-		_context.enterScope();
+		_context.enterScope(isolated);
 	}
 	
 	compilerContext::scopeRaii::~scopeRaii() {
@@ -169,4 +368,63 @@ namespace cobalt{
 	compilerContext::functionRaii::~functionRaii() {
 		_context.leaveScope();
 	}
+	
+	compilerContext::lambdaRaii::lambdaRaii(compilerContext& context):
+		_context(context),
+		_params(context._params),
+		_locals(std::move(context._locals)),
+		_frame_size(context._frame_size),
+		_written_locals(std::move(context._written_locals)),
+		_references(std::move(context._references)),
+		_in_bounds(std::move(context._in_bounds)),
+		_effects(std::move(context._effects))
+	{
+		//Slots of the body start over, so what is known about the slots of the
+		//enclosing function does not apply to them.
+		std::unique_ptr<paramLookup> params = std::make_unique<paramLookup>();
+		_context._params = params.get();
+		_context._locals = std::move(params);
+		_context._frame_size = 1;
+		_context._written_locals.clear();
+		_context._references.clear();
+		_context._in_bounds.clear();
+		_context._effects = functionEffects{false, false, {}, {}};
+	}
+	
+	compilerContext::lambdaRaii::~lambdaRaii() {
+		_context._params = _params;
+		_context._locals = std::move(_locals);
+		_context._frame_size = _frame_size;
+		_context._written_locals = std::move(_written_locals);
+		_context._references = std::move(_references);
+		_context._in_bounds = std::move(_in_bounds);
+		
+		//Which globals are ever written is known for the whole module, so reusing
+		//the body of the enclosing function must replay the writes of the lambda.
+		std::vector<size_t> written_globals = std::move(_context._effects.written_globals);
+		_context._effects = std::move(_effects);
+		_context._effects.written_globals.insert(
+			_context._effects.written_globals.end(), written_globals.begin(), written_globals.end()
+		);
+	}
+	
+	compilerContext::inBoundsRaii::inBoundsRaii(compilerContext& context, size_t arrayIndex, size_t index):
+		_context(context)
+	{
+		_context._in_bounds.emplace_back(arrayIndex, index);
+	}
+	
+	compilerContext::inBoundsRaii::~inBoundsRaii() {
+		_context._in_bounds.pop_back();
+	}
+	
+	compilerContext::expansionRaii::expansionRaii(compilerContext& context, const incompleteFunction* f):
+		_context(context)
+	{
+		_context._expanding.push_back(f);
+	}
+	
+	compilerContext::expansionRaii::~expansionRaii() {
+		_context._expanding.pop_back();
+	}
 }
@@ -2,12 +2,18 @@
 #define compilerContext_hpp
 
 #include <unordered_map>
+#include <unordered_set>
 #include <memory>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include "types.hpp"
+#include "tokens.hpp"
+#include "variable.hpp"
 
 namespace cobalt {
+	class incompleteFunction;
 
 	enum struct identifierScope {
 		global_variable,
@@ -32,35 +38,41 @@ namespace cobalt {
 	
 	class identifierLookup {
 	private:
-		std::unordered_map<std::string, identifierInfo> _identifiers;
+		std::unordered_map<symbolId, identifierInfo> _identifiers;
 	protected:
-		const identifierInfo* insertIdentifier(std::string name, typeHandle typeID, size_t index, identifierScope scope);
+		const identifierInfo* insertIdentifier(symbolId name, typeHandle typeID, size_t index, identifierScope scope);
+		void eraseIdentifier(symbolId name);
 		size_t identifiersSize() const;
 	public:
-		virtual const identifierInfo* find(const std::string& name) const;
+		virtual const identifierInfo* find(symbolId name) const;
 		
-		virtual const identifierInfo* createIdentifier(std::string name, typeHandle typeID) = 0;
+		virtual const identifierInfo* createIdentifier(symbolId name, typeHandle typeID) = 0;
 		
-		bool canDeclare(const std::string& name) const;
+		bool canDeclare(symbolId name) const;
 		
 		virtual ~identifierLookup();
 	};
 	
 	class globalVariableLookup: public identifierLookup {
 	public:
-		const identifierInfo* createIdentifier(std::string name, typeHandle typeID) override;
+		const identifierInfo* createIdentifier(symbolId name, typeHandle typeID) override;
 	};
 	
 	class localVariableLookup: public identifierLookup {
 	private:
 		std::unique_ptr<localVariableLookup> _parent;
 		int _next_identifier_index;
+		bool _isolated;
 	public:
-		localVariableLookup(std::unique_ptr<localVariableLookup> parent_lookup);
+		localVariableLookup(std::unique_ptr<localVariableLookup> parent_lookup, bool isolated = false);
 		
-		const identifierInfo* find(const std::string& name) const override;
+		const identifierInfo* find(symbolId name) const override;
 
-		const identifierInfo* createIdentifier(std::string name, typeHandle typeID) override;
+		const identifierInfo* createIdentifier(symbolId name, typeHandle typeID) override;
+		
+		const identifierInfo* bindIdentifier(symbolId name, typeHandle typeID, size_t index);
+		
+		size_t reserveIndex();
 		
 		std::unique_ptr<localVariableLookup> detach_parent();
 	};
@@ -71,30 +83,75 @@ namespace cobalt {
 	public:
 		paramLookup();
 		
-		const identifierInfo* createParam(std::string name, typeHandle typeID);
+		const identifierInfo* createParam(symbolId name, typeHandle typeID);
 	};
 	
 	class functionLookup: public identifierLookup {
+	private:
+		size_t _next_index;
 	public:
-		const identifierInfo* createIdentifier(std::string name, typeHandle typeID) override;
+		functionLookup();
+		
+		const identifierInfo* createIdentifier(symbolId name, typeHandle typeID) override;
+		
+		//The function keeps its index, but is no longer found by name.
+		void hide(symbolId name);
+	};
+	
+	//What a function does that running it on several threads at once could conflict
+	//on, besides what the functions it calls do.
+	struct functionEffects {
+		bool writes_globals;
+		bool calls_values;
+		std::vector<size_t> callees;
+		std::vector<size_t> written_globals;
 	};
 	
 	class compilerContext {
 	private:
+		symbolTable& _symbols;
 		functionLookup _functions;
+		std::unordered_set<symbolId> _externals;
 		globalVariableLookup _globals;
 		paramLookup* _params;
 		std::unique_ptr<localVariableLookup> _locals;
+		size_t _frame_size;
+		std::unordered_map<size_t, incompleteFunction*> _inline_candidates;
+		std::vector<const incompleteFunction*> _expanding;
+		std::vector<size_t> _written_locals;
+		size_t _calls;
+		std::vector<std::pair<size_t, size_t> > _in_bounds;
+		std::unordered_set<const identifierInfo*> _references;
+		std::unordered_set<size_t> _written_globals;
+		std::unordered_map<size_t, variablePtr> _constant_globals;
+		std::optional<size_t> _profiled_function;
+		functionEffects _effects;
 		typeRegistry _types;
 		
 		class scopeRaii {
 		private:
 			compilerContext& _context;
 		public:
-			scopeRaii(compilerContext& context);
+			scopeRaii(compilerContext& context, bool isolated);
 			~scopeRaii();
 		};
 		
+		class expansionRaii {
+		private:
+			compilerContext& _context;
+		public:
+			expansionRaii(compilerContext& context, const incompleteFunction* f);
+			~expansionRaii();
+		};
+		
+		class inBoundsRaii {
+		private:
+			compilerContext& _context;
+		public:
+			inBoundsRaii(compilerContext& context, size_t arrayIndex, size_t index);
+			~inBoundsRaii();
+		};
+		
 		class functionRaii {
 		private:
 			compilerContext& _context;
@@ -103,26 +160,140 @@ namespace cobalt {
 			~functionRaii();
 		};
 		
+		class lambdaRaii {
+			lambdaRaii(const lambdaRaii&) = delete;
+			void operator=(const lambdaRaii&) = delete;
+		private:
+			compilerContext& _context;
+			paramLookup* _params;
+			std::unique_ptr<localVariableLookup> _locals;
+			size_t _frame_size;
+			std::vector<size_t> _written_locals;
+			std::unordered_set<const identifierInfo*> _references;
+			std::vector<std::pair<size_t, size_t> > _in_bounds;
+			functionEffects _effects;
+		public:
+			lambdaRaii(compilerContext& context);
+			~lambdaRaii();
+		};
+		
 		void enterFunction();
-		void enterScope();
+		void enterScope(bool isolated);
 		void leaveScope();
+		void shadowExternal(symbolId name);
 	public:
-		compilerContext();
+		compilerContext(symbolTable& symbols);
 		
 		typeHandle getHandle(const type& t);
 		
-		const identifierInfo* find(const std::string& name) const;
+		identifier intern(std::string name);
+		
+		std::string_view name(symbolId id) const;
+		
+		const identifierInfo* find(symbolId name) const;
+		
+		const identifierInfo* createIdentifier(symbolId name, typeHandle typeID);
+		
+		const identifierInfo* createParam(symbolId name, typeHandle typeID, bool reference);
 		
-		const identifierInfo* createIdentifier(std::string name, typeHandle typeID);
+		const identifierInfo* createFunction(symbolId name, typeHandle typeID);
 		
-		const identifierInfo* createParam(std::string name, typeHandle typeID);
+		//Function provided by the host. A global or function that the script
+		//declares with the same name shadows it, so new builtins don't break
+		//scripts that already use their names, and so does a later external.
+		const identifierInfo* createExternalFunction(symbolId name, typeHandle typeID);
 		
-		const identifierInfo* createFunction(std::string name, typeHandle typeID);
+		bool canDeclare(symbolId name) const;
 		
-		bool canDeclare(const std::string& name) const;
+		//Number of stack slots, retval included, needed by the innermost function
+		//compiled so far. Sibling scopes share slots, so it is the deepest nesting.
+		size_t frameSize() const;
+		
+		//Allocates a slot in the current frame that no name refers to.
+		size_t reserveLocal();
+		
+		//Makes name refer to a slot allocated with reserveLocal.
+		const identifierInfo* bindLocal(symbolId name, typeHandle typeID, size_t index, bool reference);
+		
+		//Whether a local variable is a parameter received by reference, which
+		//might be changed by writes to whatever it refers to.
+		bool isReference(const identifierInfo* info) const;
+		
+		//Logs a capture of the local variable name by reference. Calls may write it
+		//from then on, as if it were a parameter received by reference.
+		void markCapturedByReference(symbolId name);
+		
+		void addInlineCandidate(size_t functionIndex, incompleteFunction* f);
+		
+		//Returns the function to substitute for a call, or nullptr if the call has
+		//to stay a call: outside function bodies, for recursion, or too deep nesting.
+		incompleteFunction* findInlineCandidate(size_t functionIndex) const;
+		
+		//Position in the log of writes and calls compiled so far.
+		struct sideEffectsMark {
+			size_t writes;
+			size_t calls;
+		};
+		
+		//Logs an assignment, increment or by-reference argument that targets name.
+		//Only local variables are logged, as anything may change a global. Globals
+		//are only remembered as written.
+		void markWritten(symbolId name);
+		
+		//Whether any code compiled so far writes the global variable directly.
+		bool isGlobalWritten(size_t index) const;
+		
+		//Makes the code compiled from now on read the global variables with the given
+		//indices as constants holding the values of the variables.
+		void setConstantGlobals(std::unordered_map<size_t, variablePtr> constants);
+		
+		const variablePtr* findConstantGlobal(size_t index) const;
+		
+		//Function whose calls and loop iterations the code compiled from now on
+		//counts in the runtime profile, if any.
+		void profileFunction(std::optional<size_t> functionIndex);
+		
+		std::optional<size_t> profiledFunction() const;
+		
+		//Logs a call of the function with the given index, or of a function value.
+		void markCall(std::optional<size_t> functionIndex);
+		
+		//Logs an access to an element of a global variable, which may add the element.
+		void markGlobalElement();
+		
+		//Effects of the code compiled since the current function was entered.
+		const functionEffects& effects() const;
+		
+		//Logs the effects of a function whose body, compiled before, is used
+		//instead of compiling it again.
+		void replayEffects(const functionEffects& effects);
+		
+		sideEffectsMark sideEffects() const;
+		
+		bool isWrittenSince(const sideEffectsMark& mark, size_t index) const;
+		
+		bool hasCallsSince(const sideEffectsMark& mark) const;
+		
+		//While the returned object lives, the number in local slot index is known
+		//to be a valid position in the array in local slot arrayIndex.
+		inBoundsRaii assumeInBounds(size_t arrayIndex, size_t index);
+		
+		bool isInBounds(size_t arrayIndex, size_t index) const;
 		
 		scopeRaii scope();
 		functionRaii function();
+		
+		//Scope for the body of a lambda, compiled within the function that creates
+		//it. The body has a frame of its own and only sees its own names, functions
+		//and globals. Its effects are its own, not those of the enclosing function.
+		lambdaRaii lambda();
+		
+		//Scope for an inlined body. It allocates from the current frame, but only
+		//sees its own names, functions and globals.
+		scopeRaii inlineScope();
+		
+		//Marks f as being compiled, which keeps it from being inlined into itself.
+		expansionRaii expand(const incompleteFunction* f);
 	};
 }
 
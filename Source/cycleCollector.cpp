@@ -0,0 +1,223 @@
+#include "cycleCollector.hpp"
+#include <algorithm>
+#include <typeinfo>
+#include <unordered_map>
+
+namespace cobalt {
+	namespace {
+		struct stateCaller {
+			std::shared_ptr<functionState> state;
+			
+			void operator()(runtimeContext& ctx) const {
+				state->call(ctx);
+			}
+		};
+		
+		functionState* heldState(const variable& v) {
+			if (typeid(v) == typeid(variableImpl<function>)) {
+				return functionStateOf(static_cast<const variableImpl<function>&>(v).value);
+			}
+			return nullptr;
+		}
+		
+		//Variables that may be part of a cycle: containers, and functions with a state.
+		bool isTraced(const variable& v) {
+			const std::type_info& type = typeid(v);
+			return type == typeid(variableImpl<array>) || type == typeid(variableImpl<dictionary>) || heldState(v);
+		}
+		
+		struct node {
+			variable* var;
+			functionState* state;
+			long external;
+			bool alive;
+		};
+		
+		class graph {
+		private:
+			std::unordered_map<const void*, size_t> _index;
+		public:
+			std::vector<node> nodes;
+			
+			size_t add(variable* var, functionState* state) {
+				const void* key = var ? static_cast<const void*>(var) : static_cast<const void*>(state);
+				auto [it, inserted] = _index.emplace(key, nodes.size());
+				if (inserted) {
+					long count = var ? var->weak_from_this().use_count() : state->weak_from_this().use_count();
+					nodes.push_back(node{var, state, count, false});
+				}
+				return it->second;
+			}
+			
+			//Calls visit with the index of the node that each traced reference of the
+			//node leads to, adding the nodes that are missing.
+			template<typename F>
+			void forEachReference(size_t idx, F&& visit) {
+				variable* var = nodes[idx].var;
+				functionState* state = nodes[idx].state;
+				
+				auto visitVariable = [&](const variablePtr& v) {
+					if (v && isTraced(*v)) {
+						visit(add(v.get(), nullptr));
+					}
+				};
+				
+				if (state) {
+					state->trace(visitVariable);
+					return;
+				}
+				
+				const std::type_info& type = typeid(*var);
+				if (type == typeid(variableImpl<array>)) {
+					for (const variablePtr& v : static_cast<variableImpl<array>*>(var)->value) {
+						visitVariable(v);
+					}
+				} else if (type == typeid(variableImpl<dictionary>)) {
+					for (const dictionary::entry& e : static_cast<variableImpl<dictionary>*>(var)->value.entries()) {
+						visitVariable(e.value);
+					}
+				} else if (functionState* held = heldState(*var)) {
+					visit(add(nullptr, held));
+				}
+			}
+		};
+		
+		void clearValue(variable& v) {
+			const std::type_info& type = typeid(v);
+			if (type == typeid(variableImpl<array>)) {
+				array released;
+				released.swap(static_cast<variableImpl<array>&>(v).value);
+			} else if (type == typeid(variableImpl<dictionary>)) {
+				static_cast<variableImpl<dictionary>&>(v).value.takeEntries();
+			} else if (type == typeid(variableImpl<function>)) {
+				function released = std::move(static_cast<variableImpl<function>&>(v).value);
+				static_cast<variableImpl<function>&>(v).value = nullptr;
+			}
+		}
+	}
+	
+	functionState::functionState():
+		_index(0)
+	{
+		if (memoryAccount* account = memoryAccount::active()) {
+			_account = account->acquire();
+			_account->collector().track(this);
+		}
+	}
+	
+	functionState::~functionState() {
+		if (_account) {
+			_account->collector().untrack(this);
+		}
+	}
+	
+	function statefulFunction(std::shared_ptr<functionState> state) {
+		return stateCaller{std::move(state)};
+	}
+	
+	functionState* functionStateOf(const function& f) {
+		if (const stateCaller* caller = f.target<stateCaller>()) {
+			return caller->state.get();
+		}
+		return nullptr;
+	}
+	
+	cycleCollector::cycleCollector():
+		_created(0)
+	{
+	}
+	
+	void cycleCollector::track(functionState* state) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		state->_index = _states.size();
+		_states.push_back(state);
+		++_created;
+	}
+	
+	void cycleCollector::untrack(functionState* state) {
+		std::lock_guard<std::mutex> lock(_mutex);
+		_states[state->_index] = _states.back();
+		_states[state->_index]->_index = state->_index;
+		_states.pop_back();
+	}
+	
+	size_t cycleCollector::createdSinceCollection() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _created;
+	}
+	
+	collectionStats cycleCollector::stats() const {
+		std::lock_guard<std::mutex> lock(_mutex);
+		return _stats;
+	}
+	
+	void cycleCollector::collect() {
+		auto start = std::chrono::steady_clock::now();
+		
+		std::vector<variablePtr> garbage;
+		size_t freed = 0;
+		size_t traced = 0;
+		
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			graph g;
+			
+			for (functionState* state : _states) {
+				g.add(nullptr, state);
+			}
+			
+			for (size_t i = 0; i < g.nodes.size(); ++i) {
+				g.forEachReference(i, [&](size_t target) {
+					--g.nodes[target].external;
+				});
+			}
+			
+			std::vector<size_t> pending;
+			for (size_t i = 0; i < g.nodes.size(); ++i) {
+				if (g.nodes[i].external > 0) {
+					g.nodes[i].alive = true;
+					pending.push_back(i);
+				}
+			}
+			
+			while (!pending.empty()) {
+				size_t i = pending.back();
+				pending.pop_back();
+				g.forEachReference(i, [&](size_t target) {
+					if (!g.nodes[target].alive) {
+						g.nodes[target].alive = true;
+						pending.push_back(target);
+					}
+				});
+			}
+			
+			for (const node& n : g.nodes) {
+				if (!n.alive) {
+					++freed;
+					if (n.var) {
+						garbage.push_back(n.var->shared_from_this());
+					}
+				}
+			}
+			
+			traced = g.nodes.size();
+			_created = 0;
+		}
+		
+		//Emptying the garbage releases the states, which untrack themselves.
+		for (const variablePtr& v : garbage) {
+			clearValue(*v);
+		}
+		garbage.clear();
+		
+		auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+		
+		std::lock_guard<std::mutex> lock(_mutex);
+		++_stats.collections;
+		_stats.traced = traced;
+		_stats.freed += freed;
+		_stats.lastPause = pause;
+		_stats.maxPause = std::max(_stats.maxPause, pause);
+		_stats.totalPause += pause;
+	}
+}
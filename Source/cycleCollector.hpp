@@ -0,0 +1,89 @@
+#ifndef cycleCollector_hpp
+#define cycleCollector_hpp
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "variable.hpp"
+#include "memoryAccount.hpp"
+
+namespace cobalt {
+	//State that the copies of a function value share when it holds variables of
+	//its own, such as a suspended generator. If it is created while an account is
+	//active, the cycle collector of the account tracks it, and follows references
+	//from the variables that hold the function to the variables it holds.
+	class functionState: public std::enable_shared_from_this<functionState> {
+		functionState(const functionState&) = delete;
+		void operator=(const functionState&) = delete;
+	private:
+		memoryAccountPtr _account;
+		size_t _index;
+		
+		friend class cycleCollector;
+	protected:
+		functionState();
+	public:
+		virtual ~functionState();
+		
+		virtual void call(runtimeContext& ctx) = 0;
+		
+		//Calls visit for each reference to a variable that the state holds.
+		virtual void trace(const std::function<void(const variablePtr&)>& visit) const = 0;
+	};
+	
+	//Function value that calls state.
+	function statefulFunction(std::shared_ptr<functionState> state);
+	
+	//State that f calls, if it was made by statefulFunction.
+	functionState* functionStateOf(const function& f);
+	
+	struct collectionStats {
+		size_t collections = 0;
+		
+		//Arrays, dictionaries, functions and function states examined by the last
+		//collection.
+		size_t traced = 0;
+		
+		//Arrays, dictionaries, functions and function states that all collections
+		//freed.
+		size_t freed = 0;
+		
+		std::chrono::nanoseconds lastPause{0};
+		std::chrono::nanoseconds maxPause{0};
+		std::chrono::nanoseconds totalPause{0};
+	};
+	
+	//Frees the values that only keep each other alive. Arrays and dictionaries
+	//hold copies of values, so every such cycle goes through a function state.
+	//Starting from the tracked states, each container or state is left with the
+	//references that do not come from the others; those with any, and what they
+	//reach, are alive, and the rest are emptied.
+	class cycleCollector {
+		cycleCollector(const cycleCollector&) = delete;
+		void operator=(const cycleCollector&) = delete;
+	private:
+		mutable std::mutex _mutex;
+		std::vector<functionState*> _states;
+		size_t _created;
+		collectionStats _stats;
+		
+		void track(functionState* state);
+		void untrack(functionState* state);
+		
+		friend class functionState;
+	public:
+		cycleCollector();
+		
+		//Function states created since the last collection.
+		size_t createdSinceCollection() const;
+		
+		collectionStats stats() const;
+		
+		//Must not run while values it may reach are used on other threads.
+		void collect();
+	};
+}
+
+#endif /* cycleCollector_hpp */
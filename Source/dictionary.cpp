@@ -0,0 +1,135 @@
+#include "dictionary.hpp"
+#include "variable.hpp"
+#include <cstring>
+#include <functional>
+
+namespace cobalt {
+	namespace {
+		size_t mix(uint64_t h) {
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdULL;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ULL;
+			h ^= h >> 33;
+			return size_t(h);
+		}
+		
+		bool equalKey(const dictionary::key& k1, double k2) {
+			if (const double* d = std::get_if<double>(&k1)) {
+				return *d == k2 || (*d != *d && k2 != k2);
+			}
+			return false;
+		}
+		
+		bool equalKey(const dictionary::key& k1, std::string_view k2) {
+			if (const std::string* s = std::get_if<std::string>(&k1)) {
+				return *s == k2;
+			}
+			return false;
+		}
+		
+		uint32_t fragment(size_t hash) {
+			return uint32_t(uint64_t(hash) >> 32);
+		}
+		
+		const size_t min_capacity = 8;
+	}
+	
+	dictionary::dictionary() {
+	}
+	
+	size_t dictionary::hashKey(double k) {
+		if (k == 0) {
+			k = 0;
+		}
+		uint64_t bits;
+		std::memcpy(&bits, &k, sizeof(bits));
+		return mix(bits);
+	}
+	
+	size_t dictionary::hashKey(std::string_view k) {
+		return mix(std::hash<std::string_view>()(k));
+	}
+	
+	template<typename K>
+	size_t dictionary::lookup(K k, size_t hash) const {
+		if (_slots.empty()) {
+			return npos;
+		}
+		
+		const size_t mask = _slots.size() - 1;
+		const uint32_t f = fragment(hash);
+		
+		for (size_t i = hash & mask; _slots[i].index; i = (i + 1) & mask) {
+			if (_slots[i].hash == f && equalKey(_entries[_slots[i].index - 1].k, k)) {
+				return _slots[i].index - 1;
+			}
+		}
+		
+		return npos;
+	}
+	
+	template size_t dictionary::lookup<double>(double k, size_t hash) const;
+	template size_t dictionary::lookup<std::string_view>(std::string_view k, size_t hash) const;
+	
+	variablePtr& dictionary::emplace(key k, size_t hash, variablePtr value) {
+		if (2 * (_entries.size() + 1) > _slots.size()) {
+			rehash(_slots.empty() ? min_capacity : 2 * _slots.size());
+		}
+		
+		_entries.push_back(entry{std::move(k), std::move(value), hash});
+		
+		const size_t mask = _slots.size() - 1;
+		size_t i = hash & mask;
+		while (_slots[i].index) {
+			i = (i + 1) & mask;
+		}
+		_slots[i] = slot{fragment(hash), uint32_t(_entries.size())};
+		
+		return _entries.back().value;
+	}
+	
+	void dictionary::rehash(size_t capacity) {
+		_slots.assign(capacity, slot{0, 0});
+		
+		const size_t mask = capacity - 1;
+		for (size_t idx = 0; idx < _entries.size(); ++idx) {
+			size_t i = _entries[idx].hash & mask;
+			while (_slots[i].index) {
+				i = (i + 1) & mask;
+			}
+			_slots[i] = slot{fragment(_entries[idx].hash), uint32_t(idx + 1)};
+		}
+	}
+	
+	size_t dictionary::size() const {
+		return _entries.size();
+	}
+	
+	const std::vector<dictionary::entry>& dictionary::entries() const {
+		return _entries;
+	}
+	
+	std::vector<dictionary::entry> dictionary::takeEntries() {
+		_slots.clear();
+		return std::move(_entries);
+	}
+	
+	bool dictionary::contains(double k) const {
+		return lookup(k, hashKey(k)) != npos;
+	}
+	
+	bool dictionary::contains(std::string_view k) const {
+		return lookup(k, hashKey(k)) != npos;
+	}
+	
+	dictionary dictionary::clone() const {
+		dictionary ret;
+		ret._slots = _slots;
+		ret._entries.reserve(_entries.size());
+		for (const entry& e : _entries) {
+			ret._entries.push_back(entry{e.k, e.value->clone(), e.hash});
+		}
+		return ret;
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef dictionary_hpp
+#define dictionary_hpp
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <cstdint>
+#include <type_traits>
+
+namespace cobalt {
+	class variable;
+	
+	using variablePtr = std::shared_ptr<variable>;
+	
+	//Open-addressing hash table keyed by numbers or strings. Entries are stored
+	//densely in insertion order, which keeps iteration cache-friendly and stable.
+	//Linear probing walks a compact array of (hash fragment, entry index) pairs and
+	//only touches an entry when the fragments match.
+	class dictionary {
+	public:
+		using key = std::variant<double, std::string>;
+		
+		struct entry {
+			key k;
+			variablePtr value;
+			size_t hash;
+		};
+	private:
+		struct slot {
+			uint32_t hash;
+			uint32_t index;
+		};
+		
+		static const size_t npos = size_t(-1);
+		
+		std::vector<slot> _slots;
+		std::vector<entry> _entries;
+		
+		static size_t hashKey(double k);
+		static size_t hashKey(std::string_view k);
+		
+		template<typename K>
+		size_t lookup(K k, size_t hash) const;
+		
+		variablePtr& emplace(key k, size_t hash, variablePtr value);
+		
+		void rehash(size_t capacity);
+	public:
+		dictionary();
+		
+		size_t size() const;
+		
+		const std::vector<entry>& entries() const;
+		
+		//Empties the dictionary, returning its entries.
+		std::vector<entry> takeEntries();
+		
+		bool contains(double k) const;
+		bool contains(std::string_view k) const;
+		
+		template<typename K, typename F>
+		variablePtr& findOrInsert(K k, F&& create) {
+			static_assert(std::is_same<K, double>::value || std::is_same<K, std::string_view>::value);
+			
+			size_t hash = hashKey(k);
+			
+			if (size_t idx = lookup(k, hash); idx != npos) {
+				return _entries[idx].value;
+			}
+			
+			if constexpr(std::is_same<K, double>::value) {
+				return emplace(key(k), hash, create());
+			} else {
+				return emplace(key(std::in_place_type<std::string>, k), hash, create());
+			}
+		}
+		
+		dictionary clone() const;
+	};
+}
+
+#endif /* dictionary_hpp */
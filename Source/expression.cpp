@@ -7,6 +7,10 @@
 #include "runtimeContext.hpp"
 #include "tokeniser.hpp"
 #include "compilerContext.hpp"
+#include "compiler.hpp"
+#include "incompleteFunction.hpp"
+#include "statement.hpp"
+#include "closure.hpp"
 
 namespace cobalt {
 	namespace {
@@ -27,7 +31,10 @@ namespace cobalt {
 		
 		template <typename T>
 		auto unbox(T&& t) {
-			if constexpr (std::is_same<typename remove_cvref<T>::type, larray>::value) {
+			if constexpr (
+				std::is_same<typename remove_cvref<T>::type, larray>::value ||
+				std::is_same<typename remove_cvref<T>::type, ldictionary>::value
+			) {
 				return cloneVariableValue(t->value);
 			} else {
 				return t->value;
@@ -70,7 +77,82 @@ namespace cobalt {
 		number lt(string s1, string s2) {
 			return *s1 < *s2;
 		}
+		
+		//Strings are shared between variables, so the left operand is only extended
+		//in place when nothing else holds it. Appends to a string owned by a single
+		//variable are then amortized O(1) instead of copying the whole prefix.
+		string append(string s1, const string& s2) {
+			if (s1.use_count() == 1) {
+				s1->append(*s2);
+				chargeStringGrowth(s1);
+				return s1;
+			}
+			
+			std::string ret;
+			ret.reserve(s1->size() + s2->size());
+			ret.append(*s1);
+			ret.append(*s2);
+			return accountedString(std::move(ret));
+		}
+		
+		double keyOf(number k) {
+			return k;
+		}
+		
+		std::string_view keyOf(const string& k) {
+			return *k;
+		}
+		
+		size_t sizeOf(const larray& a) {
+			return a->value.size();
+		}
+		
+		size_t sizeOf(const array& a) {
+			return a.size();
+		}
+		
+		size_t sizeOf(const ldictionary& d) {
+			return d->value.size();
+		}
+		
+		size_t sizeOf(const dictionary& d) {
+			return d.size();
+		}
+		
+		array keysOf(const dictionary& d) {
+			array ret;
+			for (const dictionary::entry& e : d.entries()) {
+				if (const number* n = std::get_if<number>(&e.k)) {
+					ret.push_back(std::make_shared<variableImpl<number> >(*n));
+				} else {
+					ret.push_back(std::make_shared<variableImpl<string> >(
+						std::make_shared<std::string>(std::get<std::string>(e.k))
+					));
+				}
+			}
+			return ret;
+		}
+		
+		array keysOf(const ldictionary& d) {
+			return keysOf(d->value);
+		}
+		
+		template<typename K>
+		number containsKey(const K& k, const dictionary& d) {
+			return d.contains(keyOf(k));
+		}
+		
+		template<typename K>
+		number containsKey(const K& k, const ldictionary& d) {
+			return d->value.contains(keyOf(k));
+		}
 	
+		//Reads the value held by a variable slot without copying the shared pointer.
+		template<typename T>
+		typename T::element_type::valueType& slot_value(const variablePtr& v) {
+			return static_cast<typename T::element_type*>(v.get())->value;
+		}
+		
 		template<typename R, typename T>
 		class global_variable_expression: public expression<R> {
 		private:
@@ -82,7 +164,11 @@ namespace cobalt {
 			}
 			
 			R evaluate(runtimeContext& context) const override {
-				return convert<R>(context.global(_idx)->template staticPointerDowncast<T>());
+				if constexpr(is_boxed<T, R>::value) {
+					return cloneVariableValue(slot_value<T>(context.global(_idx)));
+				} else {
+					return convert<R>(context.global(_idx)->template staticPointerDowncast<T>());
+				}
 			}
 		};
 		
@@ -97,7 +183,11 @@ namespace cobalt {
 			}
 			
 			R evaluate(runtimeContext& context) const override {
-				return convert<R>(context.local(_idx)->template staticPointerDowncast<T>());
+				if constexpr(is_boxed<T, R>::value) {
+					return cloneVariableValue(slot_value<T>(context.local(_idx)));
+				} else {
+					return convert<R>(context.local(_idx)->template staticPointerDowncast<T>());
+				}
 			}
 		};
 		
@@ -116,6 +206,21 @@ namespace cobalt {
 			}
 		};
 		
+		template<typename R>
+		class lambda_expression: public expression<R> {
+		private:
+			std::shared_ptr<const lambdaCode> _code;
+		public:
+			lambda_expression(std::shared_ptr<const lambdaCode> code) :
+				_code(std::move(code))
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				return convert<R>(createClosure(_code, context));
+			}
+		};
+		
 		template<typename R, typename T>
 		class constant_expression: public expression<R> {
 		private:
@@ -193,12 +298,16 @@ namespace cobalt {
 		UNARY_EXPRESSION(lnot, return !t1);
 		
 		UNARY_EXPRESSION(size,
-			return t1->value.size();
+			return sizeOf(t1);
 		);
 		
 		UNARY_EXPRESSION(tostring,
 			return convertToString(t1);
 		);
+		
+		UNARY_EXPRESSION(keys,
+			return keysOf(t1);
+		);
 
 #undef UNARY_EXPRESSION
 
@@ -234,7 +343,7 @@ namespace cobalt {
 
 		BINARY_EXPRESSION(bsr, return int(t1) >> int(t2));
 
-		BINARY_EXPRESSION(concat, return std::make_shared<std::string>(*t1 + *t2));
+		BINARY_EXPRESSION(concat, return append(std::move(t1), t2));
 		
 		BINARY_EXPRESSION(add_assign,
 			t1->value += t2;
@@ -292,7 +401,7 @@ namespace cobalt {
 		);
 
 		BINARY_EXPRESSION(concat_assign,
-			t1->value = std::make_shared<std::string>(*t1->value + *t2);
+			t1->value = append(std::move(t1->value), t2);
 			return t1;
 		);
 		
@@ -312,9 +421,200 @@ namespace cobalt {
 		BINARY_EXPRESSION(le, return !lt(t2, t1));
 		
 		BINARY_EXPRESSION(ge, return !lt(t1, t2));
+		
+		BINARY_EXPRESSION(contains, return containsKey(t1, t2));
 
 #undef BINARY_EXPRESSION
 
+		//Fused expressions for the most frequent shapes on local variables. They read
+		//the frame slots directly instead of building a tree of generic expressions
+		//that copy, downcast and convert the shared pointers at every level.
+		template<typename R, typename O>
+		class local_local_comparison_expression: public expression<R> {
+		private:
+			int _idx1;
+			int _idx2;
+		public:
+			local_local_comparison_expression(int idx1, int idx2) :
+				_idx1(idx1),
+				_idx2(idx2)
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				number n = O()(slot_value<lnumber>(context.local(_idx1)), slot_value<lnumber>(context.local(_idx2)));
+				if constexpr(!std::is_same<R, void>::value) {
+					return convert<R>(n);
+				}
+			}
+		};
+		
+		template<typename R, typename O>
+		class local_constant_comparison_expression: public expression<R> {
+		private:
+			int _idx;
+			number _c;
+		public:
+			local_constant_comparison_expression(int idx, number c) :
+				_idx(idx),
+				_c(c)
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				number n = O()(slot_value<lnumber>(context.local(_idx)), _c);
+				if constexpr(!std::is_same<R, void>::value) {
+					return convert<R>(n);
+				}
+			}
+		};
+		
+		template<typename R, typename O>
+		class constant_local_comparison_expression: public expression<R> {
+		private:
+			number _c;
+			int _idx;
+		public:
+			constant_local_comparison_expression(number c, int idx) :
+				_c(c),
+				_idx(idx)
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				number n = O()(_c, slot_value<lnumber>(context.local(_idx)));
+				if constexpr(!std::is_same<R, void>::value) {
+					return convert<R>(n);
+				}
+			}
+		};
+		
+		struct local_preinc_op {
+			number operator()(number& v) {
+				return ++v;
+			}
+		};
+		
+		struct local_predec_op {
+			number operator()(number& v) {
+				return --v;
+			}
+		};
+		
+		struct local_postinc_op {
+			number operator()(number& v) {
+				return v++;
+			}
+		};
+		
+		struct local_postdec_op {
+			number operator()(number& v) {
+				return v--;
+			}
+		};
+		
+		template<typename R, typename O>
+		class local_update_expression: public expression<R> {
+		private:
+			int _idx;
+		public:
+			local_update_expression(int idx) :
+				_idx(idx)
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				number n = O()(slot_value<lnumber>(context.local(_idx)));
+				if constexpr(std::is_same<R, lnumber>::value || std::is_same<R, lvalue>::value) {
+					return convert<R>(context.local(_idx)->template staticPointerDowncast<lnumber>());
+				} else if constexpr(!std::is_same<R, void>::value) {
+					return convert<R>(n);
+				}
+			}
+		};
+		
+		template<typename R, typename O>
+		class local_compound_assign_expression: public expression<R> {
+		private:
+			int _idx;
+			expression<number>::ptr _expr;
+		public:
+			local_compound_assign_expression(int idx, expression<number>::ptr expr) :
+				_idx(idx),
+				_expr(std::move(expr))
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				number rhs = _expr->evaluate(context);
+				number& v = slot_value<lnumber>(context.local(_idx));
+				v = O()(v, rhs);
+				if constexpr(std::is_same<R, lnumber>::value || std::is_same<R, lvalue>::value) {
+					return convert<R>(context.local(_idx)->template staticPointerDowncast<lnumber>());
+				} else if constexpr(!std::is_same<R, void>::value) {
+					return convert<R>(v);
+				}
+			}
+		};
+		
+		template<typename R, typename T>
+		class local_index_local_expression: public expression<R> {
+		private:
+			int _arr_idx;
+			int _idx;
+			expression<lvalue>::ptr _init;
+		public:
+			local_index_local_expression(int arrIdx, int idx, expression<lvalue>::ptr init) :
+				_arr_idx(arrIdx),
+				_idx(idx),
+				_init(std::move(init))
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				array& arr = slot_value<larray>(context.local(_arr_idx));
+				int idx = int(slot_value<lnumber>(context.local(_idx)));
+				
+				runtimeAssertion(idx >= 0, "Negative index is invalid");
+				
+				while (size_t(idx) >= arr.size()) {
+					arr.push_back(_init->evaluate(context));
+				}
+				
+				if constexpr(is_boxed<T, R>::value) {
+					return cloneVariableValue(slot_value<T>(arr[idx]));
+				} else {
+					return convert<R>(arr[idx]->template staticPointerDowncast<T>());
+				}
+			}
+		};
+		
+		//Local array indexed by a local number that a loop has proven to be a
+		//valid position, so neither the sign check nor the growth is needed.
+		template<typename R, typename T>
+		class local_index_local_in_bounds_expression: public expression<R> {
+		private:
+			int _arr_idx;
+			int _idx;
+		public:
+			local_index_local_in_bounds_expression(int arrIdx, int idx) :
+				_arr_idx(arrIdx),
+				_idx(idx)
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				array& arr = slot_value<larray>(context.local(_arr_idx));
+				size_t idx = size_t(slot_value<lnumber>(context.local(_idx)));
+				
+				if constexpr(is_boxed<T, R>::value) {
+					return cloneVariableValue(slot_value<T>(arr[idx]));
+				} else {
+					return convert<R>(arr[idx]->template staticPointerDowncast<T>());
+				}
+			}
+		};
+		
 		template<typename R, typename T1, typename T2>
 		class comma_expression: public expression<R> {
 		private:
@@ -427,6 +727,9 @@ namespace cobalt {
 					return std::static_pointer_cast<variableImpl<T> >(v);
 				}
 			}
+			
+			//Element type, which reads of a plain value can take straight from the slot.
+			using boxed = decltype(to_lvalue_impl(std::declval<lvalue>()));
 		public:
 			index_expression(typename expression<A>::ptr expr1, expression<number>::ptr expr2, expression<lvalue>::ptr init):
 				_expr1(std::move(expr1)),
@@ -444,14 +747,68 @@ namespace cobalt {
 				while (idx >= value(arr).size()) {
 					value(arr).push_back(_init->evaluate(context));
 				}
-
-				return convert<R>(
-					to_lvalue_impl(value(arr)[idx])
-				);
+				
+				if constexpr(is_boxed<boxed, R>::value) {
+					return cloneVariableValue(slot_value<boxed>(value(arr)[idx]));
+				} else {
+					return convert<R>(
+						to_lvalue_impl(value(arr)[idx])
+					);
+				}
 			}
 		};
 		
 		
+		template<typename R, typename D, typename K, typename T>
+		class dictionary_index_expression: public expression<R>{
+		private:
+			typename expression<D>::ptr _expr1;
+			typename expression<K>::ptr _expr2;
+			expression<lvalue>::ptr _init;
+			
+			static dictionary& value(D& d){
+				if constexpr(std::is_same<ldictionary, D>::value) {
+					return d->value;
+				} else {
+					static_assert(std::is_same<dictionary, D>::value);
+					return d;
+				}
+			}
+			
+			static auto to_lvalue_impl(lvalue v) {
+				if constexpr(std::is_same<ldictionary, D>::value) {
+					return v->staticPointerDowncast<T>();
+				} else {
+					static_assert(std::is_same<dictionary, D>::value);
+					return std::static_pointer_cast<variableImpl<T> >(v);
+				}
+			}
+			
+			using boxed = decltype(to_lvalue_impl(std::declval<lvalue>()));
+		public:
+			dictionary_index_expression(typename expression<D>::ptr expr1, typename expression<K>::ptr expr2, expression<lvalue>::ptr init):
+				_expr1(std::move(expr1)),
+				_expr2(std::move(expr2)),
+				_init(std::move(init))
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				D d = _expr1->evaluate(context);
+				K k = _expr2->evaluate(context);
+				
+				const lvalue& v = value(d).findOrInsert(keyOf(k), [&](){
+					return _init->evaluate(context);
+				});
+				
+				if constexpr(is_boxed<boxed, R>::value) {
+					return cloneVariableValue(slot_value<boxed>(v));
+				} else {
+					return convert<R>(to_lvalue_impl(v));
+				}
+			}
+		};
+		
 		template<typename R, typename A, typename T>
 		class member_expression: public expression<R>{
 		private:
@@ -475,6 +832,8 @@ namespace cobalt {
 					return std::static_pointer_cast<variableImpl<T> >(v);
 				}
 			}
+			
+			using boxed = decltype(to_lvalue_impl(std::declval<lvalue>()));
 		public:
 			member_expression(typename expression<A>::ptr expr, size_t idx):
 				_expr(std::move(expr)),
@@ -485,9 +844,13 @@ namespace cobalt {
 			R evaluate(runtimeContext& context) const override {
 				A tup = _expr->evaluate(context);
 				
-				return convert<R>(
-					to_lvalue_impl(value(tup)[_idx])
-				);
+				if constexpr(is_boxed<boxed, R>::value) {
+					return cloneVariableValue(slot_value<boxed>(value(tup)[_idx]));
+				} else {
+					return convert<R>(
+						to_lvalue_impl(value(tup)[_idx])
+					);
+				}
 			}
 			
 		};
@@ -528,6 +891,88 @@ namespace cobalt {
 			}
 		};
 		
+		template<typename R, typename T>
+		class inline_call_expression: public expression<R>{
+		private:
+			std::vector<expression<void>::ptr> _params;
+			statement_ptr _body;
+			typename expression<R>::ptr _result;
+			expression<lvalue>::ptr _value;
+		public:
+			inline_call_expression(
+				std::vector<expression<void>::ptr> params,
+				statement_ptr body,
+				typename expression<R>::ptr result,
+				expression<lvalue>::ptr value
+			):
+				_params(std::move(params)),
+				_body(std::move(body)),
+				_result(std::move(result)),
+				_value(std::move(value))
+			{
+			}
+			
+			R evaluate(runtimeContext& context) const override {
+				for (const expression<void>::ptr& param : _params) {
+					param->evaluate(context);
+				}
+				
+				_body->execute(context);
+				
+				if constexpr (std::is_same<R, void>::value) {
+					if (_result) {
+						_result->evaluate(context);
+					}
+				} else if (_result) {
+					return _result->evaluate(context);
+				} else {
+					return convert<R>(std::move(
+						std::static_pointer_cast<variableImpl<T> >(_value->evaluate(context))->value
+					));
+				}
+			}
+		};
+		
+		class tail_call_expression: public expression<void>{
+		private:
+			expression<function>::ptr _fexpr;
+			std::vector<expression<lvalue>::ptr> _exprs;
+		public:
+			tail_call_expression(
+				expression<function>::ptr fexpr,
+				std::vector<expression<lvalue>::ptr> exprs
+			):
+				_fexpr(std::move(fexpr)),
+				_exprs(std::move(exprs))
+			{
+			}
+			
+			void evaluate(runtimeContext& context) const override {
+				std::vector<variablePtr> params;
+				params.reserve(_exprs.size());
+				
+				for (size_t i = 0; i < _exprs.size(); ++i) {
+					params.push_back(_exprs[i]->evaluate(context));
+				}
+				
+				context.tailCall(_fexpr->evaluate(context), std::move(params));
+			}
+		};
+		
+		class return_value_expression: public expression<void>{
+		private:
+			expression<lvalue>::ptr _expr;
+		public:
+			return_value_expression(expression<lvalue>::ptr expr):
+				_expr(std::move(expr))
+			{
+			}
+			
+			void evaluate(runtimeContext& context) const override {
+				context.retval() = _expr->evaluate(context);
+			}
+		};
+		
 		template<typename R>
 		class init_expression: public expression<R>{
 		private:
@@ -597,6 +1042,36 @@ namespace cobalt {
 		
 		expression<lvalue>::ptr build_lvalue_expression(typeHandle typeID, const node_ptr& np, compilerContext& context);
 		
+		std::vector<expression<lvalue>::ptr> build_call_arguments(const node_ptr& np, compilerContext& context);
+		
+		const identifierInfo* find_local_variable(const node_ptr& np, compilerContext& context) {
+			if (!np->isIdentifier()) {
+				return nullptr;
+			}
+			const identifierInfo* info = context.find(std::get<identifier>(np->getValue()).id);
+			return info->getScope() == identifierScope::local_variable ? info : nullptr;
+		}
+		
+		const identifierInfo* find_local_number(const node_ptr& np, compilerContext& context) {
+			return np->getTypeID() == typeRegistry::getNumberHandle() ? find_local_variable(np, context) : nullptr;
+		}
+		
+		//Globals that the compiler was given as constants are read as such, where
+		//only their value is wanted.
+		template<typename R, typename T>
+		typename expression<R>::ptr build_global_variable_expression(size_t idx, compilerContext& context) {
+			if constexpr(std::is_same<R, number>::value || std::is_same<R, string>::value) {
+				if (const variablePtr* v = context.findConstantGlobal(idx)) {
+					return std::make_unique<constant_expression<R, typename T::element_type::valueType> >(slot_value<T>(*v));
+				}
+			}
+			return std::make_unique<global_variable_expression<R, T> >(idx);
+		}
+		
+		const identifierInfo* find_local_array(const node_ptr& np, compilerContext& context) {
+			return std::holds_alternative<arrayType>(*np->getTypeID()) ? find_local_variable(np, context) : nullptr;
+		}
+		
 #define RETURN_EXPRESSION_OF_TYPE(T)\
 	if constexpr(is_convertible<T, R>::value) {\
 		return build_##T##_expression(np, context);\
@@ -608,10 +1083,10 @@ namespace cobalt {
 #define CHECK_IDENTIFIER(T1)\
 	if (std::holds_alternative<identifier>(np->getValue())) {\
 		const identifier& id = std::get<identifier>(np->getValue());\
-		const identifierInfo* info = context.find(id.name);\
+		const identifierInfo* info = context.find(id.id);\
 		switch (info->getScope()) {\
 			case identifierScope::global_variable:\
-				return std::make_unique<global_variable_expression<R, T1> >(info->index());\
+				return build_global_variable_expression<R, T1>(info->index(), context);\
 			case identifierScope::local_variable:\
 				return std::make_unique<local_variable_expression<R, T1> >(info->index());\
 			case identifierScope::function:\
@@ -622,7 +1097,7 @@ namespace cobalt {
 #define CHECK_FUNCTION()\
 	if (std::holds_alternative<identifier>(np->getValue())) {\
 		const identifier& id = std::get<identifier>(np->getValue());\
-		const identifierInfo* info = context.find(id.name);\
+		const identifierInfo* info = context.find(id.id);\
 		switch (info->getScope()) {\
 			case identifierScope::global_variable:\
 			case identifierScope::local_variable:\
@@ -643,11 +1118,33 @@ namespace cobalt {
 #define CHECK_SIZE_OPERATION()\
 	case nodeOperation::size:\
 		if (std::holds_alternative<arrayType>(*(np->getChildren()[0]->getTypeID()))) {\
-			return expression_ptr(\
-				std::make_unique<size_expression<R, larray> > (\
-					expression_builder<larray>::build_expression(np->getChildren()[0], context)\
-				)\
-			);\
+			if (np->getChildren()[0]->is_lvalue()) {\
+				return expression_ptr(\
+					std::make_unique<size_expression<R, larray> > (\
+						expression_builder<larray>::build_expression(np->getChildren()[0], context)\
+					)\
+				);\
+			} else {\
+				return expression_ptr(\
+					std::make_unique<size_expression<R, array> > (\
+						expression_builder<array>::build_expression(np->getChildren()[0], context)\
+					)\
+				);\
+			}\
+		} else if (std::holds_alternative<dictionaryType>(*(np->getChildren()[0]->getTypeID()))) {\
+			if (np->getChildren()[0]->is_lvalue()) {\
+				return expression_ptr(\
+					std::make_unique<size_expression<R, ldictionary> > (\
+						expression_builder<ldictionary>::build_expression(np->getChildren()[0], context)\
+					)\
+				);\
+			} else {\
+				return expression_ptr(\
+					std::make_unique<size_expression<R, dictionary> > (\
+						expression_builder<dictionary>::build_expression(np->getChildren()[0], context)\
+					)\
+				);\
+			}\
 		} else {\
 			return expression_ptr(\
 				std::make_unique<constant_expression<R, number> >(1)\
@@ -656,7 +1153,7 @@ namespace cobalt {
 
 #define CHECK_TO_STRING_OPERATION()\
 	case nodeOperation::tostring:\
-		if (np->getChildren()[0]->is_lvalue()) {\
+		if (np->getChildren()[0]->is_lvalue() && !std::holds_alternative<simpleType>(*np->getChildren()[0]->getTypeID())) {\
 			return expression_ptr(std::make_unique<tostring_expression<R, lvalue> > (\
 				expression_builder<lvalue>::build_expression(np->getChildren()[0], context)\
 			));\
@@ -696,9 +1193,43 @@ namespace cobalt {
 				return expression_ptr(std::make_unique<tostring_expression<R, initializer_list> > (\
 					expression_builder<initializer_list>::build_expression(np->getChildren()[0], context)\
 				));\
+			},\
+			[&](const dictionaryType&) {\
+				return expression_ptr(std::make_unique<tostring_expression<R, dictionary> > (\
+					expression_builder<dictionary>::build_expression(np->getChildren()[0], context)\
+				));\
+			},\
+			[&](const generatorType&) {\
+				return expression_ptr(std::make_unique<tostring_expression<R, function> > (\
+					expression_builder<function>::build_expression(np->getChildren()[0], context)\
+				));\
 			}\
 		}, *np->getChildren()[0]->getTypeID());
 
+#define CHECK_KEYS_OPERATION()\
+	case nodeOperation::keys:\
+		if (np->getChildren()[0]->is_lvalue()) {\
+			return expression_ptr(std::make_unique<keys_expression<R, ldictionary> > (\
+				expression_builder<ldictionary>::build_expression(np->getChildren()[0], context)\
+			));\
+		} else {\
+			return expression_ptr(std::make_unique<keys_expression<R, dictionary> > (\
+				expression_builder<dictionary>::build_expression(np->getChildren()[0], context)\
+			));\
+		}
+		
+#define CHECK_CONTAINS_OPERATION()\
+	case nodeOperation::contains:\
+		if (np->getChildren()[1]->is_lvalue()) {\
+			return build_contains_expression<ldictionary>(\
+				std::get_if<dictionaryType>(np->getChildren()[1]->getTypeID()), np, context\
+			);\
+		} else {\
+			return build_contains_expression<dictionary>(\
+				std::get_if<dictionaryType>(np->getChildren()[1]->getTypeID()), np, context\
+			);\
+		}
+		
 #define CHECK_BINARY_OPERATION(name, T1, T2)\
 	case nodeOperation::name:\
 		return expression_ptr(\
@@ -724,6 +1255,9 @@ namespace cobalt {
 				np->getChildren()[0]->getTypeID() == typeRegistry::getNumberHandle() &&\
 				np->getChildren()[1]->getTypeID() == typeRegistry::getNumberHandle()\
 			) {\
+				if (expression_ptr fused = build_local_comparison_expression<name##_op>(np, context)) {\
+					return fused;\
+				}\
 				return expression_ptr(\
 					std::make_unique<name##_expression<R, number, number> > (\
 						expression_builder<number>::build_expression(np->getChildren()[0], context),\
@@ -743,6 +1277,7 @@ namespace cobalt {
 		case nodeOperation::index:\
 			{\
 				const tupleType* tt = std::get_if<tupleType>(np->getChildren()[0]->getTypeID());\
+				const dictionaryType* dt = std::get_if<dictionaryType>(np->getChildren()[0]->getTypeID());\
 				if (tt) {\
 					return expression_ptr(\
 						std::make_unique<member_expression<R, A, T> >(\
@@ -750,8 +1285,31 @@ namespace cobalt {
 							size_t(np->getChildren()[1]->getNumber())\
 						)\
 					);\
+				} else if (dt) {\
+					using D = typename std::conditional<std::is_same<A, larray>::value, ldictionary, dictionary>::type;\
+					return build_dictionary_index_expression<D, T>(dt, np, context);\
 				} else {\
 					const arrayType* at = std::get_if<arrayType>(np->getChildren()[0]->getTypeID());\
+					if constexpr(std::is_same<A, larray>::value) {\
+						const identifierInfo* arr = find_local_array(np->getChildren()[0], context);\
+						const identifierInfo* idx = find_local_number(np->getChildren()[1], context);\
+						if (arr && idx && context.isInBounds(arr->index(), idx->index())) {\
+							return expression_ptr(\
+								std::make_unique<local_index_local_in_bounds_expression<R, T> >(\
+									arr->index(),\
+									idx->index()\
+								)\
+							);\
+						} else if (arr && idx) {\
+							return expression_ptr(\
+								std::make_unique<local_index_local_expression<R, T> >(\
+									arr->index(),\
+									idx->index(),\
+									build_default_initialization(at->inner_type_id)\
+								)\
+							);\
+						}\
+					}\
 					return expression_ptr(\
 						std::make_unique<index_expression<R, A, T> >(\
 							expression_builder<A>::build_expression(np->getChildren()[0], context),\
@@ -762,39 +1320,190 @@ namespace cobalt {
 				}\
 			}
 
+#define CHECK_LOCAL_UPDATE_OPERATION(name)\
+	case nodeOperation::name:\
+		if (const identifierInfo* info = find_local_number(np->getChildren()[0], context)) {\
+			return expression_ptr(\
+				std::make_unique<local_update_expression<R, local_##name##_op> >(info->index())\
+			);\
+		}\
+		return expression_ptr(\
+			std::make_unique<name##_expression<R, lnumber> > (\
+				expression_builder<lnumber>::build_expression(np->getChildren()[0], context)\
+			)\
+		);
+		
+#define CHECK_COMPOUND_ASSIGN_OPERATION(name)\
+	case nodeOperation::name##_assign:\
+		if (const identifierInfo* info = find_local_number(np->getChildren()[0], context)) {\
+			return expression_ptr(\
+				std::make_unique<local_compound_assign_expression<R, name##_op> >(\
+					info->index(),\
+					expression_builder<number>::build_expression(np->getChildren()[1], context)\
+				)\
+			);\
+		}\
+		return expression_ptr(\
+			std::make_unique<name##_assign_expression<R, lnumber, number> > (\
+				expression_builder<lnumber>::build_expression(np->getChildren()[0], context),\
+				expression_builder<number>::build_expression(np->getChildren()[1], context)\
+			)\
+		);
+		
 #define CHECK_CALL_OPERATION(T)\
 	case nodeOperation::call:\
-	{\
-		std::vector<expression<lvalue>::ptr> arguments;\
-		const functionType* ft = std::get_if<functionType>(np->getChildren()[0]->getTypeID());\
-		for (size_t i = 1; i < np->getChildren().size(); ++i) {\
-			const node_ptr& child = np->getChildren()[i];\
-			if (\
-				child->is_node_operation() &&\
-				std::get<nodeOperation>(child->getValue()) == nodeOperation::param\
-			) {\
-				arguments.push_back(\
-					build_lvalue_expression(ft->param_type_id[i-1].typeID, child->getChildren()[0], context)\
-				);\
-			} else {\
-				arguments.push_back(\
-					expression_builder<lvalue>::build_expression(child, context)\
-				);\
-			}\
+		if (expression_ptr inlined = build_inline_call_expression<T>(np, context)) {\
+			return inlined;\
 		}\
 		return expression_ptr(\
 			std::make_unique<call_expression<R, T> >(\
 				expression_builder<function>::build_expression(np->getChildren()[0], context),\
-				std::move(arguments)\
+				build_call_arguments(np, context)\
 			)\
-		);\
-	}
+		);
 
 		template<typename R>
 		class expression_builder{
 		private:
 			using expression_ptr = typename expression<R>::ptr;
 		
+			template<typename D, typename T>
+			static expression_ptr build_dictionary_index_expression(
+				const dictionaryType* dt,
+				const node_ptr& np,
+				compilerContext& context
+			) {
+				if (dt->key_type_id == typeRegistry::getNumberHandle()) {
+					return std::make_unique<dictionary_index_expression<R, D, number, T> >(
+						expression_builder<D>::build_expression(np->getChildren()[0], context),
+						expression_builder<number>::build_expression(np->getChildren()[1], context),
+						build_default_initialization(dt->inner_type_id)
+					);
+				} else {
+					return std::make_unique<dictionary_index_expression<R, D, string, T> >(
+						expression_builder<D>::build_expression(np->getChildren()[0], context),
+						expression_builder<string>::build_expression(np->getChildren()[1], context),
+						build_default_initialization(dt->inner_type_id)
+					);
+				}
+			}
+			
+			//Substitutes the body of a small function for the call. The arguments are
+			//stored in slots of the caller's frame that the body's parameters are bound
+			//to, which is exactly what a call would push, by-reference ones included.
+			template<typename T>
+			static expression_ptr build_inline_call_expression(const node_ptr& np, compilerContext& context) {
+				if constexpr(std::is_same<R, ltuple>::value) {
+					return nullptr;
+				} else {
+					const node_ptr& callee = np->getChildren()[0];
+					
+					if (!callee->isIdentifier()) {
+						return nullptr;
+					}
+					
+					const identifierInfo* info = context.find(std::get<identifier>(callee->getValue()).id);
+					
+					if (info->getScope() != identifierScope::function) {
+						return nullptr;
+					}
+					
+					incompleteFunction* f = context.findInlineCandidate(info->index());
+					
+					if (!f) {
+						return nullptr;
+					}
+					
+					const functionType* ft = std::get_if<functionType>(callee->getTypeID());
+					
+					std::vector<size_t> slots;
+					for (size_t i = 0; i < ft->param_type_id.size(); ++i) {
+						slots.push_back(context.reserveLocal());
+					}
+					
+					std::vector<expression<lvalue>::ptr> arguments = build_call_arguments(np, context);
+					
+					std::vector<expression<void>::ptr> params;
+					for (size_t i = 0; i < arguments.size(); ++i) {
+						params.push_back(build_local_initialization(slots[i], std::move(arguments[i])));
+					}
+					
+					auto expansion = context.expand(f);
+					auto scope = context.inlineScope();
+					
+					for (size_t i = 0; i < slots.size(); ++i) {
+						context.bindLocal(
+							f->getDecl().params[i].id, ft->param_type_id[i].typeID, slots[i], ft->param_type_id[i].by_ref
+						);
+					}
+					
+					std::deque<token> tokens = f->getTokens();
+					tokensIterator it(tokens);
+					
+					statement_ptr body = compileInlineBody(context, it, ft->return_type_id);
+					
+					expression_ptr result;
+					expression<lvalue>::ptr value;
+					
+					if (it->hasValue(reservedToken::kw_return)) {
+						++it;
+						if (ft->return_type_id != typeRegistry::getVoidHandle()) {
+							node_ptr rn = parseExpressionTree(context, it, ft->return_type_id, true);
+							if (std::is_same<R, void>::value || rn->getTypeID() == ft->return_type_id) {
+								result = expression_builder<R>::build_expression(rn, context);
+							} else {
+								value = build_lvalue_expression(ft->return_type_id, rn, context);
+							}
+						}
+						parseTokenValue(context, it, reservedToken::semicolon);
+					}
+					
+					parseTokenValue(context, it, reservedToken::close_curly);
+					
+					return std::make_unique<inline_call_expression<R, T> >(
+						std::move(params), std::move(body), std::move(result), std::move(value)
+					);
+				}
+			}
+			
+			template<typename O>
+			static expression_ptr build_local_comparison_expression(const node_ptr& np, compilerContext& context) {
+				const node_ptr& lhs = np->getChildren()[0];
+				const node_ptr& rhs = np->getChildren()[1];
+				
+				const identifierInfo* l = find_local_number(lhs, context);
+				const identifierInfo* r = find_local_number(rhs, context);
+				
+				if (l && r) {
+					return std::make_unique<local_local_comparison_expression<R, O> >(l->index(), r->index());
+				} else if (l && rhs->isNumber()) {
+					return std::make_unique<local_constant_comparison_expression<R, O> >(l->index(), rhs->getNumber());
+				} else if (lhs->isNumber() && r) {
+					return std::make_unique<constant_local_comparison_expression<R, O> >(lhs->getNumber(), r->index());
+				}
+				
+				return nullptr;
+			}
+			
+			template<typename D>
+			static expression_ptr build_contains_expression(
+				const dictionaryType* dt,
+				const node_ptr& np,
+				compilerContext& context
+			) {
+				if (dt->key_type_id == typeRegistry::getNumberHandle()) {
+					return std::make_unique<contains_expression<R, number, D> >(
+						expression_builder<number>::build_expression(np->getChildren()[0], context),
+						expression_builder<D>::build_expression(np->getChildren()[1], context)
+					);
+				} else {
+					return std::make_unique<contains_expression<R, string, D> >(
+						expression_builder<string>::build_expression(np->getChildren()[0], context),
+						expression_builder<D>::build_expression(np->getChildren()[1], context)
+					);
+				}
+			}
+			
 			static expression_ptr build_void_expression(const node_ptr& np, compilerContext& context) {
 				switch (std::get<nodeOperation>(np->getValue())) {
 					CHECK_BINARY_OPERATION(comma, void, void);
@@ -815,8 +1524,8 @@ namespace cobalt {
 				CHECK_IDENTIFIER(lnumber);
 				
 				switch (std::get<nodeOperation>(np->getValue())) {
-					CHECK_UNARY_OPERATION(postinc, lnumber);
-					CHECK_UNARY_OPERATION(postdec, lnumber);
+					CHECK_LOCAL_UPDATE_OPERATION(postinc);
+					CHECK_LOCAL_UPDATE_OPERATION(postdec);
 					CHECK_UNARY_OPERATION(positive, number);
 					CHECK_UNARY_OPERATION(negative, number);
 					CHECK_UNARY_OPERATION(bnot, number);
@@ -839,6 +1548,7 @@ namespace cobalt {
 					CHECK_COMPARISON_OPERATION(gt);
 					CHECK_COMPARISON_OPERATION(le);
 					CHECK_COMPARISON_OPERATION(ge);
+					CHECK_CONTAINS_OPERATION();
 					CHECK_BINARY_OPERATION(comma, void, number);
 					CHECK_BINARY_OPERATION(land, number, number);
 					CHECK_BINARY_OPERATION(lor, number, number);
@@ -851,26 +1561,32 @@ namespace cobalt {
 			}
 			
 			static expression_ptr build_lnumber_expression(const node_ptr& np, compilerContext& context) {
+				//When only the value is wanted, the branches of ternary and comma operators
+				//are built as plain numbers, so that no variable is boxed or shared.
+				using lnumber_or_number = typename std::conditional<
+					std::is_same<R, lnumber>::value || std::is_same<R, lvalue>::value, lnumber, number
+				>::type;
+				
 				CHECK_IDENTIFIER(lnumber);
 				
 				switch (std::get<nodeOperation>(np->getValue())) {
-					CHECK_UNARY_OPERATION(preinc, lnumber);
-					CHECK_UNARY_OPERATION(predec, lnumber);
+					CHECK_LOCAL_UPDATE_OPERATION(preinc);
+					CHECK_LOCAL_UPDATE_OPERATION(predec);
 					CHECK_BINARY_OPERATION(assign, lnumber, number);
-					CHECK_BINARY_OPERATION(add_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(sub_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(mul_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(div_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(idiv_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(mod_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(band_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(bor_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(bxor_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(bsl_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(bsr_assign, lnumber, number);
-					CHECK_BINARY_OPERATION(comma, void, lnumber);
+					CHECK_COMPOUND_ASSIGN_OPERATION(add);
+					CHECK_COMPOUND_ASSIGN_OPERATION(sub);
+					CHECK_COMPOUND_ASSIGN_OPERATION(mul);
+					CHECK_COMPOUND_ASSIGN_OPERATION(div);
+					CHECK_COMPOUND_ASSIGN_OPERATION(idiv);
+					CHECK_COMPOUND_ASSIGN_OPERATION(mod);
+					CHECK_COMPOUND_ASSIGN_OPERATION(band);
+					CHECK_COMPOUND_ASSIGN_OPERATION(bor);
+					CHECK_COMPOUND_ASSIGN_OPERATION(bxor);
+					CHECK_COMPOUND_ASSIGN_OPERATION(bsl);
+					CHECK_COMPOUND_ASSIGN_OPERATION(bsr);
+					CHECK_BINARY_OPERATION(comma, void, lnumber_or_number);
 					CHECK_INDEX_OPERATION(lnumber, larray);
-					CHECK_TERNARY_OPERATION(ternary, number, lnumber, lnumber);
+					CHECK_TERNARY_OPERATION(ternary, number, lnumber_or_number, lnumber_or_number);
 					default:
 						throw expression_builder_error();
 				}
@@ -898,14 +1614,18 @@ namespace cobalt {
 			}
 			
 			static expression_ptr build_lstring_expression(const node_ptr& np, compilerContext& context) {
+				using lstring_or_string = typename std::conditional<
+					std::is_same<R, lstring>::value || std::is_same<R, lvalue>::value, lstring, string
+				>::type;
+				
 				CHECK_IDENTIFIER(lstring);
 				
 				switch (std::get<nodeOperation>(np->getValue())) {
 					CHECK_BINARY_OPERATION(assign, lstring, string);
 					CHECK_BINARY_OPERATION(concat_assign, lstring, string);
-					CHECK_BINARY_OPERATION(comma, void, lstring);
+					CHECK_BINARY_OPERATION(comma, void, lstring_or_string);
 					CHECK_INDEX_OPERATION(lstring, larray);
-					CHECK_TERNARY_OPERATION(ternary, number, lstring, lstring);
+					CHECK_TERNARY_OPERATION(ternary, number, lstring_or_string, lstring_or_string);
 					default:
 						throw expression_builder_error();
 				}
@@ -915,6 +1635,7 @@ namespace cobalt {
 				CHECK_IDENTIFIER(larray);
 				
 				switch (std::get<nodeOperation>(np->getValue())) {
+					CHECK_KEYS_OPERATION();
 					CHECK_BINARY_OPERATION(comma, void, array);
 					CHECK_INDEX_OPERATION(array, array);
 					CHECK_TERNARY_OPERATION(ternary, number, array, array);
@@ -941,6 +1662,10 @@ namespace cobalt {
 				CHECK_IDENTIFIER(lfunction);
 				CHECK_FUNCTION();
 				
+				if (np->isLambda()) {
+					return std::make_unique<lambda_expression<R> >(compileLambda(context, np->getLambda()));
+				}
+				
 				switch (std::get<nodeOperation>(np->getValue())) {
 					CHECK_BINARY_OPERATION(comma, void, function);
 					CHECK_INDEX_OPERATION(function, array);
@@ -991,6 +1716,32 @@ namespace cobalt {
 				}
 			}
 			
+			static expression_ptr build_dictionary_expression(const node_ptr& np, compilerContext& context) {
+				CHECK_IDENTIFIER(ldictionary);
+				
+				switch (std::get<nodeOperation>(np->getValue())) {
+					CHECK_BINARY_OPERATION(comma, void, dictionary);
+					CHECK_INDEX_OPERATION(dictionary, array);
+					CHECK_TERNARY_OPERATION(ternary, number, dictionary, dictionary);
+					CHECK_CALL_OPERATION(dictionary);
+					default:
+						throw expression_builder_error();
+				}
+			}
+			
+			static expression_ptr build_ldictionary_expression(const node_ptr& np, compilerContext& context) {
+				CHECK_IDENTIFIER(ldictionary);
+				
+				switch (std::get<nodeOperation>(np->getValue())) {
+					CHECK_BINARY_OPERATION(assign, ldictionary, dictionary);
+					CHECK_BINARY_OPERATION(comma, void, ldictionary);
+					CHECK_INDEX_OPERATION(ldictionary, larray);
+					CHECK_TERNARY_OPERATION(ternary, number, ldictionary, ldictionary);
+					default:
+						throw expression_builder_error();
+				}
+			}
+			
 			static expression_ptr build_initializer_list_expression(const node_ptr& np, compilerContext& context) {
 				switch (std::get<nodeOperation>(np->getValue())) {
 					case nodeOperation::init:
@@ -1052,6 +1803,20 @@ namespace cobalt {
 					},
 					[&](const initListType& ilt) {
 						RETURN_EXPRESSION_OF_TYPE(initializer_list);
+					},
+					[&](const dictionaryType& dt) {
+						if (np->is_lvalue()) {
+							RETURN_EXPRESSION_OF_TYPE(ldictionary);
+						} else {
+							RETURN_EXPRESSION_OF_TYPE(dictionary);
+						}
+					},
+					[&](const generatorType& gt) {
+						if (np->is_lvalue()) {
+							RETURN_EXPRESSION_OF_TYPE(lfunction);
+						} else {
+							RETURN_EXPRESSION_OF_TYPE(function);
+						}
 					}
 				}, *np->getTypeID());
 			}
@@ -1064,10 +1829,14 @@ namespace cobalt {
 		};
 
 #undef CHECK_CALL_OPERATION
+#undef CHECK_COMPOUND_ASSIGN_OPERATION
+#undef CHECK_LOCAL_UPDATE_OPERATION
 #undef CHECK_INDEX_OPERATION
 #undef CHECK_COMPARISON_OPERATION
 #undef CHECK_TERNARY_OPERATION
 #undef CHECK_BINARY_OPERATION
+#undef CHECK_CONTAINS_OPERATION
+#undef CHECK_KEYS_OPERATION
 #undef CHECK_TO_STRING_OPERATION
 #undef CHECK_SIZE_OPERATION
 #undef CHECK_UNARY_OPERATION
@@ -1075,6 +1844,27 @@ namespace cobalt {
 #undef CHECK_IDENTIFIER
 #undef RETURN_EXPRESSION_OF_TYPE
 
+		std::vector<expression<lvalue>::ptr> build_call_arguments(const node_ptr& np, compilerContext& context) {
+			std::vector<expression<lvalue>::ptr> arguments;
+			const functionType* ft = std::get_if<functionType>(np->getChildren()[0]->getTypeID());
+			for (size_t i = 1; i < np->getChildren().size(); ++i) {
+				const node_ptr& child = np->getChildren()[i];
+				if (
+					child->is_node_operation() &&
+					std::get<nodeOperation>(child->getValue()) == nodeOperation::param
+				) {
+					arguments.push_back(
+						build_lvalue_expression(ft->param_type_id[i-1].typeID, child->getChildren()[0], context)
+					);
+				} else {
+					arguments.push_back(
+						expression_builder<lvalue>::build_expression(child, context)
+					);
+				}
+			}
+			return arguments;
+		}
+		
 		expression<lvalue>::ptr build_lvalue_expression(typeHandle typeID, const node_ptr& np, compilerContext& context) {
 			return std::visit(overloaded{
 				[&](simpleType st){
@@ -1100,6 +1890,12 @@ namespace cobalt {
 				[&](const initListType&) {
 					throw expression_builder_error();
 					return expression<lvalue>::ptr();
+				},
+				[&](const dictionaryType&) {
+					return expression_builder<dictionary>::build_param_expression(np, context);
+				},
+				[&](const generatorType&) {
+					return expression_builder<function>::build_param_expression(np, context);
 				}
 			}, *typeID);
 		}
@@ -1144,7 +1940,27 @@ namespace cobalt {
 		class default_initialization_expression: public expression<lvalue> {
 		public:
 			lvalue evaluate(runtimeContext &context) const override {
-				return std::make_shared<variableImpl<T> >(T{});
+				if constexpr(std::is_same<T, string>::value) {
+					return std::make_shared<variableImpl<T> >(std::make_shared<std::string>());
+				} else {
+					return std::make_shared<variableImpl<T> >(T{});
+				}
+			}
+		};
+		
+		class local_initialization_expression: public expression<void> {
+		private:
+			size_t _idx;
+			expression<lvalue>::ptr _init;
+		public:
+			local_initialization_expression(size_t idx, expression<lvalue>::ptr init):
+				_idx(idx),
+				_init(std::move(init))
+			{
+			}
+			
+			void evaluate(runtimeContext& context) const override {
+				context.local(int(_idx)) = _init->evaluate(context);
 			}
 		};
 	}
@@ -1166,6 +1982,32 @@ namespace cobalt {
 		return build_expression<lvalue>(typeID, context, it, allow_comma);
 	}
 
+	expression<void>::ptr build_return_expression(compilerContext& context, tokensIterator& it, typeHandle typeID) {
+		size_t lineNumber = it->getLineNumber();
+		size_t charIndex = it->getCharIndex();
+		
+		try {
+			node_ptr np = parseExpressionTree(context, it, typeID, true);
+			
+			//A call returning exactly the function's return type is left for the
+			//caller to run, so the current frame is gone before the callee starts.
+			if (
+				np->is_node_operation() &&
+				std::get<nodeOperation>(np->getValue()) == nodeOperation::call &&
+				np->getTypeID() == typeID
+			) {
+				return std::make_unique<tail_call_expression>(
+					expression_builder<function>::build_expression(np->getChildren()[0], context),
+					build_call_arguments(np, context)
+				);
+			}
+			
+			return std::make_unique<return_value_expression>(build_lvalue_expression(typeID, np, context));
+		} catch (const expression_builder_error&) {
+			throw compilerError("Expression building failed", lineNumber, charIndex);
+		}
+	}
+	
 	expression<lvalue>::ptr build_default_initialization(typeHandle typeID) {
 		return std::visit(overloaded{
 			[&](simpleType st){
@@ -1200,7 +2042,17 @@ namespace cobalt {
 			[&](const initListType& ilt) {
 				//cannot happen
 				return expression<lvalue>::ptr();
+			},
+			[&](const dictionaryType& dt) {
+				return expression<lvalue>::ptr(std::make_unique<default_initialization_expression<dictionary> >());
+			},
+			[&](const generatorType& gt) {
+				return expression<lvalue>::ptr(std::make_unique<default_initialization_expression<function> >());
 			}
 		}, *typeID);
 	}
+	
+	expression<void>::ptr build_local_initialization(size_t idx, expression<lvalue>::ptr init) {
+		return std::make_unique<local_initialization_expression>(idx, std::move(init));
+	}
 }
@@ -32,7 +32,9 @@ namespace cobalt {
 		typeHandle typeID,
 		bool allow_comma
 	);
+	expression<void>::ptr build_return_expression(compilerContext& context, tokensIterator& it, typeHandle typeID);
 	expression<lvalue>::ptr build_default_initialization(typeHandle typeID);
+	expression<void>::ptr build_local_initialization(size_t idx, expression<lvalue>::ptr init);
 }
 
 #endif /* expression_hpp */
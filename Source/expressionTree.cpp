@@ -49,6 +49,44 @@ namespace cobalt {
 			}
 			return type_from == typeRegistry::getNumberHandle() && type_to == typeRegistry::getStringHandle();
 		}
+		
+		//Whether an lvalue is a global variable or an element of one.
+		bool refers_to_global(compilerContext& context, const node_ptr& np) {
+			if (np->isIdentifier()) {
+				const identifierInfo* info = context.find(std::get<identifier>(np->getValue()).id);
+				return info && info->getScope() == identifierScope::global_variable;
+			} else if (np->is_node_operation()) {
+				switch (np->getNodeOperation()) {
+					case nodeOperation::index:
+						return refers_to_global(context, np->getChildren()[0]);
+					case nodeOperation::ternary:
+						return refers_to_global(context, np->getChildren()[1]) || refers_to_global(context, np->getChildren()[2]);
+					case nodeOperation::comma:
+						return refers_to_global(context, np->getChildren().back());
+					default:
+						break;
+				}
+			}
+			return false;
+		}
+		
+		void mark_written(compilerContext& context, const node_ptr& np) {
+			if (np->isIdentifier()) {
+				context.markWritten(std::get<identifier>(np->getValue()).id);
+			} else if (np->is_node_operation()) {
+				switch (np->getNodeOperation()) {
+					case nodeOperation::ternary:
+						mark_written(context, np->getChildren()[1]);
+						mark_written(context, np->getChildren()[2]);
+						break;
+					case nodeOperation::comma:
+						mark_written(context, np->getChildren().back());
+						break;
+					default:
+						break;
+				}
+			}
+		}
 	}
 
 	node::node(compilerContext& context, nodeValue value, std::vector<node_ptr> children, size_t lineNumber, size_t charIndex) :
@@ -70,8 +108,24 @@ namespace cobalt {
 				_type_id = number_handle;
 				_lvalue = false;
 			},
+			[&](const lambda_ptr& value) {
+				_type_id = value->typeID;
+				_lvalue = false;
+				for (const lambdaLiteral::capture& c : value->captures) {
+					const identifierInfo* info = context.find(c.name.id);
+					if (!info) {
+						throw undeclaredError(c.name.name, _line_number, _char_index);
+					}
+					if (info->getScope() != identifierScope::local_variable) {
+						throw semanticError("Only local variables can be captured", _line_number, _char_index);
+					}
+					if (c.by_ref) {
+						context.markCapturedByReference(c.name.id);
+					}
+				}
+			},
 			[&](const identifier& value){
-				if (const identifierInfo* info = context.find(value.name)) {
+				if (const identifierInfo* info = context.find(value.id)) {
 					_type_id = info->typeID();
 					_lvalue = (info->getScope() != identifierScope::function);
 				} else {
@@ -89,12 +143,14 @@ namespace cobalt {
 						_type_id = number_handle;
 						_lvalue = true;
 						_children[0]->checkConversion(number_handle, true);
+						mark_written(context, _children[0]);
 						break;
 					case nodeOperation::postinc:
 					case nodeOperation::postdec:
 						_type_id = number_handle;
 						_lvalue = false;
 						_children[0]->checkConversion(number_handle, true);
+						mark_written(context, _children[0]);
 						break;
 					case nodeOperation::positive:
 					case nodeOperation::negative:
@@ -112,6 +168,15 @@ namespace cobalt {
 						_type_id = string_handle;
 						_lvalue = false;
 						break;
+					case nodeOperation::keys:
+						if (const dictionaryType* dt = std::get_if<dictionaryType>(_children[0]->getTypeID())) {
+							_type_id = context.getHandle(arrayType{dt->key_type_id});
+							_lvalue = false;
+						} else {
+							throw semanticError(to_string(_children[0]->_type_id) + " is not a dictionary",
+							                     _line_number, _char_index);
+						}
+						break;
 					case nodeOperation::add:
 					case nodeOperation::sub:
 					case nodeOperation::mul:
@@ -146,6 +211,16 @@ namespace cobalt {
 							_children[1]->checkConversion(number_handle, false);
 						}
 						break;
+					case nodeOperation::contains:
+						if (const dictionaryType* dt = std::get_if<dictionaryType>(_children[1]->getTypeID())) {
+							_type_id = number_handle;
+							_lvalue = false;
+							_children[0]->checkConversion(dt->key_type_id, false);
+						} else {
+							throw semanticError(to_string(_children[1]->_type_id) + " is not a dictionary",
+							                     _line_number, _char_index);
+						}
+						break;
 					case nodeOperation::concat:
 						_type_id = context.getHandle(simpleType::string);
 						_lvalue = false;
@@ -156,6 +231,7 @@ namespace cobalt {
 						_type_id = _children[0]->getTypeID();
 						_lvalue = true;
 						_children[0]->checkConversion(_type_id, true);
+						mark_written(context, _children[0]);
 						_children[1]->checkConversion(_type_id, false);
 						break;
 					case nodeOperation::add_assign:
@@ -172,12 +248,14 @@ namespace cobalt {
 						_type_id = number_handle;
 						_lvalue = true;
 						_children[0]->checkConversion(number_handle, true);
+						mark_written(context, _children[0]);
 						_children[1]->checkConversion(number_handle, false);
 						break;
 					case nodeOperation::concat_assign:
 						_type_id = string_handle;
 						_lvalue = true;
 						_children[0]->checkConversion(string_handle, true);
+						mark_written(context, _children[0]);
 						_children[1]->checkConversion(string_handle, false);
 						break;
 					case nodeOperation::comma:
@@ -203,10 +281,16 @@ namespace cobalt {
 							} else {
 								throw semanticError("Invalid tuple index", _line_number, _char_index);
 							}
+						} else if (const dictionaryType* dt = std::get_if<dictionaryType>(_children[0]->getTypeID())) {
+							_type_id = dt->inner_type_id;
+							_children[1]->checkConversion(dt->key_type_id, false);
 						} else {
 							throw semanticError(to_string(_children[0]->_type_id) + " is not indexable",
 							                     _line_number, _char_index);
 						}
+						if (refers_to_global(context, _children[0])) {
+							context.markGlobalElement();
+						}
 						break;
 					case nodeOperation::ternary:
 						_children[0]->checkConversion(number_handle, false);
@@ -241,6 +325,18 @@ namespace cobalt {
 									);
 								}
 								_children[i+1]->checkConversion(ft->param_type_id[i].typeID, ft->param_type_id[i].by_ref);
+								if (ft->param_type_id[i].by_ref) {
+									mark_written(context, _children[i+1]);
+								}
+							}
+							if (
+								const identifierInfo* f = _children[0]->isIdentifier() ?
+									context.find(std::get<identifier>(_children[0]->getValue()).id) : nullptr;
+								f && f->getScope() == identifierScope::function
+							) {
+								context.markCall(f->index());
+							} else {
+								context.markCall(std::nullopt);
 							}
 						} else {
 							throw semanticError(to_string(_children[0]->_type_id) + " is not callable",
@@ -283,6 +379,10 @@ namespace cobalt {
 		return std::holds_alternative<std::string>(_value);
 	}
 	
+	bool node::isLambda() const {
+		return std::holds_alternative<lambda_ptr>(_value);
+	}
+	
 	nodeOperation node::getNodeOperation() const {
 		return std::get<nodeOperation>(_value);
 	}
@@ -299,6 +399,10 @@ namespace cobalt {
 		return std::get<std::string>(_value);
 	}
 	
+	const lambdaLiteral& node::getLambda() const {
+		return *std::get<lambda_ptr>(_value);
+	}
+	
 	const std::vector<node_ptr>& node::getChildren() const {
 		return _children;
 	}
@@ -1,5 +1,6 @@
 #ifndef expressionTree_hpp
 #define expressionTree_hpp
+#include <deque>
 #include <memory>
 #include <variant>
 #include <vector>
@@ -21,6 +22,7 @@ namespace cobalt {
 		lnot,
 		size,
 		tostring,
+		keys,
 		
 		add,
 		sub,
@@ -53,6 +55,7 @@ namespace cobalt {
 		gt,
 		le,
 		ge,
+		contains,
 		comma,
 		land,
 		lor,
@@ -68,7 +71,23 @@ namespace cobalt {
 	struct node;
 	using node_ptr=std::unique_ptr<node>;
 	
-	using nodeValue=std::variant<nodeOperation, std::string, double, identifier>;
+	//Anonymous function. Its body is compiled when the expression is built, in
+	//the scope the lambda appears in.
+	struct lambdaLiteral {
+		struct capture {
+			identifier name;
+			bool by_ref;
+		};
+		
+		typeHandle typeID = nullptr;
+		std::vector<identifier> params;
+		std::vector<capture> captures;
+		std::deque<token> body;
+	};
+	
+	using lambda_ptr=std::shared_ptr<const lambdaLiteral>;
+	
+	using nodeValue=std::variant<nodeOperation, std::string, double, identifier, lambda_ptr>;
 	
 	class compilerContext;
 	
@@ -89,11 +108,13 @@ namespace cobalt {
 		bool isIdentifier() const;
 		bool isNumber() const;
 		bool isString() const;
+		bool isLambda() const;
 		
 		nodeOperation getNodeOperation() const;
 		std::string_view getIdentifier() const;
 		double getNumber() const;
 		std::string_view getString() const;
+		const lambdaLiteral& getLambda() const;
 
 		const std::vector<node_ptr>& getChildren() const;
 		
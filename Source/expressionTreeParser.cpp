@@ -1,7 +1,10 @@
 #include "expressionTreeParser.hpp"
 #include "expressionTree.hpp"
+#include "compiler.hpp"
+#include "compilerContext.hpp"
 #include "tokeniser.hpp"
 #include "errors.hpp"
+#include <optional>
 #include <stack>
 
 namespace cobalt {
@@ -61,6 +64,7 @@ namespace cobalt {
 					case nodeOperation::lnot:
 					case nodeOperation::size:
 					case nodeOperation::tostring:
+					case nodeOperation::keys:
 						precedence = operator_precedence::prefix;
 						break;
 					case nodeOperation::mul:
@@ -82,6 +86,7 @@ namespace cobalt {
 					case nodeOperation::gt:
 					case nodeOperation::le:
 					case nodeOperation::ge:
+					case nodeOperation::contains:
 						precedence = operator_precedence::comparison;
 						break;
 					case nodeOperation::eq:
@@ -148,6 +153,7 @@ namespace cobalt {
 					case nodeOperation::lnot:
 					case nodeOperation::size:
 					case nodeOperation::tostring:
+					case nodeOperation::keys:
 					case nodeOperation::call: //at least one
 						number_of_operands = 1;
 						break;
@@ -206,7 +212,7 @@ namespace cobalt {
 				case reservedToken::concat_assign:
 					return operator_info(nodeOperation::concat_assign, lineNumber, charIndex);
 				case reservedToken::mul_assign:
-					return operator_info(nodeOperation::mod_assign, lineNumber, charIndex);
+					return operator_info(nodeOperation::mul_assign, lineNumber, charIndex);
 				case reservedToken::div_assign:
 					return operator_info(nodeOperation::div_assign, lineNumber, charIndex);
 				case reservedToken::idiv_assign:
@@ -253,6 +259,10 @@ namespace cobalt {
 					return operator_info(nodeOperation::size, lineNumber, charIndex);
 				case reservedToken::kw_tostring:
 					return operator_info(nodeOperation::tostring, lineNumber, charIndex);
+				case reservedToken::kw_keysof:
+					return operator_info(nodeOperation::keys, lineNumber, charIndex);
+				case reservedToken::kw_in:
+					return operator_info(nodeOperation::contains, lineNumber, charIndex);
 				case reservedToken::open_curly:
 					return operator_info(nodeOperation::init, lineNumber, charIndex);
 				default:
@@ -315,6 +325,22 @@ namespace cobalt {
 			operator_stack.pop();
 		}
 		
+		//The reserved token, or the contextual keyword that an identifier stands for:
+		//'in' where an operator is expected, and 'keysof' where an operand is, unless
+		//a variable or function of that name is in scope.
+		std::optional<reservedToken> get_operator_token(compilerContext& context, const token& t, bool expected_operand) {
+			if (t.isReservedToken()) {
+				return t.getReservedToken();
+			}
+			if (!expected_operand && t.isContextualKeyword(reservedToken::kw_in)) {
+				return reservedToken::kw_in;
+			}
+			if (expected_operand && t.isContextualKeyword(reservedToken::kw_keysof) && !context.find(t.getIdentifier().id)) {
+				return reservedToken::kw_keysof;
+			}
+			return std::nullopt;
+		}
+		
 		node_ptr parse_expression_tree_impl(compilerContext& context, tokensIterator& it, bool allow_comma, bool allow_empty) {
 			std::stack<node_ptr> operand_stack;
 			std::stack<operator_info> operator_stack;
@@ -322,9 +348,19 @@ namespace cobalt {
 			bool expected_operand = true;
 			
 			for (; !is_end_of_expression(*it, allow_comma); ++it) {
-				if (it->isReservedToken()) {
+				if (it->hasValue(reservedToken::kw_function) && expected_operand) {
+					size_t lineNumber = it->getLineNumber();
+					size_t charIndex = it->getCharIndex();
+					operand_stack.push(std::make_unique<node>(
+						context, parseLambda(context, it), std::vector<node_ptr>(), lineNumber, charIndex
+					));
+					expected_operand = false;
+					continue;
+				}
+				
+				if (std::optional<reservedToken> rt = get_operator_token(context, *it, expected_operand)) {
 					operator_info oi = get_operator_info(
-						it->getReservedToken(), expected_operand, it->getLineNumber(), it->getCharIndex()
+						*rt, expected_operand, it->getLineNumber(), it->getCharIndex()
 					);
 					
 					if (oi.operation == nodeOperation::call && expected_operand) {
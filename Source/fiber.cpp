@@ -0,0 +1,151 @@
+#include "fiber.hpp"
+#include <cstdint>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+namespace cobalt {
+	namespace {
+		//Stack left for the native code of a call and the calls it makes without
+		//going through runtimeContext::call.
+		const size_t stack_headroom = 64 * 1024;
+		
+		//Lowest address that calls on this thread may use, or nullptr outside fibers.
+		const char*& stackLimit() {
+			thread_local const char* limit = nullptr;
+			return limit;
+		}
+	}
+	
+	struct fiber::state {
+		std::function<void()> body;
+		bool finished;
+		size_t size;
+		const char* limit;
+		
+		//The stack grows down from about where body starts.
+		void start() {
+			char top;
+			limit = &top - size + stack_headroom;
+			stackLimit() = limit;
+			body();
+			finished = true;
+		}
+#ifdef _WIN32
+		LPVOID handle;
+		LPVOID caller;
+		
+		static void WINAPI entry(LPVOID p) {
+			state* self = static_cast<state*>(p);
+			self->start();
+			SwitchToFiber(self->caller);
+		}
+#else
+		char* mapping;
+		size_t mapping_size;
+		ucontext_t context;
+		ucontext_t caller;
+		
+		static void entry(unsigned int hi, unsigned int lo) {
+			state* self = reinterpret_cast<state*>((uintptr_t(hi) << 16 << 16) | uintptr_t(lo));
+			self->start();
+			swapcontext(&self->context, &self->caller);
+		}
+#endif
+	};
+	
+	fiber::fiber(std::function<void()> body, size_t stackSize):
+		_state(std::make_unique<state>())
+	{
+		_state->body = std::move(body);
+		_state->finished = false;
+		_state->size = stackSize;
+		_state->limit = nullptr;
+#ifdef _WIN32
+		//Windows commits the stack as it grows, and keeps a guard page below it.
+		_state->handle = CreateFiberEx(0, stackSize, FIBER_FLAG_FLOAT_SWITCH, &state::entry, _state.get());
+		if (!_state->handle) {
+			throw std::bad_alloc();
+		}
+#else
+		size_t page = size_t(sysconf(_SC_PAGESIZE));
+		stackSize = (stackSize + page - 1) / page * page;
+		_state->size = stackSize;
+		_state->mapping_size = stackSize + page;
+		
+		void* mapping = mmap(
+			nullptr, _state->mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0
+		);
+		if (mapping == MAP_FAILED) {
+			throw std::bad_alloc();
+		}
+		_state->mapping = static_cast<char*>(mapping);
+		
+		//An overflow past the headroom faults on the guard page instead of
+		//writing over whatever is mapped below.
+		mprotect(_state->mapping, page, PROT_NONE);
+		
+		getcontext(&_state->context);
+		_state->context.uc_stack.ss_sp = _state->mapping + page;
+		_state->context.uc_stack.ss_size = stackSize;
+		_state->context.uc_link = nullptr;
+		uintptr_t p = reinterpret_cast<uintptr_t>(_state.get());
+		makecontext(
+			&_state->context,
+			reinterpret_cast<void(*)()>(&state::entry),
+			2,
+			(unsigned int)(p >> 16 >> 16),
+			(unsigned int)(p & 0xffffffff)
+		);
+#endif
+	}
+	
+	fiber::~fiber() {
+#ifdef _WIN32
+		DeleteFiber(_state->handle);
+#else
+		munmap(_state->mapping, _state->mapping_size);
+#endif
+	}
+	
+	void fiber::resume() {
+		const char* caller_limit = stackLimit();
+		stackLimit() = _state->limit;
+#ifdef _WIN32
+		if (!IsThreadAFiber()) {
+			ConvertThreadToFiber(nullptr);
+		}
+		_state->caller = GetCurrentFiber();
+		SwitchToFiber(_state->handle);
+#else
+		swapcontext(&_state->caller, &_state->context);
+#endif
+		stackLimit() = caller_limit;
+	}
+	
+	void fiber::yield() {
+#ifdef _WIN32
+		SwitchToFiber(_state->caller);
+#else
+		swapcontext(&_state->context, &_state->caller);
+#endif
+	}
+	
+	bool fiber::finished() const {
+		return _state->finished;
+	}
+	
+	bool fiber::nearStackLimit() {
+		char here;
+		const char* limit = stackLimit();
+		return limit && &here < limit;
+	}
+}
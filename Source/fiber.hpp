@@ -0,0 +1,35 @@
+#ifndef fiber_hpp
+#define fiber_hpp
+
+#include <functional>
+#include <memory>
+
+namespace cobalt {
+	//Stack of its own that body runs on. resume runs body until it yields or
+	//returns, yield goes back to the resume that is running it. body must not
+	//throw. The stack is reserved up front and committed as it is used, with a
+	//guard page below it.
+	class fiber {
+		fiber(const fiber&) = delete;
+		void operator=(const fiber&) = delete;
+	private:
+		struct state;
+		std::unique_ptr<state> _state;
+	public:
+		fiber(std::function<void()> body, size_t stackSize);
+		~fiber();
+		
+		void resume();
+		void yield();
+		
+		//True once body has returned.
+		bool finished() const;
+		
+		//Whether the fiber running on this thread is close to the end of its stack,
+		//so that a call could overflow it. Always false outside fibers, which run
+		//on the stack of the thread.
+		static bool nearStackLimit();
+	};
+}
+
+#endif /* fiber_hpp */
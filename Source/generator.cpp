@@ -0,0 +1,118 @@
+#include "generator.hpp"
+#include "runtimeContext.hpp"
+#include "errors.hpp"
+
+namespace cobalt {
+	namespace {
+		//As much as the main thread usually gets. Only the pages a generator
+		//touches are committed.
+		const size_t generator_stack_size = 8 * 1024 * 1024;
+		
+		//Thrown from the yield of a generator that is destroyed, to unwind its body.
+		struct generatorExit {
+		};
+	}
+	
+	generatorState::generatorState(const runtimeContext& ctx, function body, std::vector<variablePtr> params):
+		_ctx(ctx.createWorker()),
+		_body(std::move(body)),
+		_params(std::move(params)),
+		_fiber([this](){
+			run();
+		}, generator_stack_size),
+		_started(false),
+		_running(false),
+		_cancelled(false)
+	{
+	}
+	
+	generatorState::~generatorState() {
+		if (_started && !_fiber.finished()) {
+			_cancelled = true;
+			resume();
+		}
+		
+		_params.push_back(std::move(_value));
+		releaseVariables(_params);
+	}
+	
+	void generatorState::call(runtimeContext& ctx) {
+		std::shared_ptr<functionState> running = shared_from_this();
+		ctx.retval() = next();
+	}
+	
+	void generatorState::trace(const std::function<void(const variablePtr&)>& visit) const {
+		_ctx->trace(visit);
+		for (const variablePtr& v : _params) {
+			visit(v);
+		}
+		visit(_value);
+	}
+	
+	generatorState*& generatorState::current() {
+		thread_local generatorState* current_generator = nullptr;
+		return current_generator;
+	}
+	
+	void generatorState::run() {
+		try {
+			_ctx->call(_body, std::move(_params));
+		} catch (const generatorExit&) {
+		} catch (...) {
+			_error = std::current_exception();
+		}
+		_value = nullptr;
+	}
+	
+	void generatorState::resume() {
+		generatorState* previous = current();
+		current() = this;
+		_started = true;
+		_running = true;
+		_fiber.resume();
+		_running = false;
+		current() = previous;
+	}
+	
+	variablePtr generatorState::next() {
+		runtimeAssertion(!_running, "Generator is already running");
+		
+		if (_fiber.finished()) {
+			return nullptr;
+		}
+		
+		resume();
+		
+		if (_error) {
+			std::exception_ptr error = std::move(_error);
+			_error = nullptr;
+			std::rethrow_exception(error);
+		}
+		
+		return std::move(_value);
+	}
+	
+	void generatorState::yield(variablePtr value) {
+		generatorState* g = current();
+		g->_value = std::move(value);
+		g->_fiber.yield();
+		
+		if (g->_cancelled) {
+			throw generatorExit();
+		}
+	}
+	
+	function createGeneratorFunction(size_t paramCount, function body) {
+		return [paramCount, body=std::move(body)](runtimeContext& ctx) {
+			std::vector<variablePtr> params;
+			params.reserve(paramCount);
+			for (size_t i = 0; i < paramCount; ++i) {
+				params.push_back(ctx.local(-1 - int(i)));
+			}
+			
+			std::shared_ptr<generatorState> state = std::make_shared<generatorState>(ctx, body, std::move(params));
+			
+			ctx.retval() = std::make_shared<variableImpl<function> >(statefulFunction(std::move(state)));
+		};
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef generator_hpp
+#define generator_hpp
+
+#include <exception>
+#include <memory>
+#include <vector>
+#include "cycleCollector.hpp"
+#include "fiber.hpp"
+#include "variable.hpp"
+
+namespace cobalt {
+	//Runs the body of a generator function on a stack of its own, in a worker
+	//context, up to one yield at a time. A generator destroyed before its body
+	//returns unwinds the body from the yield it is suspended at.
+	class generatorState: public functionState {
+		generatorState(const generatorState&) = delete;
+		void operator=(const generatorState&) = delete;
+	private:
+		std::unique_ptr<runtimeContext> _ctx;
+		function _body;
+		std::vector<variablePtr> _params;
+		fiber _fiber;
+		variablePtr _value;
+		std::exception_ptr _error;
+		bool _started;
+		bool _running;
+		bool _cancelled;
+		
+		void run();
+		void resume();
+		
+		static generatorState*& current();
+	public:
+		generatorState(const runtimeContext& ctx, function body, std::vector<variablePtr> params);
+		~generatorState() override;
+		
+		//Sets the return value to the result of next.
+		void call(runtimeContext& ctx) override;
+		
+		//Follows the worker context, which holds the globals, and the parameters and
+		//value not yet passed on.
+		void trace(const std::function<void(const variablePtr&)>& visit) const override;
+		
+		//Runs the body up to its next yield and returns the yielded value, or null
+		//once the body has returned.
+		variablePtr next();
+		
+		//Suspends the generator that runs on this thread, making value the result
+		//of its next.
+		static void yield(variablePtr value);
+	};
+	
+	//Function that starts a generator, in place of the body of a generator function
+	//with paramCount parameters. The call returns a generator value: a function that
+	//sets the return value to the next yielded value, or to null at the end.
+	function createGeneratorFunction(size_t paramCount, function body);
+}
+
+#endif /* generator_hpp */
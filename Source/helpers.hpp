@@ -1,11 +1,27 @@
 #ifndef helpers_h
 #define helpers_h
 
+#include <cstddef>
+#include <cstdint>
+
 namespace cobalt {
 
 	//blatantly stolen from https://en.cppreference.com/w/cpp/utility/variant/visit
 	template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 	template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
+	
+	//Hash that an FNV-1a hash starts from.
+	const uint64_t fnv_offset_basis = 14695981039346656037ull;
+	
+	//Mixes size bytes at data into the FNV-1a hash h. It is quick, not hard to
+	//collide, so equal hashes are only a hint that the hashed bytes are equal.
+	inline uint64_t fnv1a(uint64_t h, const void* data, size_t size) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i) {
+			h = (h ^ uint64_t(bytes[i])) * 1099511628211ull;
+		}
+		return h;
+	}
 
 }
 
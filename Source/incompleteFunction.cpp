@@ -2,9 +2,123 @@
 #include "compiler.hpp"
 #include "compilerContext.hpp"
 #include "errors.hpp"
+#include "generator.hpp"
+#include "runtimeContext.hpp"
 #include "tokeniser.hpp"
+#include "helpers.hpp"
+#include <atomic>
 
 namespace cobalt {
+	//Bodies compiled for a function. A replaced body is freed once no call of the
+	//function runs, as the calls that run it may not have finished yet.
+	class functionCode {
+	private:
+		struct body {
+			shared_statement_ptr stmt;
+			size_t frame_size;
+		};
+		
+		std::unique_ptr<const body> _first;
+		std::unique_ptr<const body> _latest;
+		std::vector<std::unique_ptr<const body> > _retired;
+		std::atomic<const body*> _current;
+		mutable std::atomic<size_t> _running;
+		
+		class runningRaii {
+		private:
+			std::atomic<size_t>& _running;
+		public:
+			runningRaii(std::atomic<size_t>& running):
+				_running(running)
+			{
+				++_running;
+			}
+			
+			~runningRaii() {
+				--_running;
+			}
+		};
+		
+		void retireLatest() {
+			if (_latest) {
+				_retired.push_back(std::move(_latest));
+			}
+			
+			//a call that starts after the check loads the new current body
+			if (_running == 0) {
+				_retired.clear();
+			}
+		}
+	public:
+		functionCode():
+			_current(nullptr),
+			_running(0)
+		{
+		}
+		
+		void publish(shared_statement_ptr stmt, size_t frameSize) {
+			std::unique_ptr<const body> b(new body{std::move(stmt), frameSize});
+			
+			if (!_first) {
+				_first = std::move(b);
+				_current = _first.get();
+				return;
+			}
+			
+			_current = b.get();
+			retireLatest();
+			_latest = std::move(b);
+		}
+		
+		void restore() {
+			_current = _first.get();
+			retireLatest();
+		}
+		
+		compiledBody first() const {
+			return compiledBody{_first->stmt, _first->frame_size};
+		}
+		
+		void run(runtimeContext& ctx) const {
+			runningRaii running(_running);
+			const body* b = _current;
+			ctx.reserveFrame(b->frame_size);
+			b->stmt->execute(ctx);
+			ctx.setFlow(flow::normalFlow());
+		}
+	};
+	
+	namespace {
+		struct scriptFunction {
+			std::shared_ptr<functionCode> code;
+			size_t index;
+			
+			void operator()(runtimeContext& ctx) const {
+				code->run(ctx);
+			}
+		};
+		
+		struct profiledScriptFunction {
+			std::shared_ptr<functionCode> code;
+			size_t index;
+			
+			void operator()(runtimeContext& ctx) const {
+				ctx.profile(index);
+				code->run(ctx);
+			}
+		};
+	}
+	
+	std::optional<size_t> scriptFunctionIndex(const function& f) {
+		if (const scriptFunction* sf = f.target<scriptFunction>()) {
+			return sf->index;
+		}
+		if (const profiledScriptFunction* sf = f.target<profiledScriptFunction>()) {
+			return sf->index;
+		}
+		return std::nullopt;
+	}
+	
 	functionDeclaration parseFunctionDeclaration(compilerContext& ctx, tokensIterator& it) {
 		functionDeclaration ret;
 		
@@ -35,7 +149,7 @@ namespace cobalt {
 				if (!it->hasValue(reservedToken::close_round) && !it->hasValue(reservedToken::comma)) {
 					ret.params.push_back(parseDeclarationName(ctx, it));
 				} else {
-					ret.params.push_back("@"+std::to_string(ret.params.size()));
+					ret.params.push_back(ctx.intern("@"+std::to_string(ret.params.size())));
 				}
 			}
 			++it;
@@ -72,12 +186,14 @@ namespace cobalt {
 			throw unexpectedSyntaxError("end of file", it->getLineNumber(), it->getCharIndex());
 		}
 		
-		ctx.createFunction(_decl.name, _decl.typeID);
+		_index = ctx.createFunction(_decl.name.id, _decl.typeID)->index();
 	}
 	
 	incompleteFunction::incompleteFunction(incompleteFunction&& orig) noexcept:
 		_tokens(std::move(orig._tokens)),
-		_decl(std::move(orig._decl))
+		_decl(std::move(orig._decl)),
+		_index(orig._index),
+		_code(std::move(orig._code))
 	{
 	}
 	
@@ -85,21 +201,150 @@ namespace cobalt {
 		return _decl;
 	}
 	
-	function incompleteFunction::compile(compilerContext& ctx) {
+	const std::deque<token>& incompleteFunction::getTokens() const {
+		return _tokens;
+	}
+	
+	std::string incompleteFunction::serializedTokens() const {
+		//the kind and the value of each token, with the size of each name, so that
+		//different tokens never give the same bytes
+		std::string ret;
+		
+		auto add = [&ret](const void* data, size_t size) {
+			ret.append(static_cast<const char*>(data), size);
+		};
+		
+		auto addName = [&add](std::string_view name) {
+			size_t size = name.size();
+			add(&size, sizeof(size));
+			add(name.data(), name.size());
+		};
+		
+		for (const identifier& param : _decl.params) {
+			addName(param.name);
+		}
+		
+		for (const token& t : _tokens) {
+			size_t kind = t.getValue().index();
+			add(&kind, sizeof(kind));
+			std::visit(overloaded{
+				[&](reservedToken rt) {
+					add(&rt, sizeof(rt));
+				},
+				[&](const identifier& id) {
+					addName(id.name);
+				},
+				[&](double d) {
+					add(&d, sizeof(d));
+				},
+				[&](const std::string& str) {
+					size_t size = str.size();
+					add(&size, sizeof(size));
+					add(str.data(), str.size());
+				},
+				[&](eof) {
+				}
+			}, t.getValue());
+		}
+		
+		return ret;
+	}
+	
+	bool incompleteFunction::canInline(size_t budget) const {
+		const functionType* ft = std::get_if<functionType>(_decl.typeID);
+		
+		if (_tokens.size() > budget || std::holds_alternative<generatorType>(*ft->return_type_id)) {
+			return false;
+		}
+		
+		size_t returns = 0;
+		int nesting = 0;
+		
+		for (size_t i = 0; i < _tokens.size(); ++i) {
+			if (_tokens[i].hasValue(reservedToken::open_curly)) {
+				++nesting;
+			} else if (_tokens[i].hasValue(reservedToken::close_curly)) {
+				--nesting;
+			} else if (_tokens[i].hasValue(reservedToken::kw_return)) {
+				const token& prev = _tokens[i-1];
+				if (
+					returns != 0 ||
+					nesting != 1 || (
+						!prev.hasValue(reservedToken::semicolon) &&
+						!prev.hasValue(reservedToken::open_curly) &&
+						!prev.hasValue(reservedToken::close_curly)
+					)
+				) {
+					return false;
+				}
+				
+				size_t end = i + 1;
+				for (int depth = 0; end < _tokens.size(); ++end) {
+					if (_tokens[end].hasValue(reservedToken::open_curly)) {
+						++depth;
+					} else if (_tokens[end].hasValue(reservedToken::close_curly)) {
+						--depth;
+					} else if (depth == 0 && _tokens[end].hasValue(reservedToken::semicolon)) {
+						break;
+					}
+				}
+				
+				if (end + 2 != _tokens.size()) {
+					return false;
+				}
+				
+				++returns;
+			}
+		}
+		
+		return returns == 1 || ft->return_type_id == typeRegistry::getVoidHandle();
+	}
+	
+	function incompleteFunction::compile(compilerContext& ctx, const compiledBody* compiled) {
+		_code = std::make_shared<functionCode>();
+		
+		if (compiled) {
+			_code->publish(compiled->stmt, compiled->frame_size);
+		} else {
+			recompile(ctx);
+		}
+		
+		const functionType* ft = std::get_if<functionType>(_decl.typeID);
+		
+		if (std::holds_alternative<generatorType>(*ft->return_type_id)) {
+			return createGeneratorFunction(_decl.params.size(), scriptFunction{_code, _index});
+		}
+		
+		if (ctx.profiledFunction()) {
+			return profiledScriptFunction{_code, _index};
+		}
+		
+		return scriptFunction{_code, _index};
+	}
+	
+	void incompleteFunction::recompile(compilerContext& ctx) {
 		auto _ = ctx.function();
+		auto expansion = ctx.expand(this);
 		
 		const functionType* ft = std::get_if<functionType>(_decl.typeID);
 		
 		for (int i = 0; i < int(_decl.params.size()); ++i) {
-			ctx.createParam(std::move(_decl.params[i]), ft->param_type_id[i].typeID);
+			ctx.createParam(_decl.params[i].id, ft->param_type_id[i].typeID, ft->param_type_id[i].by_ref);
 		}
 		
-		tokensIterator it(_tokens);
+		std::deque<token> tokens = _tokens;
+		tokensIterator it(tokens);
 		
 		shared_statement_ptr stmt = compileFunctionBlock(ctx, it, ft->return_type_id);
 		
-		return [stmt=std::move(stmt)] (runtimeContext& ctx) {
-			stmt->execute(ctx);
-		};
+		_code->publish(std::move(stmt), ctx.frameSize());
+	}
+	
+	void incompleteFunction::restore() {
+		_code->restore();
+	}
+	
+	compiledBody incompleteFunction::body() const {
+		return _code->first();
 	}
 }
@@ -3,28 +3,44 @@
 
 #include "tokens.hpp"
 #include "types.hpp"
+#include "statement.hpp"
+#include <cstdint>
 #include <deque>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string>
 
 namespace cobalt {
 	class compilerContext;
 	class runtimeContext;
 	class tokensIterator;
+	class functionCode;
 	using function = std::function<void(runtimeContext&)>;
 
 	struct functionDeclaration{
-		std::string name;
+		identifier name;
 		typeHandle typeID;
-		std::vector<std::string> params;
+		std::vector<identifier> params;
 	};
 	
 	functionDeclaration parseFunctionDeclaration(compilerContext& ctx, tokensIterator& it);
+	
+	//Index of the function that f runs, if it is a script function returned by
+	//incompleteFunction::compile.
+	std::optional<size_t> scriptFunctionIndex(const function& f);
+	
+	struct compiledBody {
+		shared_statement_ptr stmt;
+		size_t frame_size;
+	};
 
 	class incompleteFunction {
 	private:
 		functionDeclaration _decl;
 		std::deque<token> _tokens;
 		size_t _index;
+		std::shared_ptr<functionCode> _code;
 	public:
 		incompleteFunction(compilerContext& ctx, tokensIterator& it);
 		
@@ -32,7 +48,30 @@ namespace cobalt {
 		
 		const functionDeclaration& getDecl() const;
 		
-		function compile(compilerContext& ctx);
+		const std::deque<token>& getTokens() const;
+		
+		//Bytes of the names of the parameters and the tokens of the body, which are
+		//equal for functions that compile the same in the same declarations.
+		std::string serializedTokens() const;
+		
+		//True if the body is at most budget tokens long and its only return
+		//statement, if any, is the last statement of the body.
+		bool canInline(size_t budget) const;
+		
+		//The returned function runs the body compiled last, by this or recompile.
+		//It counts its calls in the runtime profile if the context profiles it.
+		//A given body, compiled before from the same tokens and declarations, is
+		//used instead of compiling one.
+		function compile(compilerContext& ctx, const compiledBody* compiled = nullptr);
+		
+		//Body the function was first compiled with.
+		compiledBody body() const;
+		
+		//Compiles the body again, for the function that compile returned.
+		void recompile(compilerContext& ctx);
+		
+		//Makes the function that compile returned run the body it was compiled with.
+		void restore();
 	};
 }
 
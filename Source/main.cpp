@@ -1,10 +1,109 @@
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
 #include "module.hpp"
 #include "standardFunctions.hpp"
 
-int main() {
-	std::string path = __FILE__;
-	path = path.substr(0, path.find_last_of("/\\") + 1) + "..\\Samples\\ascTest.cbt";
+namespace {
+	std::string samplesDirectory() {
+		std::string path = __FILE__;
+		return path.substr(0, path.find_last_of("/\\") + 1) + "../Samples/";
+	}
+	
+	void expect(const char* what, bool ok) {
+		std::cout << (ok ? "ok " : "FAILED ") << what << std::endl;
+	}
+	
+	//The consumer and the producer of pipeTest.cbt, as executions of one module,
+	//wait on a channel for each other.
+	void checkChannelBetweenExecutions() {
+		using namespace cobalt;
+		
+		module m;
+		addStandardFunctions(m);
+		
+		auto consumer = m.createAsyncPublicFunctionCaller<number>("consumer");
+		auto producer = m.createAsyncPublicFunctionCaller<void>("producer");
+		
+		m.load((samplesDirectory() + "pipeTest.cbt").c_str());
+		
+		future<number> received = consumer();
+		future<void> sent = producer();
+		m.runAsync();
+		
+		sent.get();
+		expect("channel between executions", received.get() == 6);
+	}
+	
+	//Reloads reloadTest1.cbt with reloadTest2.cbt while a call of the first
+	//program waits for delayed, which completes only once the new program is in.
+	void checkReloadWhileRunning() {
+		using namespace cobalt;
+		
+		module m;
+		addStandardFunctions(m);
+		
+		std::promise<void> waiting;
+		promise<number> delay;
+		m.addAsyncExternalFunctions("delayed", std::function<future<number>(number, number)>([&](number, number){
+			waiting.set_value();
+			return delay.get_future();
+		}));
+		
+		auto version = m.createPublicFunctionCaller<std::string>("version");
+		auto version_after_delay = m.createAsyncPublicFunctionCaller<std::string>("version_after_delay");
+		
+		m.load((samplesDirectory() + "reloadTest1.cbt").c_str());
+		
+		future<std::string> old_call = version_after_delay();
+		std::thread runner([&](){
+			m.runAsync();
+		});
+		waiting.get_future().wait();
+		
+		m.reload(samplesDirectory() + "reloadTest2.cbt").get();
+		expect("new calls run the reloaded program", version() == "two");
+		
+		delay.set_value(0);
+		runner.join();
+		expect("running call finishes on the previous program", old_call.get() == "one");
+		
+		bool failed = false;
+		try {
+			m.reload(samplesDirectory() + "missing.cbt").get();
+		} catch (const std::exception&) {
+			failed = true;
+		}
+		expect("failed reload keeps the program", failed && version() == "two");
+	}
+}
+
+//Runs the public main function of each sample given on the command line, or of
+//ascTest.cbt. A runtime error ends the sample that raises it and is printed, then
+//the next sample runs. With -m bytes before the samples, scripts may hold at most
+//that many bytes. With -checks instead of samples, it runs the checks of the
+//host interface above.
+int main(int argc, char** argv) {
+	std::vector<std::string> paths(argv + 1, argv + argc);
+	size_t memory_limit = 0;
+	
+	if (paths.size() == 1 && paths[0] == "-checks") {
+		checkChannelBetweenExecutions();
+		checkReloadWhileRunning();
+		return 0;
+	}
+	
+	if (paths.size() >= 2 && paths[0] == "-m") {
+		memory_limit = std::stoul(paths[1]);
+		paths.erase(paths.begin(), paths.begin() + 2);
+	}
+	
+	if (paths.empty()) {
+		paths.push_back(samplesDirectory() + "ascTest.cbt");
+	}
 	
 	using namespace cobalt;
 	
@@ -12,16 +111,46 @@ int main() {
 	
 	addStandardFunctions(m);
 	
+	m.setMemoryLimit(memory_limit);
+	
 	/*
 	m.addExternalFunctions("greater", std::function<number(number, number)>([](number x, number y){
 		return x > y;
 	}));
 	*/
 	
-	auto s_main = m.createPublicFunctionCaller<void>("main");
+	//Completes with value after ms milliseconds, on a thread of its own, and
+	//fails for a negative delay.
+	m.addAsyncExternalFunctions("delayed", std::function<future<number>(number, number)>([](number value, number ms){
+		promise<number> p;
+		std::thread([p, value, ms](){
+			if (ms < 0) {
+				p.set_exception(std::make_exception_ptr(runtimeError("Negative delay")));
+				return;
+			}
+			std::this_thread::sleep_for(std::chrono::duration<number, std::milli>(ms));
+			p.set_value(value);
+		}).detach();
+		return p.get_future();
+	}));
+	
+	//Samples run as asynchronous executions, which delayed suspends while it
+	//waits.
+	auto s_main = m.createAsyncPublicFunctionCaller<void>("main");
 	
-	if (m.tryLoad(path.c_str(), &std::cerr)) {
-		s_main();
+	for (const std::string& path : paths) {
+		if (!m.tryLoad(path.c_str(), &std::cerr)) {
+			return 1;
+		}
+		
+		future<void> done = s_main();
+		m.runAsync();
+		
+		try {
+			done.get();
+		} catch (const std::exception& e) {
+			std::cout << "Runtime error: " << e.what() << std::endl;
+		}
 	}
 	
 	return 0;
@@ -0,0 +1,86 @@
+#include "memoryAccount.hpp"
+#include "errors.hpp"
+#include "cycleCollector.hpp"
+
+namespace cobalt {
+	namespace {
+		memoryAccount*& active_account() {
+			thread_local memoryAccount* account = nullptr;
+			return account;
+		}
+	}
+	
+	void memoryAccountRelease::operator()(memoryAccount* account) const {
+		account->drop(memoryAccount::owner_share);
+	}
+	
+	memoryAccount::memoryAccount():
+		_count(owner_share),
+		_peak(0),
+		_limit(0),
+		_collector(std::make_unique<cycleCollector>())
+	{
+	}
+	
+	void memoryAccount::drop(uint64_t amount) {
+		if (_count.fetch_sub(amount, std::memory_order_acq_rel) == amount) {
+			delete this;
+		}
+	}
+	
+	memoryAccountPtr memoryAccount::create() {
+		return memoryAccountPtr(new memoryAccount());
+	}
+	
+	memoryAccountPtr memoryAccount::acquire() {
+		_count.fetch_add(owner_share, std::memory_order_relaxed);
+		return memoryAccountPtr(this);
+	}
+	
+	void memoryAccount::charge(size_t bytes) {
+		size_t held = size_t((_count.fetch_add(bytes, std::memory_order_relaxed) + bytes) % owner_share);
+		size_t limit = _limit.load(std::memory_order_relaxed);
+		
+		if (limit != 0 && held > limit) {
+			_count.fetch_sub(bytes, std::memory_order_relaxed);
+			throw runtimeError("Memory limit exceeded");
+		}
+		
+		size_t peak = _peak.load(std::memory_order_relaxed);
+		while (held > peak && !_peak.compare_exchange_weak(peak, held, std::memory_order_relaxed));
+	}
+	
+	void memoryAccount::credit(size_t bytes) {
+		drop(bytes);
+	}
+	
+	size_t memoryAccount::current() const {
+		return size_t(_count.load(std::memory_order_relaxed) % owner_share);
+	}
+	
+	size_t memoryAccount::peak() const {
+		return _peak.load(std::memory_order_relaxed);
+	}
+	
+	void memoryAccount::setLimit(size_t bytes) {
+		_limit.store(bytes, std::memory_order_relaxed);
+	}
+	
+	cycleCollector& memoryAccount::collector() {
+		return *_collector;
+	}
+	
+	memoryAccount* memoryAccount::active() {
+		return active_account();
+	}
+	
+	memoryAccount::activeScope::activeScope(memoryAccount* account):
+		_previous(active_account())
+	{
+		active_account() = account;
+	}
+	
+	memoryAccount::activeScope::~activeScope() {
+		active_account() = _previous;
+	}
+}
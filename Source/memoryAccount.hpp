@@ -0,0 +1,75 @@
+#ifndef memoryAccount_hpp
+#define memoryAccount_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace cobalt {
+	class memoryAccount;
+	class cycleCollector;
+	
+	struct memoryAccountRelease {
+		void operator()(memoryAccount* account) const;
+	};
+	
+	//Reference that keeps an account open.
+	using memoryAccountPtr = std::unique_ptr<memoryAccount, memoryAccountRelease>;
+	
+	//Bytes held by the variables and strings that the contexts of a module create.
+	//Values charged to it keep it alive along with the references to it, so they
+	//may outlive the module and be freed on any thread.
+	class memoryAccount {
+		memoryAccount(const memoryAccount&) = delete;
+		void operator=(const memoryAccount&) = delete;
+	private:
+		//Bytes held, plus owner_share for each reference. The account is deleted by
+		//whatever brings it to zero.
+		std::atomic<uint64_t> _count;
+		std::atomic<size_t> _peak;
+		std::atomic<size_t> _limit;
+		std::unique_ptr<cycleCollector> _collector;
+		
+		static constexpr uint64_t owner_share = uint64_t(1) << 44;
+		
+		memoryAccount();
+		
+		void drop(uint64_t amount);
+		
+		friend struct memoryAccountRelease;
+	public:
+		static memoryAccountPtr create();
+		
+		memoryAccountPtr acquire();
+		
+		//Adds bytes, or throws a runtimeError if that would exceed the limit.
+		void charge(size_t bytes);
+		
+		void credit(size_t bytes);
+		
+		size_t current() const;
+		size_t peak() const;
+		
+		//Zero removes the limit.
+		void setLimit(size_t bytes);
+		
+		//Collector of the cycles between the values charged to the account.
+		cycleCollector& collector();
+		
+		//Account charged by the context that runs on this thread, if any.
+		static memoryAccount* active();
+		
+		//Makes an account active on this thread while it lives.
+		class activeScope {
+			activeScope(const activeScope&) = delete;
+			void operator=(const activeScope&) = delete;
+		private:
+			memoryAccount* _previous;
+		public:
+			explicit activeScope(memoryAccount* account);
+			~activeScope();
+		};
+	};
+}
+
+#endif /* memoryAccount_hpp */
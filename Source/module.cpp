@@ -1,10 +1,24 @@
 #include "module.hpp"
 #include <vector>
+#include <atomic>
+#include <future>
+#include <mutex>
 #include <cstdio>
 #include "errors.hpp"
 #include "pushBackStream.hpp"
 #include "tokeniser.hpp"
 #include "compiler.hpp"
+#include "native.hpp"
+#include "programCache.hpp"
+#include "transpiler.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
 
 namespace cobalt {
 	namespace {
@@ -32,45 +46,261 @@ namespace cobalt {
 				return fgetc(_fp);
 			}
 		};
+		
+		class library{
+			library(const library&) = delete;
+			void operator=(const library&) = delete;
+		private:
+#ifdef _WIN32
+			HMODULE _handle;
+#else
+			void* _handle;
+#endif
+		public:
+			library(const char* path):
+#ifdef _WIN32
+				_handle(LoadLibraryA(path))
+#else
+				_handle(dlopen(path, RTLD_NOW))
+#endif
+			{
+				if (!_handle) {
+					throw fileNotFound(std::string("'") + path + "' cannot be loaded");
+				}
+			}
+			
+			~library() {
+#ifdef _WIN32
+				FreeLibrary(_handle);
+#else
+				dlclose(_handle);
+#endif
+			}
+			
+			const void* symbol(const char* name) const {
+#ifdef _WIN32
+				return reinterpret_cast<const void*>(GetProcAddress(_handle, name));
+#else
+				return dlsym(_handle, name);
+#endif
+			}
+		};
 	}
 
 	class module_impl {
 	private:
+		//Program with the context that runs it. Callers hold it while they run it,
+		//so loading another one replaces it without waiting for them.
+		struct loadedProgram {
+			std::shared_ptr<const program> compiled;
+			runtimeContext context;
+			std::vector<function> public_functions;
+			
+			loadedProgram(std::shared_ptr<const program> compiled, runtimeContext context):
+				compiled(std::move(compiled)),
+				context(std::move(context))
+			{
+			}
+		};
+		
+		std::vector<std::unique_ptr<library> > _libraries;
+		std::vector<const nativeModule*> _native_modules;
 		std::vector<std::pair<std::string, function> > _external_functions;
 		std::vector<std::string> _public_declarations;
-		std::unordered_map<std::string, std::shared_ptr<function> > _public_functions;
-		std::unique_ptr<runtimeContext> _context;
+		std::vector<std::string> _public_names;
+		std::shared_ptr<loadedProgram> _loaded;
+		scheduler _scheduler;
+		size_t _inline_budget;
+		size_t _hot_threshold;
+		memoryAccountPtr _account;
+		std::mutex _calls_mutex;
+		size_t _running_calls;
+		size_t _collection_threshold;
 	public:
-		module_impl(){
+		module_impl():
+			_inline_budget(40),
+			_hot_threshold(1000),
+			_account(memoryAccount::create()),
+			_running_calls(0),
+			_collection_threshold(1000)
+		{
+		}
+		
+		~module_impl() {
+			//Once the program is released, the cycles it left are garbage.
+			std::atomic_store(&_loaded, std::shared_ptr<loadedProgram>());
+			_account->collector().collect();
+		}
+		
+		void setInlineBudget(size_t budget) {
+			_inline_budget = budget;
+		}
+		
+		void setHotThreshold(size_t threshold) {
+			_hot_threshold = threshold;
+		}
+		
+		memoryAccount& account() const {
+			return *_account;
+		}
+		
+		void setCycleCollectionThreshold(size_t threshold) {
+			std::lock_guard<std::mutex> lock(_calls_mutex);
+			_collection_threshold = threshold;
+		}
+		
+		void beginCall() {
+			std::lock_guard<std::mutex> lock(_calls_mutex);
+			++_running_calls;
 		}
 		
-		runtimeContext* getRuntimeContext() {
-			return _context.get();
+		//Calls that begin wait for the collection to finish.
+		void endCall() noexcept{
+			std::lock_guard<std::mutex> lock(_calls_mutex);
+			
+			if (--_running_calls == 0 && _collection_threshold != 0) {
+				cycleCollector& collector = _account->collector();
+				if (collector.createdSinceCollection() >= _collection_threshold) {
+					try {
+						collector.collect();
+					} catch (...) {
+						//The values stay until the next collection.
+					}
+				}
+			}
 		}
 		
-		void addPublicFunctionDeclaration(std::string declaration, std::string name, std::shared_ptr<function> fptr) {
+		module::loadedFunction getPublicFunction(size_t idx) {
+			std::shared_ptr<loadedProgram> loaded = std::atomic_load(&_loaded);
+			
+			runtimeAssertion(loaded && idx < loaded->public_functions.size(), "Public function is not loaded");
+			
+			const function* f = &loaded->public_functions[idx];
+			return module::loadedFunction{std::shared_ptr<runtimeContext>(loaded, &loaded->context), f};
+		}
+		
+		void spawnExecution(const runtimeContext& context, std::function<void(runtimeContext&)> body) {
+			std::shared_ptr<runtimeContext> ctx = context.createWorker();
+			beginCall();
+			_scheduler.spawn([this, ctx, body=std::move(body)](){
+				try {
+					body(*ctx);
+				} catch (...) {
+					endCall();
+					throw;
+				}
+				endCall();
+			});
+		}
+		
+		void runAsync() {
+			_scheduler.run();
+		}
+		
+		size_t addPublicFunctionDeclaration(std::string declaration, std::string name) {
 			_public_declarations.push_back(std::move(declaration));
-			_public_functions.emplace(std::move(name), std::move(fptr));
+			_public_names.push_back(std::move(name));
+			return _public_names.size() - 1;
 		}
 		
 		void addExternalFunctionImpl(std::string declaration, function f) {
 			_external_functions.emplace_back(std::move(declaration), std::move(f));
 		}
 		
-		void load(const char* path) {
-			file f(path);
-			get_character get = [&](){
-				return f();
+		std::shared_ptr<const program> compileSource(const std::string& source, const functionBodies* previous) {
+			get_character get = [&source, i = size_t(0)]() mutable {
+				if (i < source.size()) {
+					return int(source[i++]);
+				} else {
+					return -1;
+				}
 			};
 			push_back_stream stream(&get);
 			
-			tokensIterator it(stream);
+			std::shared_ptr<symbolTable> symbols = std::make_shared<symbolTable>();
+			
+			tokensIterator it(stream, *symbols);
+			
+			return compile(
+				it, symbols, _external_functions, _public_declarations, _inline_budget, _hot_threshold, _native_modules, previous
+			);
+		}
+		
+		//Variables of the previous program for the globals of compiled declared
+		//with the same name and type, by index in compiled, or null.
+		static std::vector<variablePtr> keptGlobals(loadedProgram& previous, const program& compiled) {
+			std::unordered_map<std::string_view, size_t> indices;
+			for (size_t i = 0; i < previous.compiled->globals.size(); ++i) {
+				if (!previous.compiled->globals[i].empty()) {
+					indices.emplace(previous.compiled->globals[i], i);
+				}
+			}
+			
+			std::vector<variablePtr> ret(compiled.globals.size());
+			for (size_t i = 0; i < compiled.globals.size(); ++i) {
+				auto it = indices.find(compiled.globals[i]);
+				if (it != indices.end()) {
+					ret[i] = previous.context.global(int(it->second));
+				}
+			}
+			return ret;
+		}
+		
+		void load(const char* path) {
+			//functions unchanged since the loaded program keep their bodies
+			std::shared_ptr<loadedProgram> current = std::atomic_load(&_loaded);
+			const functionBodies* previous = current ? current->compiled->bodies.get() : nullptr;
+			
+			std::shared_ptr<const program> compiled;
+			std::string source;
+			{
+				file f(path);
+				for (int c = f(); c != EOF; c = f()) {
+					source.push_back(char(c));
+				}
+			}
+			
+			//native modules are matched with the layout while compiling, and may
+			//be unloaded with the module
+			if (_native_modules.empty()) {
+				std::string declarations = std::to_string(_inline_budget) + " " + std::to_string(_hot_threshold) + "\n";
+				for (const auto& p : _external_functions) {
+					declarations += p.first + "\n";
+				}
+				declarations += "public\n";
+				for (const std::string& d : _public_declarations) {
+					declarations += d + "\n";
+				}
+				
+				compiled = programCache::shared().get(source, std::move(declarations), [&](){
+					return compileSource(source, previous);
+				});
+			} else {
+				compiled = compileSource(source, previous);
+			}
+			
+			//globals declared with the same name and type keep their values, and
+			//their initializers do not run
+			std::vector<variablePtr> kept;
+			if (current) {
+				kept = keptGlobals(*current, *compiled);
+			}
+			
+			runtimeContext context = createContext(*compiled, _external_functions, _account->acquire(), kept);
 			
-			_context = std::make_unique<runtimeContext>(compile(it, _external_functions, _public_declarations));
+			std::shared_ptr<loadedProgram> loaded = std::make_shared<loadedProgram>(std::move(compiled), std::move(context));
 			
-			for (const auto& p : _public_functions) {
-				*p.second = _context->get_public_function(p.first.c_str());
+			for (const std::string& name : _public_names) {
+				loaded->public_functions.push_back(loaded->context.get_public_function(name.c_str()));
 			}
+			
+			std::atomic_store(&_loaded, std::move(loaded));
+		}
+		
+		std::future<void> reload(std::string path) {
+			return std::async(std::launch::async, [this, path=std::move(path)](){
+				load(path.c_str());
+			});
 		}
 		
 		bool tryLoad(const char* path, std::ostream* err) noexcept{
@@ -100,9 +330,40 @@ namespace cobalt {
 			return false;
 		}
 		
+		void transpile(const char* path, std::ostream& out) {
+			file f(path);
+			get_character get = [&](){
+				return f();
+			};
+			push_back_stream stream(&get);
+			
+			symbolTable symbols;
+			
+			tokensIterator it(stream, symbols);
+			
+			cobalt::transpile(it, symbols, _external_functions, out);
+		}
+		
+		void addNativeModule(const nativeModule& native) {
+			_native_modules.push_back(&native);
+		}
+		
+		void loadNativeLibrary(const char* path) {
+			std::unique_ptr<library> lib = std::make_unique<library>(path);
+			
+			const nativeModule* native = static_cast<const nativeModule*>(lib->symbol("cobalt_native_module"));
+			
+			if (!native) {
+				throw fileNotFound(std::string("'") + path + "' has no cobalt_native_module");
+			}
+			
+			_native_modules.push_back(native);
+			_libraries.push_back(std::move(lib));
+		}
+		
 		void resetGlobals() {
-			if (_context) {
-				_context->initialize();
+			if (std::shared_ptr<loadedProgram> loaded = std::atomic_load(&_loaded)) {
+				loaded->context.initialize();
 			}
 		}
 	};
@@ -112,16 +373,70 @@ namespace cobalt {
 	{
 	}
 	
-	runtimeContext* module::getRuntimeContext() {
-		return _impl->getRuntimeContext();
+	module::loadedFunction module::getPublicFunction(size_t idx) {
+		return _impl->getPublicFunction(idx);
+	}
+	
+	void module::spawnExecution(const runtimeContext& ctx, std::function<void(runtimeContext&)> body) {
+		_impl->spawnExecution(ctx, std::move(body));
+	}
+	
+	void module::runAsync() {
+		_impl->runAsync();
 	}
 	
 	void module::addExternalFunctionImpl(std::string declaration, function f) {
 		_impl->addExternalFunctionImpl(std::move(declaration), std::move(f));
 	}
 
-	void module::addPublicFunctionDeclaration(std::string declaration, std::string name, std::shared_ptr<function> fptr) {
-		_impl->addPublicFunctionDeclaration(std::move(declaration), std::move(name), std::move(fptr));
+	void module::addRawExternalFunction(std::string declaration, function f) {
+		_impl->addExternalFunctionImpl(std::move(declaration), std::move(f));
+	}
+	
+	size_t module::addPublicFunctionDeclaration(std::string declaration, std::string name) {
+		return _impl->addPublicFunctionDeclaration(std::move(declaration), std::move(name));
+	}
+	
+	void module::setInlineBudget(size_t budget) {
+		_impl->setInlineBudget(budget);
+	}
+	
+	void module::setHotThreshold(size_t threshold) {
+		_impl->setHotThreshold(threshold);
+	}
+	
+	void module::setMemoryLimit(size_t bytes) {
+		_impl->account().setLimit(bytes);
+	}
+	
+	size_t module::memoryUsage() const {
+		return _impl->account().current();
+	}
+	
+	size_t module::peakMemoryUsage() const {
+		return _impl->account().peak();
+	}
+	
+	void module::collectCycles() {
+		_impl->account().collector().collect();
+	}
+	
+	void module::setCycleCollectionThreshold(size_t threshold) {
+		_impl->setCycleCollectionThreshold(threshold);
+	}
+	
+	collectionStats module::cycleCollectionStats() const {
+		return _impl->account().collector().stats();
+	}
+	
+	module::runningCall::runningCall(module& m):
+		_impl(*m._impl)
+	{
+		_impl.beginCall();
+	}
+	
+	module::runningCall::~runningCall() {
+		_impl.endCall();
 	}
 	
 	void module::load(const char* path) {
@@ -132,6 +447,22 @@ namespace cobalt {
 		return _impl->tryLoad(path, err);
 	}
 	
+	std::future<void> module::reload(std::string path) {
+		return _impl->reload(std::move(path));
+	}
+	
+	void module::transpile(const char* path, std::ostream& out) {
+		_impl->transpile(path, out);
+	}
+	
+	void module::addNativeModule(const nativeModule& native) {
+		_impl->addNativeModule(native);
+	}
+	
+	void module::loadNativeLibrary(const char* path) {
+		_impl->loadNativeLibrary(path);
+	}
+	
 	void module::resetGlobals() {
 		_impl->resetGlobals();
 	}
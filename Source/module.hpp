@@ -2,15 +2,85 @@
 #define module_hpp
 
 #include <functional>
+#include <future>
+#include <optional>
 #include <tuple>
 #include <type_traits>
 #include <utility>
 #include <iostream>
 #include "variable.hpp"
 #include "runtimeContext.hpp"
+#include "async.hpp"
+#include "channel.hpp"
+#include "cycleCollector.hpp"
 
 namespace cobalt {
+	template<typename T>
+	class stream;
+	
 	namespace details {
+		template<typename T, typename = void>
+		struct is_dictionary: std::false_type {
+		};
+		
+		template<typename T>
+		struct is_stream: std::false_type {
+		};
+		
+		template<typename T>
+		struct is_stream<stream<T> >: std::true_type {
+		};
+		
+		template<typename T>
+		struct is_dictionary<T, std::void_t<typename T::key_type, typename T::mapped_type> >: std::true_type {
+		};
+		
+		template <typename T>
+		T fromVariable(const variablePtr& v) {
+			if constexpr (is_dictionary<T>::value) {
+				T ret;
+				for (const dictionary::entry& e : v->staticPointerDowncast<ldictionary>()->value.entries()) {
+					if constexpr (std::is_convertible<const std::string&, typename T::key_type>::value) {
+						ret.emplace(std::get<std::string>(e.k), fromVariable<typename T::mapped_type>(e.value));
+					} else {
+						ret.emplace(std::get<number>(e.k), fromVariable<typename T::mapped_type>(e.value));
+					}
+				}
+				return ret;
+			} else if constexpr (std::is_convertible<const std::string&, T>::value) {
+				return *v->staticPointerDowncast<lstring>()->value;
+			} else {
+				static_assert(std::is_convertible<number, T>::value);
+				return v->staticPointerDowncast<lnumber>()->value;
+			}
+		}
+		
+		inline variablePtr to_variable(number n) {
+			return std::make_shared<variableImpl<number> >(n);
+		}
+		
+		inline variablePtr to_variable(std::string str) {
+			return std::make_shared<variableImpl<string> >(accountedString(std::move(str)));
+		}
+		
+		template <typename T, typename = typename std::enable_if<is_dictionary<T>::value>::type>
+		variablePtr to_variable(T m) {
+			dictionary ret;
+			for (auto& p : m) {
+				variablePtr v = to_variable(std::move(p.second));
+				if constexpr (std::is_convertible<const std::string&, typename T::key_type>::value) {
+					ret.findOrInsert(std::string_view(p.first), [&](){
+						return v;
+					});
+				} else {
+					ret.findOrInsert(number(p.first), [&](){
+						return v;
+					});
+				}
+			}
+			return std::make_shared<variableImpl<dictionary> >(std::move(ret));
+		}
+		
 		template<typename R, typename Unpacked, typename Left>
 		struct unpacker;
 		
@@ -22,7 +92,20 @@ namespace cobalt {
 				std::tuple<Unpacked...> t
 			) const {
 				using next_unpacker = unpacker<R, std::tuple<Unpacked..., Left0>, std::tuple<Left...> >;
-				if constexpr(std::is_convertible<const std::string&, Left0>::value) {
+				if constexpr(is_dictionary<typename std::decay<Left0>::type>::value) {
+					return next_unpacker()(
+						ctx,
+						f,
+						std::tuple_cat(
+							std::move(t),
+							std::tuple<Left0>(
+								fromVariable<typename std::decay<Left0>::type>(
+									ctx.local(-1 - int(sizeof...(Unpacked)))
+								)
+							)
+						)
+					);
+				} else if constexpr(std::is_convertible<const std::string&, Left0>::value) {
 					return next_unpacker()(
 						ctx,
 						f,
@@ -64,28 +147,41 @@ namespace cobalt {
 			}
 		};
 		
+		template<typename R>
+		variablePtr retvalToVariable(R retval) {
+			if constexpr(is_dictionary<R>::value) {
+				return to_variable(std::move(retval));
+			} else if constexpr(std::is_convertible<R, std::string>::value) {
+				return std::make_shared<variableImpl<string> >(accountedString(std::move(retval)));
+			} else {
+				static_assert(std::is_convertible<R, number>::value);
+				return std::make_shared<variableImpl<number> >(retval);
+			}
+		}
+		
 		template<typename R, typename... Args>
 		function createExternalFunction(std::function<R(Args...)> f) {
 			return [f=std::move(f)](runtimeContext& ctx) {
 				if constexpr(std::is_same<R, void>::value) {
 					unpacker<R, std::tuple<>, std::tuple<Args...> >()(ctx, f, std::tuple<>());
 				} else {
-					R retval = unpacker<R, std::tuple<>, std::tuple<Args...> >()(ctx, f, std::tuple<>());
-					if constexpr(std::is_convertible<R, std::string>::value) {
-						ctx.retval() = std::make_shared<variableImpl<string> >(std::make_shared<std::string>(std::move(retval)));
-					} else {
-						static_assert(std::is_convertible<R, number>::value);
-						ctx.retval() = std::make_shared<variableImpl<number> >(retval);
-					}
+					ctx.retval() = retvalToVariable(unpacker<R, std::tuple<>, std::tuple<Args...> >()(ctx, f, std::tuple<>()));
 				}
 			};
 		}
 		
+		template<typename T>
+		struct argumentDeclaration;
+		
 		template<typename T>
 		struct retval_declaration{
-			static constexpr const char* result() {
+			static std::string result() {
 				if constexpr(std::is_same<T, void>::value) {
 					return "void";
+				} else if constexpr(is_dictionary<T>::value) {
+					return argumentDeclaration<T>::result();
+				} else if constexpr(is_stream<T>::value) {
+					return retval_declaration<typename T::value_type>::result() + "*";
 				} else if constexpr(std::is_convertible<T, std::string>::value) {
 					return "string";
 				} else {
@@ -97,8 +193,12 @@ namespace cobalt {
 		
 		template<typename T>
 		struct argumentDeclaration{
-			static constexpr const char* result() {
-				if constexpr(std::is_convertible<const std::string&, T>::value) {
+			static std::string result() {
+				using U = typename std::decay<T>::type;
+				if constexpr(is_dictionary<U>::value) {
+					return argumentDeclaration<typename U::mapped_type>::result() +
+						"[" + argumentDeclaration<typename U::key_type>::result() + "]";
+				} else if constexpr(std::is_convertible<const std::string&, T>::value) {
 					return "string";
 				} else {
 					static_assert(std::is_convertible<number, T>::value);
@@ -109,8 +209,8 @@ namespace cobalt {
 		
 		struct functionArgumentString{
 			std::string str;
-			functionArgumentString(const char* p):
-				str(p)
+			functionArgumentString(std::string s):
+				str(std::move(s))
 			{
 			}
 			
@@ -135,18 +235,17 @@ namespace cobalt {
 			}
 		}
 		
-		inline variablePtr to_variable(number n) {
-			return std::make_shared<variableImpl<number> >(n);
-		}
-		
-		inline variablePtr to_variable(std::string str) {
-			return std::make_shared<variableImpl<string> >(std::make_shared<std::string>(std::move(str)));
-		}
-		
 		template <typename T>
 		T moveFromVariable(const variablePtr& v) {
 			if constexpr (std::is_same<T, std::string>::value) {
-				return std::move(*v->staticPointerDowncast<lstring>()->value);
+				string& str = v->staticPointerDowncast<lstring>()->value;
+				if (str.use_count() == 1) {
+					return std::move(*str);
+				} else {
+					return *str;
+				}
+			} else if constexpr (is_dictionary<T>::value) {
+				return fromVariable<T>(v);
 			} else {
 				static_assert(std::is_same<number, T>::value);
 				return v->staticPointerDowncast<lnumber>()->value;
@@ -154,14 +253,143 @@ namespace cobalt {
 		}
 	}
 	
+	//Values that a script generator yields, pulled one at a time. Each call of next
+	//runs the generator up to its next yield, in the program it was returned from.
+	//While the stream lives, it counts as a running call of its module.
+	template<typename T>
+	class stream {
+	private:
+		std::shared_ptr<runtimeContext> _ctx;
+		function _next;
+		std::shared_ptr<const void> _running;
+	public:
+		using value_type = T;
+		
+		stream(std::shared_ptr<runtimeContext> ctx, function next, std::shared_ptr<const void> running = nullptr):
+			_ctx(std::move(ctx)),
+			_next(std::move(next)),
+			_running(std::move(running))
+		{
+		}
+		
+		std::optional<T> next() {
+			variablePtr v = _ctx->call(_next, {});
+			if (!v) {
+				return std::nullopt;
+			}
+			return details::moveFromVariable<T>(v);
+		}
+	};
+	
+	template<typename R>
+	class promise;
+	
+	//Result of an asynchronous call, available once the promise it comes from is
+	//completed.
+	template<typename R>
+	class future {
+	private:
+		std::shared_ptr<details::asyncState> _state;
+	public:
+		explicit future(std::shared_ptr<details::asyncState> state):
+			_state(std::move(state))
+		{
+		}
+		
+		bool ready() const {
+			return _state->done();
+		}
+		
+		//Waits for the result, or rethrows the error it was completed with.
+		R get() const {
+			variablePtr v = _state->wait();
+			if constexpr(!std::is_same<R, void>::value) {
+				return details::moveFromVariable<R>(v);
+			}
+		}
+		
+		const std::shared_ptr<details::asyncState>& state() const {
+			return _state;
+		}
+	};
+	
+	//Completes a future once, from any thread.
+	template<typename R>
+	class promise {
+	private:
+		std::shared_ptr<details::asyncState> _state;
+	public:
+		promise():
+			_state(std::make_shared<details::asyncState>())
+		{
+		}
+		
+		future<R> get_future() const {
+			return future<R>(_state);
+		}
+		
+		template<typename... V>
+		void set_value(V&&... value) const {
+			if constexpr(std::is_same<R, void>::value) {
+				static_assert(sizeof...(V) == 0);
+				_state->complete(nullptr, nullptr);
+			} else {
+				_state->complete(details::retvalToVariable<R>(R(std::forward<V>(value)...)), nullptr);
+			}
+		}
+		
+		void set_exception(std::exception_ptr error) const {
+			_state->complete(nullptr, std::move(error));
+		}
+	};
+	
+	namespace details {
+		template<typename R, typename... Args>
+		function createAsyncExternalFunction(std::function<future<R>(Args...)> f) {
+			return [f=std::move(f)](runtimeContext& ctx) {
+				future<R> result = unpacker<future<R>, std::tuple<>, std::tuple<Args...> >()(ctx, f, std::tuple<>());
+				variablePtr retval = await(result.state());
+				if constexpr(!std::is_same<R, void>::value) {
+					ctx.retval() = std::move(retval);
+				}
+			};
+		}
+	}
+	
+	struct nativeModule;
+	
 	class module_impl;
 	
 	class module {
 	private:
 		std::unique_ptr<module_impl> _impl;
+		
+		//Public function of the loaded program and the context it runs in, which
+		//stay valid while they are held, even once another program is loaded.
+		struct loadedFunction {
+			std::shared_ptr<runtimeContext> context;
+			const function* f;
+		};
+		
+		friend class module_impl;
+		
+		//Counts a call of a public function caller, an execution it started or a
+		//stream it returned while it runs. Cycles are only collected automatically
+		//when none is running.
+		class runningCall {
+			runningCall(const runningCall&) = delete;
+			void operator=(const runningCall&) = delete;
+		private:
+			module_impl& _impl;
+		public:
+			explicit runningCall(module& m);
+			~runningCall();
+		};
+		
 		void addExternalFunctionImpl(std::string declaration, function f);
-		void addPublicFunctionDeclaration(std::string declaration, std::string name, std::shared_ptr<function> fptr);
-		runtimeContext* getRuntimeContext();
+		size_t addPublicFunctionDeclaration(std::string declaration, std::string name);
+		loadedFunction getPublicFunction(size_t idx);
+		void spawnExecution(const runtimeContext& ctx, std::function<void(runtimeContext&)> body);
 	public:
 		module();
 		
@@ -173,30 +401,152 @@ namespace cobalt {
 			);
 		}
 		
+		void addRawExternalFunction(std::string declaration, function f);
+		
+		//Adds an external function that completes later. A script execution started by
+		//an asynchronous public function caller is suspended while it waits for the
+		//future, and the others run; any other caller blocks until it is ready.
+		template<typename R, typename... Args>
+		void addAsyncExternalFunctions(const char* name, std::function<future<R>(Args...)> f) {
+			addExternalFunctionImpl(
+				details::createFunctionDeclaration<R, Args...>(name),
+				details::createAsyncExternalFunction(std::move(f))
+			);
+		}
+		
+		//Returns a caller of the public function. Each call runs the program loaded
+		//when it starts.
 		template<typename R, typename... Args>
 		auto createPublicFunctionCaller(std::string name) {
-			std::shared_ptr<function> fptr = std::make_shared<function>();
 			std::string decl = details::createFunctionDeclaration<R, Args...>(name.c_str());
-			addPublicFunctionDeclaration(std::move(decl), std::move(name), fptr);
+			size_t idx = addPublicFunctionDeclaration(std::move(decl), std::move(name));
 			
-			return [this, fptr](Args... args){
+			return [this, idx](Args... args){
+				runningCall running(*this);
+				loadedFunction lf = getPublicFunction(idx);
+				
 				if constexpr(std::is_same<R, void>::value) {
-					getRuntimeContext()->call(
-						*fptr,
+					lf.context->call(
+						*lf.f,
 						{details::to_variable(std::move(args))...}
 					);
+				} else if constexpr(details::is_stream<R>::value) {
+					variablePtr next = lf.context->call(*lf.f, {details::to_variable(std::move(args))...});
+					return R(
+						std::move(lf.context),
+						next->staticPointerDowncast<lfunction>()->value,
+						std::make_shared<runningCall>(*this)
+					);
 				} else {
-					return details::moveFromVariable<R>(getRuntimeContext()->call(
-						*fptr,
+					return details::moveFromVariable<R>(lf.context->call(
+						*lf.f,
 						{details::to_variable(args)...}
 					));
 				}
 			};
 		}
 		
+		//Returns a caller that starts an execution of the public function and returns
+		//its future. The execution only runs within runAsync.
+		template<typename R, typename... Args>
+		auto createAsyncPublicFunctionCaller(std::string name) {
+			std::string decl = details::createFunctionDeclaration<R, Args...>(name.c_str());
+			size_t idx = addPublicFunctionDeclaration(std::move(decl), std::move(name));
+			
+			return [this, idx](Args... args){
+				loadedFunction lf = getPublicFunction(idx);
+				promise<R> p;
+				std::vector<variablePtr> params{details::to_variable(std::move(args))...};
+				spawnExecution(*lf.context, [p, f=*lf.f, params=std::move(params)](runtimeContext& ctx) mutable {
+					try {
+						variablePtr retval = ctx.call(f, std::move(params));
+						p.get_future().state()->complete(std::move(retval), nullptr);
+					} catch (...) {
+						p.set_exception(std::current_exception());
+					}
+				});
+				return p.get_future();
+			};
+		}
+		
+		//Channel of number or string values that scripts of the process reach by name
+		//with send, recv and try_recv, or their _str variants. It is created with
+		//capacity unless it exists.
+		template<typename T>
+		static std::shared_ptr<channel<T> > getChannel(const std::string& name, size_t capacity = default_channel_capacity) {
+			static_assert(std::is_same<T, number>::value || std::is_same<T, string>::value, "Channels carry numbers or strings");
+			return channel<T>::named(name, capacity);
+		}
+		
+		//Runs the executions started by asynchronous public function callers until all
+		//of them have finished, switching between them while they wait for external
+		//functions. The futures they wait for may be completed on other threads.
+		void runAsync();
+		
+		//Functions whose body has at most budget tokens are substituted at their
+		//call sites when loading. Zero disables inlining.
+		void setInlineBudget(size_t budget);
+		
+		//Functions are compiled again once their calls and loop iterations reach
+		//threshold, inlining larger functions and reading the globals that nothing
+		//writes as constants. Zero disables it.
+		void setHotThreshold(size_t threshold);
+		
+		//Scripts of the module fail with a runtime error when the variables and
+		//strings they hold would take more than bytes. It applies to all programs
+		//the module loads, and to values that calls create from then on. Zero
+		//removes the limit.
+		void setMemoryLimit(size_t bytes);
+		
+		//Bytes held by the variables and strings that scripts of the module created,
+		//now and at most since the module was created.
+		size_t memoryUsage() const;
+		size_t peakMemoryUsage() const;
+		
+		//Frees the values of scripts that only keep each other alive, such as a
+		//generator stored in a global variable that its body reads. It must not run
+		//while functions of the module run.
+		void collectCycles();
+		
+		//Public function callers collect cycles when they finish, if no other call,
+		//asynchronous execution or returned stream is running, and threshold
+		//generators were created since the last collection. Zero disables it.
+		void setCycleCollectionThreshold(size_t threshold);
+		
+		//Number and pauses of the collections so far.
+		collectionStats cycleCollectionStats() const;
+		
+		//Compiles the script in path, or reuses the program compiled for a module
+		//of the process that loaded the same source with the same declarations and
+		//settings. Modules may load on several threads at once. Globals of numbers,
+		//strings and containers of them that the previous program of the module
+		//declared with the same name and type keep their values, shared with the
+		//previous program, and their initializers do not run; the others are
+		//initialized. resetGlobals initializes all.
 		void load(const char* path);
 		bool tryLoad(const char* path, std::ostream* err = nullptr) noexcept;
 		
+		//Loads the script in path on a thread of its own, while the loaded program
+		//keeps running, then replaces it. Calls that are running finish with the
+		//previous program, and callers start the next ones with the new program.
+		//If loading fails, the previous program stays and the future rethrows the
+		//error. The module must outlive the future.
+		std::future<void> reload(std::string path);
+		
+		//Writes C++ source that implements the script functions of the script in path,
+		//calling the external functions added so far. It is built against the runtime
+		//into code that provides a nativeModule.
+		void transpile(const char* path, std::ostream& out);
+		
+		//Makes load run the functions of native code generated by transpile instead
+		//of interpreting them, as long as the script declares the same functions and
+		//globals as when it was transpiled.
+		void addNativeModule(const nativeModule& native);
+		
+		//Adds the cobalt_native_module of a shared library built from the output of
+		//transpile. The library stays loaded while the module lives.
+		void loadNativeLibrary(const char* path);
+		
 		void resetGlobals();
 		
 		~module();
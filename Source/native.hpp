@@ -0,0 +1,253 @@
+#ifndef native_hpp
+#define native_hpp
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <limits>
+#include "variable.hpp"
+#include "runtimeContext.hpp"
+#include "errors.hpp"
+
+#ifdef _WIN32
+#define COBALT_NATIVE_EXPORT __declspec(dllexport)
+#else
+#define COBALT_NATIVE_EXPORT __attribute__((visibility("default")))
+#endif
+
+namespace cobalt {
+	struct nativeFunction {
+		const char* name;
+		void (*f)(runtimeContext&);
+	};
+	
+	//Entry point of the code that module::transpile generates. The functions, up
+	//to the one with a null name, are only used for a module of the same layout.
+	struct nativeModule {
+		const char* layout;
+		const nativeFunction* functions;
+	};
+	
+	//Operations that generated code uses on the runtime values. They behave as the
+	//corresponding expressions of the interpreter.
+	namespace native {
+		template<typename T>
+		T& value(const variablePtr& v) {
+			return static_cast<variableImpl<T>*>(v.get())->value;
+		}
+		
+		template<typename T>
+		std::shared_ptr<variableImpl<T> > box(T value) {
+			return std::make_shared<variableImpl<T> >(std::move(value));
+		}
+		
+		template<typename T>
+		std::shared_ptr<variableImpl<T> > ref(const variablePtr& v) {
+			return std::static_pointer_cast<variableImpl<T> >(v);
+		}
+		
+		//Takes the value out of a variable that nothing else refers to, like a
+		//parameter passed by value or a returned value.
+		template<typename T>
+		T unbox(const variablePtr& v) {
+			return std::move(value<T>(v));
+		}
+		
+		template<typename T>
+		T defaultValue() {
+			if constexpr(std::is_same<T, string>::value) {
+				return accountedString(std::string());
+			} else {
+				return T{};
+			}
+		}
+		
+		template<typename T>
+		variablePtr& element(array& arr, number n) {
+			int idx = int(n);
+			
+			runtimeAssertion(idx >= 0, "Negative index is invalid");
+			
+			while (size_t(idx) >= arr.size()) {
+				arr.push_back(box(defaultValue<T>()));
+			}
+			
+			return arr[idx];
+		}
+		
+		template<typename T>
+		variablePtr element(array&& arr, number n) {
+			return element<T>(arr, n);
+		}
+		
+		template<typename T>
+		variablePtr& entry(dictionary& d, number k) {
+			return d.findOrInsert(k, [](){
+				return variablePtr(box(defaultValue<T>()));
+			});
+		}
+		
+		template<typename T>
+		variablePtr& entry(dictionary& d, const string& k) {
+			return d.findOrInsert(std::string_view(*k), [](){
+				return variablePtr(box(defaultValue<T>()));
+			});
+		}
+		
+		template<typename T, typename K>
+		variablePtr entry(dictionary&& d, const K& k) {
+			return entry<T>(d, k);
+		}
+		
+		inline number contains(number k, const dictionary& d) {
+			return d.contains(k);
+		}
+		
+		inline number contains(const string& k, const dictionary& d) {
+			return d.contains(std::string_view(*k));
+		}
+		
+		inline array keys(const dictionary& d) {
+			array ret;
+			for (const dictionary::entry& e : d.entries()) {
+				if (const number* n = std::get_if<number>(&e.k)) {
+					ret.push_back(box(*n));
+				} else {
+					ret.push_back(box(accountedString(std::get<std::string>(e.k))));
+				}
+			}
+			return ret;
+		}
+		
+		inline string append(string s1, const string& s2) {
+			if (s1.use_count() == 1) {
+				s1->append(*s2);
+				chargeStringGrowth(s1);
+				return s1;
+			}
+			
+			std::string ret;
+			ret.reserve(s1->size() + s2->size());
+			ret.append(*s1);
+			ret.append(*s2);
+			return accountedString(std::move(ret));
+		}
+		
+		inline string& append_assign(string& s1, const string& s2) {
+			s1 = append(std::move(s1), s2);
+			return s1;
+		}
+		
+		inline bool less(number n1, number n2) {
+			return n1 < n2;
+		}
+		
+		inline bool less(const string& s1, const string& s2) {
+			return *s1 < *s2;
+		}
+		
+		template<typename T>
+		number eq(const T& t1, const T& t2) {
+			return !less(t1, t2) && !less(t2, t1);
+		}
+		
+		template<typename T>
+		number ne(const T& t1, const T& t2) {
+			return less(t1, t2) || less(t2, t1);
+		}
+		
+		template<typename T>
+		number lt(const T& t1, const T& t2) {
+			return less(t1, t2);
+		}
+		
+		template<typename T>
+		number gt(const T& t1, const T& t2) {
+			return less(t2, t1);
+		}
+		
+		template<typename T>
+		number le(const T& t1, const T& t2) {
+			return !less(t2, t1);
+		}
+		
+		template<typename T>
+		number ge(const T& t1, const T& t2) {
+			return !less(t1, t2);
+		}
+		
+		inline number add(number t1, number t2) {
+			return t1 + t2;
+		}
+		
+		inline number sub(number t1, number t2) {
+			return t1 - t2;
+		}
+		
+		inline number mul(number t1, number t2) {
+			return t1 * t2;
+		}
+		
+		inline number div(number t1, number t2) {
+			return t1 / t2;
+		}
+		
+		inline number idiv(number t1, number t2) {
+			return int(t1 / t2);
+		}
+		
+		inline number mod(number t1, number t2) {
+			return t1 - t2 * int(t1 / t2);
+		}
+		
+		inline number band(number t1, number t2) {
+			return int(t1) & int(t2);
+		}
+		
+		inline number bor(number t1, number t2) {
+			return int(t1) | int(t2);
+		}
+		
+		inline number bxor(number t1, number t2) {
+			return int(t1) ^ int(t2);
+		}
+		
+		inline number bsl(number t1, number t2) {
+			return int(t1) << int(t2);
+		}
+		
+		inline number bsr(number t1, number t2) {
+			return int(t1) >> int(t2);
+		}
+		
+		inline number& idiv_assign(number& t1, number t2) {
+			return t1 = idiv(t1, t2);
+		}
+		
+		inline number& mod_assign(number& t1, number t2) {
+			return t1 = mod(t1, t2);
+		}
+		
+		inline number& band_assign(number& t1, number t2) {
+			return t1 = band(t1, t2);
+		}
+		
+		inline number& bor_assign(number& t1, number t2) {
+			return t1 = bor(t1, t2);
+		}
+		
+		inline number& bxor_assign(number& t1, number t2) {
+			return t1 = bxor(t1, t2);
+		}
+		
+		inline number& bsl_assign(number& t1, number t2) {
+			return t1 = bsl(t1, t2);
+		}
+		
+		inline number& bsr_assign(number& t1, number t2) {
+			return t1 = bsr(t1, t2);
+		}
+	}
+}
+
+#endif /* native_hpp */
@@ -0,0 +1,84 @@
+#include "programCache.hpp"
+#include "helpers.hpp"
+
+namespace cobalt {
+	namespace {
+		uint64_t hashSource(const std::string& source) {
+			return fnv1a(fnv_offset_basis, source.data(), source.size());
+		}
+	}
+	
+	programCache& programCache::shared() {
+		static programCache cache;
+		return cache;
+	}
+	
+	std::shared_ptr<const program> programCache::get(
+		const std::string& source,
+		std::string declarations,
+		const std::function<std::shared_ptr<const program>()>& compile
+	) {
+		key k{hashSource(source), std::move(declarations)};
+		std::promise<std::shared_ptr<const program> > compiled;
+		
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			
+			//entries of programs no module uses would keep their sources
+			for (auto e = _entries.begin(); e != _entries.end();) {
+				if (e->second.compiled.expired() && !e->second.pending.valid()) {
+					e = _entries.erase(e);
+				} else {
+					++e;
+				}
+			}
+			
+			auto it = _entries.find(k);
+			
+			if (it != _entries.end()) {
+				//sources with the same hash are compiled without the cache
+				if (it->second.source != source) {
+					lock.unlock();
+					return compile();
+				}
+				
+				if (std::shared_ptr<const program> ret = it->second.compiled.lock()) {
+					return ret;
+				}
+				
+				if (it->second.pending.valid()) {
+					std::shared_future<std::shared_ptr<const program> > pending = it->second.pending;
+					lock.unlock();
+					return pending.get();
+				}
+			} else {
+				it = _entries.emplace(k, entry{source, {}, {}}).first;
+			}
+			
+			it->second.pending = compiled.get_future().share();
+		}
+		
+		std::shared_ptr<const program> ret;
+		
+		try {
+			ret = compile();
+		} catch (...) {
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				_entries.erase(k);
+			}
+			compiled.set_exception(std::current_exception());
+			throw;
+		}
+		
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			entry& e = _entries.at(k);
+			e.compiled = ret;
+			e.pending = {};
+		}
+		compiled.set_value(ret);
+		
+		return ret;
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef programCache_hpp
+#define programCache_hpp
+
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "compiler.hpp"
+
+namespace cobalt {
+	//Programs compiled by the modules of the process, by the hash of their source
+	//and the declarations they were compiled with. Modules loading the same script
+	//at once wait for a single compilation. A program is dropped once no module
+	//uses it, and its source with it on the next call to get.
+	class programCache {
+		programCache(const programCache&) = delete;
+		void operator=(const programCache&) = delete;
+	private:
+		struct key {
+			uint64_t hash;
+			std::string declarations;
+			
+			bool operator==(const key& other) const {
+				return hash == other.hash && declarations == other.declarations;
+			}
+		};
+		
+		struct keyHash {
+			size_t operator()(const key& k) const {
+				return size_t(k.hash) ^ std::hash<std::string>()(k.declarations);
+			}
+		};
+		
+		struct entry {
+			std::string source;
+			std::weak_ptr<const program> compiled;
+			std::shared_future<std::shared_ptr<const program> > pending;
+		};
+		
+		std::mutex _mutex;
+		std::unordered_map<key, entry, keyHash> _entries;
+	public:
+		programCache() = default;
+		
+		static programCache& shared();
+		
+		//Returns the program compiled from source with declarations, which must
+		//list everything besides the source that compile depends on. If it is
+		//not cached, compile is called once, or its error is rethrown to every
+		//loader waiting for it.
+		std::shared_ptr<const program> get(
+			const std::string& source,
+			std::string declarations,
+			const std::function<std::shared_ptr<const program>()>& compile
+		);
+	};
+}
+
+#endif /* programCache_hpp */
@@ -1,26 +1,68 @@
 #include "runtimeContext.hpp"
 #include "errors.hpp"
+#include "fiber.hpp"
+#include <algorithm>
 
 namespace cobalt {
 	runtimeContext::runtimeContext(
-		std::vector<expression<lvalue>::ptr> initializers,
+		std::shared_ptr<const std::vector<expression<lvalue>::ptr> > initializers,
 		std::vector<function> functions,
-		std::unordered_map<std::string, size_t> public_functions
+		std::unordered_map<std::string, size_t> public_functions,
+		std::shared_ptr<optimizer> opt,
+		size_t hotThreshold,
+		memoryAccountPtr account,
+		const std::vector<variablePtr>& kept
 	) :
 		_functions(std::move(functions)),
 		_public_functions(std::move(public_functions)),
 		_initializers(std::move(initializers)),
-		_retval_idx(0)
+		_retval_idx(0),
+		_flow(flow::normalFlow()),
+		_tail_call(false),
+		_optimizer(std::move(opt)),
+		_heat(_functions.size(), 0),
+		_hot_threshold(hotThreshold),
+		_account(std::move(account))
 	{
-		_globals.reserve(_initializers.size());
-		initialize();
+		if (_optimizer) {
+			_optimizer->attach();
+		}
+		
+		_globals.reserve(_initializers ? _initializers->size() : 0);
+		try {
+			initialize(kept);
+		} catch (...) {
+			if (_optimizer) {
+				_optimizer->detach();
+			}
+			throw;
+		}
 	}
 	
-	void runtimeContext::initialize() {
+	runtimeContext::~runtimeContext() {
+		if (_optimizer) {
+			_optimizer->detach();
+		}
+	}
+	
+	void runtimeContext::initialize(const std::vector<variablePtr>& kept) {
+		memoryAccount::activeScope scope(_account.get());
+		
 		_globals.clear();
 		
-		for (const auto& initializer : _initializers) {
-			_globals.emplace_back(initializer->evaluate(*this));
+		if (_optimizer) {
+			_optimizer->reset();
+			std::fill(_heat.begin(), _heat.end(), 0);
+		}
+		
+		if (_initializers) {
+			for (size_t i = 0; i < _initializers->size(); ++i) {
+				if (i < kept.size() && kept[i]) {
+					_globals.push_back(kept[i]);
+				} else {
+					_globals.emplace_back((*_initializers)[i]->evaluate(*this));
+				}
+			}
 		}
 	}
 	
@@ -28,7 +70,45 @@ namespace cobalt {
 		runtimeAssertion(idx < _globals.size(), "Uninitialized global variable access");
 		return _globals[idx];
 	}
+	
+	size_t runtimeContext::globalsCount() const {
+		return _globals.size();
+	}
+	
+	std::unique_ptr<runtimeContext> runtimeContext::createWorker() const {
+		std::unique_ptr<runtimeContext> ret = std::make_unique<runtimeContext>(
+			nullptr,
+			_functions,
+			std::unordered_map<std::string, size_t>(),
+			nullptr,
+			0,
+			_account ? _account->acquire() : nullptr
+		);
+		ret->_globals = _globals;
+		ret->_global_writers = _global_writers;
+		return ret;
+	}
+	
+	void runtimeContext::setGlobalWriters(std::vector<bool> writers) {
+		_global_writers = std::move(writers);
+	}
+	
+	bool runtimeContext::writesGlobals(size_t functionIndex) const {
+		return functionIndex >= _global_writers.size() || _global_writers[functionIndex];
+	}
 
+	void runtimeContext::trace(const std::function<void(const variablePtr&)>& visit) const {
+		for (const variablePtr& v : _globals) {
+			visit(v);
+		}
+		for (const variablePtr& v : _stack) {
+			visit(v);
+		}
+		for (const variablePtr& v : _tail_params) {
+			visit(v);
+		}
+	}
+	
 	variablePtr& runtimeContext::retval() {
 		return _stack[_retval_idx];
 	}
@@ -45,43 +125,63 @@ namespace cobalt {
 		return _functions[_public_functions.find(name)->second];
 	}
 	
-	runtimeContext::scope runtimeContext::enterScope() {
-		return scope(*this);
-	}
-	
-	void runtimeContext::push(variablePtr v) {
-		_stack.push_back(std::move(v));
+	void runtimeContext::reserveFrame(size_t size) {
+		_stack.resize(_retval_idx + size);
 	}
 
 	variablePtr runtimeContext::call(const function& f, std::vector<variablePtr> params) {
-		for (size_t i = params.size(); i > 0; --i) {
-			_stack.push_back(std::move(params[i-1]));
+		if (fiber::nearStackLimit()) {
+			throw runtimeError("Stack overflow");
 		}
-		size_t old_retval_idx = _retval_idx;
-		
-		_retval_idx = _stack.size();
-		_stack.resize(_retval_idx + 1);
-		
-		runtimeAssertion(bool(f), "Uninitialized function call");
 		
-		f(*this);
+		memoryAccount::activeScope scope(_account.get());
+		function tail;
+		const function* current = &f;
+		size_t base = _stack.size();
+		size_t base_retval_idx = _retval_idx;
 		
-		variablePtr ret = std::move(_stack[_retval_idx]);
-		
-		_stack.resize(_retval_idx - params.size());
-		
-		_retval_idx = old_retval_idx;
-		
-		return ret;
-	}
-	
-	runtimeContext::scope::scope(runtimeContext& context):
-		_context(context),
-		_stack_size(context._stack.size())
-	{
+		for (;;) {
+			for (size_t i = params.size(); i > 0; --i) {
+				_stack.push_back(std::move(params[i-1]));
+			}
+			size_t old_retval_idx = _retval_idx;
+			
+			_retval_idx = _stack.size();
+			_stack.resize(_retval_idx + 1);
+			
+			runtimeAssertion(bool(*current), "Uninitialized function call");
+			
+			try {
+				(*current)(*this);
+			} catch (...) {
+				//Frees the frames of the calls that the error leaves, so that what they
+				//hold is released before the caller handles it.
+				_stack.resize(base);
+				_retval_idx = base_retval_idx;
+				_tail_call = false;
+				throw;
+			}
+			
+			variablePtr ret = std::move(_stack[_retval_idx]);
+			
+			_stack.resize(_retval_idx - params.size());
+			
+			_retval_idx = old_retval_idx;
+			
+			if (!_tail_call) {
+				return ret;
+			}
+			
+			_tail_call = false;
+			tail = std::move(_tail_function);
+			current = &tail;
+			params = std::move(_tail_params);
+		}
 	}
 	
-	runtimeContext::scope::~scope() {
-		_context._stack.resize(_stack_size);
+	void runtimeContext::tailCall(function f, std::vector<variablePtr> params) {
+		_tail_function = std::move(f);
+		_tail_params = std::move(params);
+		_tail_call = true;
 	}
 }
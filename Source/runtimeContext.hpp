@@ -3,52 +3,188 @@
 #include <variant>
 #include <vector>
 #include <deque>
+#include <memory>
 #include <stack>
 #include <string>
 #include <unordered_map>
 #include "variable.hpp"
 #include "lookup.hpp"
 #include "expression.hpp"
+#include "memoryAccount.hpp"
 
 namespace cobalt {
+	enum struct flow_type{
+		f_normal,
+		f_break,
+		f_continue,
+		f_return,
+	};
+	
+	class flow {
+	private:
+		flow_type _type;
+		int _break_level;
+		flow(flow_type type, int breakLevel);
+	public:
+		flow_type type() const;
+		int breakLevel() const;
+		
+		static flow normalFlow();
+		static flow breakFlow(int breakLevel);
+		static flow continueFlow();
+		static flow returnFlow();
+		flow consumeBreak();
+	};
+	
+	inline flow::flow(flow_type type, int breakLevel):
+		_type(type),
+		_break_level(breakLevel)
+	{
+	}
+	
+	inline flow_type flow::type() const {
+		return _type;
+	}
+	
+	inline int flow::breakLevel() const {
+		return _break_level;
+	}
+	
+	inline flow flow::normalFlow() {
+		return flow(flow_type::f_normal, 0);
+	}
+	
+	inline flow flow::breakFlow(int breakLevel) {
+		return flow(flow_type::f_break, breakLevel);
+	}
+	
+	inline flow flow::continueFlow() {
+		return flow(flow_type::f_continue, 0);
+	}
+	
+	inline flow flow::returnFlow() {
+		return flow(flow_type::f_return, 0);
+	}
+	
+	inline flow flow::consumeBreak() {
+		return _break_level == 1 ? flow::normalFlow() : flow::breakFlow(_break_level-1);
+	}
+	
+	class runtimeContext;
+	
+	//Recompiles the functions that the runtime profile finds hot.
+	class optimizer {
+	public:
+		//Replaces the body of the function with one optimized for the state of ctx.
+		//Calls that already run it finish with the previous body.
+		virtual void optimize(runtimeContext& ctx, size_t functionIndex) = 0;
+		
+		//Returns all functions to the bodies they were first compiled with.
+		virtual void reset() = 0;
+		
+		//Called by each context created to run the functions, and again when it is
+		//destroyed. While several contexts share them, bodies no longer depend on
+		//the state of one of them.
+		virtual void attach() = 0;
+		virtual void detach() = 0;
+		
+		virtual ~optimizer() = default;
+	};
+	
 	class runtimeContext {
+		runtimeContext(const runtimeContext&) = delete;
+		void operator=(const runtimeContext&) = delete;
 	private:
 		std::vector<function> _functions;
 		std::unordered_map<std::string, size_t> _public_functions;
-		std::vector<expression<lvalue>::ptr> _initializers;
+		std::shared_ptr<const std::vector<expression<lvalue>::ptr> > _initializers;
 		std::vector<variablePtr> _globals;
 		std::deque<variablePtr> _stack;
 		size_t _retval_idx;
-		
-		class scope {
-		private:
-			runtimeContext& _context;
-			size_t _stack_size;
-		public:
-			scope(runtimeContext& context);
-			~scope();
-		};
-		
+		flow _flow;
+		function _tail_function;
+		std::vector<variablePtr> _tail_params;
+		bool _tail_call;
+		std::shared_ptr<optimizer> _optimizer;
+		std::vector<size_t> _heat;
+		size_t _hot_threshold;
+		std::vector<bool> _global_writers;
+		memoryAccountPtr _account;
 	public:
+		//Variables and strings that the functions create are charged to the account,
+		//if one is given. Globals that kept holds a variable for are initialized
+		//with it, as in initialize.
 		runtimeContext(
-			std::vector<expression<lvalue>::ptr> initializers,
+			std::shared_ptr<const std::vector<expression<lvalue>::ptr> > initializers,
 			std::vector<function> functions,
-			std::unordered_map<std::string, size_t> public_functions
+			std::unordered_map<std::string, size_t> public_functions,
+			std::shared_ptr<optimizer> opt = nullptr,
+			size_t hotThreshold = 0,
+			memoryAccountPtr account = nullptr,
+			const std::vector<variablePtr>& kept = {}
 		);
+		
+		runtimeContext(runtimeContext&&) = default;
+		
+		~runtimeContext();
 	
-		void initialize();
+		//Initializes the globals again, and returns the functions optimized for the
+		//previous values to their first bodies. A global that kept holds a variable
+		//for at its index takes that variable, and its initializer does not run.
+		void initialize(const std::vector<variablePtr>& kept = {});
 
 		variablePtr& global(int idx);
+		
+		//Number of globals initialized so far.
+		size_t globalsCount() const;
+		
+		//Context for running the functions alongside this one, on another thread or
+		//in a suspended execution. It shares the globals and the memory account, but
+		//has its own stack and does not optimize.
+		std::unique_ptr<runtimeContext> createWorker() const;
+		
+		//Marks the functions that may write global variables, by index. They are
+		//not run on workers.
+		void setGlobalWriters(std::vector<bool> writers);
+		
+		bool writesGlobals(size_t functionIndex) const;
+		
+		//Calls visit for each reference to a variable that the globals and the stack
+		//hold.
+		void trace(const std::function<void(const variablePtr&)>& visit) const;
+		
 		variablePtr& retval();
 		variablePtr& local(int idx);
 
 		const function& get_function(int idx) const;
 		const function& get_public_function(const char* name) const;
 
-		scope enterScope();
-		void push(variablePtr v);
+		//Control transfer left pending by the last executed statement.
+		const flow& pendingFlow() const {
+			return _flow;
+		}
+		
+		void setFlow(flow f) {
+			_flow = f;
+		}
+		
+		//Allocates the fixed slots of the current function's frame, retval included.
+		//They are released together with the parameters when the call returns.
+		void reserveFrame(size_t size);
 		
 		variablePtr call(const function& f, std::vector<variablePtr> params);
+		
+		//Schedules f to be called with params once the current function returns.
+		//call runs it in place of the returning frame, without nesting.
+		void tailCall(function f, std::vector<variablePtr> params);
+		
+		//Counts a call or a loop iteration of a function. Once the function has run
+		//hotThreshold of them, the optimizer recompiles it.
+		void profile(size_t functionIndex) {
+			if (++_heat[functionIndex] == _hot_threshold) {
+				_optimizer->optimize(*this, functionIndex);
+			}
+		}
 	};
 }
 
@@ -1,13 +1,367 @@
 #include "standardFunctions.hpp"
 #include "module.hpp"
+#include "errors.hpp"
+#include "vectorKernels.hpp"
+#include "closure.hpp"
+#include "threadPool.hpp"
+#include "channel.hpp"
 
 #include <iostream>
 #include <string>
 #include <cmath>
 #include <cstdlib>
 #include <ctime>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <unordered_map>
 
 namespace cobalt {
+	namespace {
+		template <typename T>
+		T& argument(runtimeContext& ctx, int idx) {
+			return static_cast<variableImpl<T>*>(ctx.local(-1 - idx).get())->value;
+		}
+		
+		template <typename T>
+		void setReturnValue(runtimeContext& ctx, T value) {
+			ctx.retval() = std::make_shared<variableImpl<T> >(std::move(value));
+		}
+		
+		bool nativeLess(number x, number y) {
+			//NaN is ordered after every other number, so the ordering stays strict weak
+			return x < y || (y != y && x == x);
+		}
+		
+		bool nativeLess(const string& x, const string& y) {
+			if (!y) {
+				return false;
+			}
+			return x ? *x < *y : !y->empty();
+		}
+		
+		template <typename T>
+		class scriptComparator {
+		private:
+			runtimeContext& _ctx;
+			const function& _f;
+		public:
+			scriptComparator(runtimeContext& ctx, const function& f) :
+				_ctx(ctx),
+				_f(f)
+			{
+			}
+			
+			bool operator()(const T& x, const T& y) const {
+				variablePtr ret = _ctx.call(_f, {
+					std::make_shared<variableImpl<T> >(x),
+					std::make_shared<variableImpl<T> >(y)
+				});
+				return static_cast<variableImpl<number>*>(ret.get())->value != 0;
+			}
+		};
+		
+		template <typename T>
+		class scriptPredicate {
+		private:
+			runtimeContext& _ctx;
+			const function& _f;
+		public:
+			scriptPredicate(runtimeContext& ctx, const function& f) :
+				_ctx(ctx),
+				_f(f)
+			{
+			}
+			
+			bool operator()(const T& x) const {
+				variablePtr ret = _ctx.call(_f, {std::make_shared<variableImpl<T> >(x)});
+				return static_cast<variableImpl<number>*>(ret.get())->value != 0;
+			}
+		};
+		
+		template <typename T>
+		const T& elementValue(const variablePtr& v) {
+			return static_cast<const variableImpl<T>*>(v.get())->value;
+		}
+		
+		template <typename T>
+		std::vector<T> arrayValues(const array& arr) {
+			std::vector<T> ret;
+			ret.reserve(arr.size());
+			for (const variablePtr& v : arr) {
+				ret.push_back(elementValue<T>(v));
+			}
+			return ret;
+		}
+		
+		template <typename T>
+		void assignArrayValues(array& arr, std::vector<T> values) {
+			//a script callback may have reassigned the array while its copy was sorted
+			for (size_t i = 0; i < values.size() && i < arr.size(); ++i) {
+				static_cast<variableImpl<T>*>(arr[i].get())->value = std::move(values[i]);
+			}
+		}
+		
+		//Bottom-up merge sort. It needs fewer comparisons than introsort, which matters
+		//when each one is a script call, and it never reads out of range even if the
+		//script comparator is not a strict weak ordering.
+		template <typename T, typename Compare>
+		void mergeSort(std::vector<T>& values, Compare comp) {
+			std::vector<T> buffer(values.size());
+			
+			for (size_t width = 1; width < values.size(); width *= 2) {
+				for (size_t lo = 0; lo < values.size(); lo += 2 * width) {
+					size_t mid = std::min(lo + width, values.size());
+					size_t hi = std::min(lo + 2 * width, values.size());
+					std::merge(
+						std::make_move_iterator(values.begin() + lo),
+						std::make_move_iterator(values.begin() + mid),
+						std::make_move_iterator(values.begin() + mid),
+						std::make_move_iterator(values.begin() + hi),
+						buffer.begin() + lo,
+						comp
+					);
+				}
+				values.swap(buffer);
+			}
+		}
+		
+		//Binary searches index the array instead of holding iterators, so a script
+		//comparator that grows or reassigns the array cannot invalidate them.
+		template <typename T, typename Less>
+		size_t lowerBound(const array& arr, const T& value, Less less) {
+			size_t lo = 0;
+			size_t hi = arr.size();
+			while (lo < hi) {
+				size_t mid = lo + (hi - lo) / 2;
+				runtimeAssertion(mid < arr.size(), "Array modified during search");
+				if (less(elementValue<T>(arr[mid]), value)) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			return lo;
+		}
+		
+		template <typename T, typename Less>
+		size_t upperBound(const array& arr, const T& value, Less less) {
+			size_t lo = 0;
+			size_t hi = arr.size();
+			while (lo < hi) {
+				size_t mid = lo + (hi - lo) / 2;
+				runtimeAssertion(mid < arr.size(), "Array modified during search");
+				if (less(value, elementValue<T>(arr[mid]))) {
+					hi = mid;
+				} else {
+					lo = mid + 1;
+				}
+			}
+			return lo;
+		}
+		
+		template <typename T>
+		void addArrayFunctionsOfType(module& m, const std::string& suffix, const std::string& elementType) {
+			const std::string arrayParam = "(" + elementType + "[]&";
+			const std::string comparatorParam = "number(" + elementType + ", " + elementType + ")";
+			const std::string predicateParam = "number(" + elementType + ")";
+			
+			m.addRawExternalFunction(
+				"function void sort" + suffix + arrayParam + ")",
+				[](runtimeContext& ctx) {
+					array& arr = argument<array>(ctx, 0);
+					std::vector<T> values = arrayValues<T>(arr);
+					std::sort(values.begin(), values.end(), [](const T& x, const T& y) {
+						return nativeLess(x, y);
+					});
+					assignArrayValues(arr, std::move(values));
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function void stable_sort" + suffix + arrayParam + ")",
+				[](runtimeContext& ctx) {
+					array& arr = argument<array>(ctx, 0);
+					std::vector<T> values = arrayValues<T>(arr);
+					std::stable_sort(values.begin(), values.end(), [](const T& x, const T& y) {
+						return nativeLess(x, y);
+					});
+					assignArrayValues(arr, std::move(values));
+				}
+			);
+			
+			//merge sort is stable, so both comparator variants share the implementation
+			for (const char* name : {"sort_by", "stable_sort_by"}) {
+				m.addRawExternalFunction(
+					std::string("function void ") + name + suffix + arrayParam + ", " + comparatorParam + ")",
+					[](runtimeContext& ctx) {
+						array& arr = argument<array>(ctx, 0);
+						std::vector<T> values = arrayValues<T>(arr);
+						mergeSort(values, scriptComparator<T>(ctx, argument<function>(ctx, 1)));
+						assignArrayValues(arr, std::move(values));
+					}
+				);
+			}
+			
+			m.addRawExternalFunction(
+				"function number lower_bound" + suffix + arrayParam + ", " + elementType + ")",
+				[](runtimeContext& ctx) {
+					setReturnValue<number>(ctx, number(lowerBound(
+						argument<array>(ctx, 0),
+						argument<T>(ctx, 1),
+						[](const T& x, const T& y) {
+							return nativeLess(x, y);
+						}
+					)));
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function number upper_bound" + suffix + arrayParam + ", " + elementType + ")",
+				[](runtimeContext& ctx) {
+					setReturnValue<number>(ctx, number(upperBound(
+						argument<array>(ctx, 0),
+						argument<T>(ctx, 1),
+						[](const T& x, const T& y) {
+							return nativeLess(x, y);
+						}
+					)));
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function number lower_bound_by" + suffix + arrayParam + ", " + elementType + ", " + comparatorParam + ")",
+				[](runtimeContext& ctx) {
+					setReturnValue<number>(ctx, number(lowerBound(
+						argument<array>(ctx, 0),
+						argument<T>(ctx, 1),
+						scriptComparator<T>(ctx, argument<function>(ctx, 2))
+					)));
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function number upper_bound_by" + suffix + arrayParam + ", " + elementType + ", " + comparatorParam + ")",
+				[](runtimeContext& ctx) {
+					setReturnValue<number>(ctx, number(upperBound(
+						argument<array>(ctx, 0),
+						argument<T>(ctx, 1),
+						scriptComparator<T>(ctx, argument<function>(ctx, 2))
+					)));
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function number partition" + suffix + arrayParam + ", " + predicateParam + ")",
+				[](runtimeContext& ctx) {
+					array& arr = argument<array>(ctx, 0);
+					std::vector<T> values = arrayValues<T>(arr);
+					auto it = std::stable_partition(
+						values.begin(),
+						values.end(),
+						scriptPredicate<T>(ctx, argument<function>(ctx, 1))
+					);
+					number ret = number(it - values.begin());
+					assignArrayValues(arr, std::move(values));
+					setReturnValue<number>(ctx, ret);
+				}
+			);
+		}
+		
+		//Calls body(worker, i) for every i below count on the shared thread pool. Each
+		//thread runs f in a worker context of its own, so f must not write globals or
+		//variables it shares with other calls.
+		template <typename Body>
+		void parallelRun(runtimeContext& ctx, const function& f, size_t count, Body body) {
+			runtimeAssertion(isParallelSafe(ctx, f), "Parallel function may write global or shared variables");
+			
+			threadPool& pool = threadPool::shared();
+			std::vector<std::unique_ptr<runtimeContext> > workers(pool.slots());
+			
+			//a few chunks per thread leave something to steal when iterations differ in cost
+			size_t chunks = std::min(count, 4 * pool.slots());
+			
+			pool.run(chunks, [&](size_t chunk, size_t slot) {
+				if (!workers[slot]) {
+					workers[slot] = ctx.createWorker();
+				}
+				for (size_t i = count * chunk / chunks; i < count * (chunk + 1) / chunks; ++i) {
+					body(*workers[slot], i);
+				}
+			});
+		}
+		
+		template <typename T>
+		void addParallelFunctionsOfType(module& m, const std::string& suffix, const std::string& elementType) {
+			m.addRawExternalFunction(
+				"function " + elementType + "[] parallel_map" + suffix + "(" + elementType + "[]&, " + elementType + "(" + elementType + "))",
+				[](runtimeContext& ctx) {
+					std::vector<T> values = arrayValues<T>(argument<array>(ctx, 0));
+					const function& f = argument<function>(ctx, 1);
+					
+					array ret(values.size());
+					parallelRun(ctx, f, values.size(), [&](runtimeContext& worker, size_t i) {
+						variablePtr v = worker.call(f, {std::make_shared<variableImpl<T> >(values[i])});
+						ret[i] = std::make_shared<variableImpl<T> >(elementValue<T>(v));
+					});
+					setReturnValue<array>(ctx, std::move(ret));
+				}
+			);
+		}
+		
+		//Channels are looked up once per thread, so sending and receiving do not lock.
+		template <typename T>
+		channel<T>& namedChannel(const string& name) {
+			thread_local std::unordered_map<std::string, std::shared_ptr<channel<T> > > channels;
+			
+			std::string key = name ? *name : std::string();
+			std::shared_ptr<channel<T> >& ret = channels[key];
+			if (!ret) {
+				ret = channel<T>::named(key, default_channel_capacity);
+			}
+			return *ret;
+		}
+		
+		template <typename T>
+		void addChannelFunctionsOfType(module& m, const std::string& suffix, const std::string& elementType) {
+			m.addRawExternalFunction(
+				"function void open_channel" + suffix + "(string, number)",
+				[](runtimeContext& ctx) {
+					number capacity = argument<number>(ctx, 1);
+					runtimeAssertion(
+						capacity >= 1 && capacity <= number(max_channel_capacity),
+						"Channel capacity must be between 1 and 1048576"
+					);
+					const string& name = argument<string>(ctx, 0);
+					channel<T>::named(name ? *name : std::string(), size_t(capacity));
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function void send" + suffix + "(string, " + elementType + ")",
+				[](runtimeContext& ctx) {
+					namedChannel<T>(argument<string>(ctx, 0)).send(argument<T>(ctx, 1));
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function " + elementType + " recv" + suffix + "(string)",
+				[](runtimeContext& ctx) {
+					setReturnValue<T>(ctx, namedChannel<T>(argument<string>(ctx, 0)).recv());
+				}
+			);
+			
+			m.addRawExternalFunction(
+				"function number try_recv" + suffix + "(string, " + elementType + "&)",
+				[](runtimeContext& ctx) {
+					setReturnValue<number>(ctx, namedChannel<T>(argument<string>(ctx, 0)).tryRecv(argument<T>(ctx, 1)) ? 1 : 0);
+				}
+			);
+		}
+	}
 
 	void addMathFunctions(module& m) {
 		m.addExternalFunctions("sin", std::function<number(number)>(
@@ -67,6 +421,26 @@ namespace cobalt {
 				return str.substr(size_t(from), size_t(count));
 			}
 		));
+		
+		m.addRawExternalFunction("function string strjoin(string[]&, string)", [](runtimeContext& ctx) {
+			const array& parts = argument<array>(ctx, 0);
+			const std::string& separator = *argument<string>(ctx, 1);
+			
+			size_t size = parts.empty() ? 0 : separator.size() * (parts.size() - 1);
+			for (const variablePtr& v : parts) {
+				size += elementValue<string>(v)->size();
+			}
+			
+			std::string ret;
+			ret.reserve(size);
+			for (size_t i = 0; i < parts.size(); ++i) {
+				if (i) {
+					ret += separator;
+				}
+				ret += *elementValue<string>(parts[i]);
+			}
+			setReturnValue<string>(ctx, accountedString(std::move(ret)));
+		});
 	}
 	
 	void addTraceFunctions(module& m) {
@@ -75,12 +449,144 @@ namespace cobalt {
 				std::cout << str << std::endl;
 			}
 		));
+		
+		m.addExternalFunctions("clock", std::function<number()>(
+			[]() {
+				using namespace std::chrono;
+				return duration<number>(steady_clock::now().time_since_epoch()).count();
+			}
+		));
+	}
+	
+	void addArrayFunctions(module& m) {
+		addArrayFunctionsOfType<number>(m, "", "number");
+		addArrayFunctionsOfType<string>(m, "_str", "string");
+	}
+	
+	void addVectorFunctions(module& m) {
+		m.addRawExternalFunction("function number sum(number[]&)", [](runtimeContext& ctx) {
+			std::vector<number> x = arrayValues<number>(argument<array>(ctx, 0));
+			setReturnValue<number>(ctx, kernels::sum(x.data(), x.size()));
+		});
+		
+		m.addRawExternalFunction("function number mean(number[]&)", [](runtimeContext& ctx) {
+			std::vector<number> x = arrayValues<number>(argument<array>(ctx, 0));
+			runtimeAssertion(!x.empty(), "Mean of an empty array");
+			setReturnValue<number>(ctx, kernels::sum(x.data(), x.size()) / x.size());
+		});
+		
+		m.addRawExternalFunction("function number min(number[]&)", [](runtimeContext& ctx) {
+			std::vector<number> x = arrayValues<number>(argument<array>(ctx, 0));
+			runtimeAssertion(!x.empty(), "Minimum of an empty array");
+			setReturnValue<number>(ctx, kernels::min(x.data(), x.size()));
+		});
+		
+		m.addRawExternalFunction("function number max(number[]&)", [](runtimeContext& ctx) {
+			std::vector<number> x = arrayValues<number>(argument<array>(ctx, 0));
+			runtimeAssertion(!x.empty(), "Maximum of an empty array");
+			setReturnValue<number>(ctx, kernels::max(x.data(), x.size()));
+		});
+		
+		m.addRawExternalFunction("function number dot(number[]&, number[]&)", [](runtimeContext& ctx) {
+			std::vector<number> x = arrayValues<number>(argument<array>(ctx, 0));
+			std::vector<number> y = arrayValues<number>(argument<array>(ctx, 1));
+			runtimeAssertion(x.size() == y.size(), "Array sizes differ");
+			setReturnValue<number>(ctx, kernels::dot(x.data(), y.data(), x.size()));
+		});
+		
+		m.addRawExternalFunction("function void axpy(number, number[]&, number[]&)", [](runtimeContext& ctx) {
+			std::vector<number> x = arrayValues<number>(argument<array>(ctx, 1));
+			array& arr = argument<array>(ctx, 2);
+			std::vector<number> y = arrayValues<number>(arr);
+			runtimeAssertion(x.size() == y.size(), "Array sizes differ");
+			kernels::axpy(argument<number>(ctx, 0), x.data(), y.data(), y.size());
+			assignArrayValues(arr, std::move(y));
+		});
+		
+		m.addRawExternalFunction("function void prefix_sum(number[]&)", [](runtimeContext& ctx) {
+			array& arr = argument<array>(ctx, 0);
+			std::vector<number> x = arrayValues<number>(arr);
+			kernels::prefixSum(x.data(), x.size());
+			assignArrayValues(arr, std::move(x));
+		});
+		
+		m.addRawExternalFunction("function number[] histogram(number[]&, number, number, number)", [](runtimeContext& ctx) {
+			std::vector<number> x = arrayValues<number>(argument<array>(ctx, 0));
+			number lo = argument<number>(ctx, 1);
+			number hi = argument<number>(ctx, 2);
+			number bins = argument<number>(ctx, 3);
+			runtimeAssertion(lo < hi, "Invalid histogram range");
+			runtimeAssertion(bins >= 1 && bins == size_t(bins), "Invalid histogram bin count");
+			
+			//the result is charged as it is built, so too many bins exceed the memory
+			//limit before the counts are allocated
+			array ret;
+			for (size_t i = 0; i < size_t(bins); ++i) {
+				ret.push_back(std::make_shared<variableImpl<number> >(0));
+			}
+			
+			std::vector<size_t> counts(ret.size(), 0);
+			kernels::histogram(x.data(), x.size(), lo, hi, counts.data(), counts.size());
+			
+			for (size_t i = 0; i < counts.size(); ++i) {
+				static_cast<variableImpl<number>*>(ret[i].get())->value = number(counts[i]);
+			}
+			setReturnValue<array>(ctx, std::move(ret));
+		});
+		
+		for (auto [name, f] : {
+			std::make_pair("map_sin", static_cast<number(*)(number)>(std::sin)),
+			std::make_pair("map_cos", static_cast<number(*)(number)>(std::cos)),
+			std::make_pair("map_tan", static_cast<number(*)(number)>(std::tan)),
+			std::make_pair("map_log", static_cast<number(*)(number)>(std::log)),
+			std::make_pair("map_exp", static_cast<number(*)(number)>(std::exp)),
+		}) {
+			m.addRawExternalFunction(std::string("function void ") + name + "(number[]&)", [f=f](runtimeContext& ctx) {
+				for (const variablePtr& v : argument<array>(ctx, 0)) {
+					number& value = static_cast<variableImpl<number>*>(v.get())->value;
+					value = f(value);
+				}
+			});
+		}
+		
+		m.addRawExternalFunction("function void map_pow(number[]&, number)", [](runtimeContext& ctx) {
+			number y = argument<number>(ctx, 1);
+			for (const variablePtr& v : argument<array>(ctx, 0)) {
+				number& value = static_cast<variableImpl<number>*>(v.get())->value;
+				value = std::pow(value, y);
+			}
+		});
+	}
+	
+	void addParallelFunctions(module& m) {
+		m.addRawExternalFunction("function void parallel_for(number, number, void(number))", [](runtimeContext& ctx) {
+			number begin = argument<number>(ctx, 0);
+			number end = argument<number>(ctx, 1);
+			const function& f = argument<function>(ctx, 2);
+			
+			size_t count = end > begin ? size_t(std::ceil(end - begin)) : 0;
+			parallelRun(ctx, f, count, [&](runtimeContext& worker, size_t i) {
+				worker.call(f, {std::make_shared<variableImpl<number> >(begin + number(i))});
+			});
+		});
+		
+		addParallelFunctionsOfType<number>(m, "", "number");
+		addParallelFunctionsOfType<string>(m, "_str", "string");
+	}
+	
+	void addChannelFunctions(module& m) {
+		addChannelFunctionsOfType<number>(m, "", "number");
+		addChannelFunctionsOfType<string>(m, "_str", "string");
 	}
 	
 	void addStandardFunctions(module& m) {
 		addMathFunctions(m);
 		addStringFunctions(m);
 		addTraceFunctions(m);
+		addArrayFunctions(m);
+		addVectorFunctions(m);
+		addParallelFunctions(m);
+		addChannelFunctions(m);
 	}
 
 }
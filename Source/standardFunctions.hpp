@@ -8,6 +8,10 @@ namespace cobalt {
 	void addMathFunctions(module& m);
 	void addStringFunctions(module& m);
 	void addTraceFunctions(module& m);
+	void addArrayFunctions(module& m);
+	void addVectorFunctions(module& m);
+	void addParallelFunctions(module& m);
+	void addChannelFunctions(module& m);
 	
 	void addStandardFunctions(module& m);
 }
@@ -1,44 +1,41 @@
 #include <unordered_map>
+#include <algorithm>
 #include "statement.hpp"
 #include "expression.hpp"
 #include "runtimeContext.hpp"
+#include "generator.hpp"
 
 namespace cobalt {
-	flow::flow(flow_type type, int breakLevel):
-		_type(type),
-		_break_level(breakLevel)
-	{
-	}
-
-	flow_type flow::type() const {
-		return _type;
-	}
-	
-	int flow::breakLevel() const {
-		return _break_level;
-	}
-	
-	flow flow::normalFlow() {
-		return flow(flow_type::f_normal, 0);
-	}
-
-	flow flow::breakFlow(int breakLevel) {
-		return flow(flow_type::f_break, breakLevel);
-	}
-	
-	flow flow::continueFlow() {
-		return flow(flow_type::f_continue, 0);
-	}
-	
-	flow flow::returnFlow() {
-		return flow(flow_type::f_return, 0);
-	}
-	
-	flow flow::consumeBreak() {
-		return _break_level == 1 ? flow::normalFlow() : flow::breakFlow(_break_level-1);
+	bool statement::canJump() const {
+		return false;
 	}
 	
 	namespace {
+		bool anyCanJump(const std::vector<statement_ptr>& statements) {
+			return std::any_of(statements.begin(), statements.end(), [](const statement_ptr& s) {
+				return s->canJump();
+			});
+		}
+		
+		//Called by loops after the body left a control transfer pending. Consumes
+		//continue and one level of break, and returns true if the loop has to exit.
+		bool leaveLoop(runtimeContext& context) {
+			flow f = context.pendingFlow();
+			switch (f.type()) {
+				case flow_type::f_normal:
+					return false;
+				case flow_type::f_continue:
+					context.setFlow(flow::normalFlow());
+					return false;
+				case flow_type::f_break:
+					context.setFlow(f.consumeBreak());
+					return true;
+				case flow_type::f_return:
+				default:
+					return true;
+			}
+		}
+		
 		class simple_statement: public statement {
 		private:
 			expression<void>::ptr _expr;
@@ -48,12 +45,12 @@ namespace cobalt {
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
+			void execute(runtimeContext& context) override {
 				_expr->evaluate(context);
-				return flow::normalFlow();
 			}
 		};
 		
+		template<bool Jumps>
 		class block_statement: public statement {
 		private:
 			std::vector<statement_ptr> _statements;
@@ -63,31 +60,35 @@ namespace cobalt {
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
-				auto _ = context.enterScope();
+			void execute(runtimeContext& context) override {
 				for (const statement_ptr& statement : _statements) {
-					if (flow f = statement->execute(context); f.type() != flow_type::f_normal) {
-						return f;
+					statement->execute(context);
+					if constexpr(Jumps) {
+						if (context.pendingFlow().type() != flow_type::f_normal) {
+							return;
+						}
 					}
 				}
-				return flow::normalFlow();
+			}
+			
+			bool canJump() const override {
+				return Jumps;
 			}
 		};
 			
 		class local_declaration_statement: public statement {
 		private:
-			std::vector<expression<lvalue>::ptr> _decls;
+			std::vector<expression<void>::ptr> _decls;
 		public:
-			local_declaration_statement(std::vector<expression<lvalue>::ptr> decls):
+			local_declaration_statement(std::vector<expression<void>::ptr> decls):
 				_decls(std::move(decls))
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
-				for (const expression<lvalue>::ptr& decl : _decls) {
-					context.push(decl->evaluate(context));
+			void execute(runtimeContext& context) override {
+				for (const expression<void>::ptr& decl : _decls) {
+					decl->evaluate(context);
 				}
-				return flow::normalFlow();
 			}
 		};
 			
@@ -100,8 +101,12 @@ namespace cobalt {
 			{
 			}
 			
-			flow execute(runtimeContext&) override {
-				return flow::breakFlow(_break_level);
+			void execute(runtimeContext& context) override {
+				context.setFlow(flow::breakFlow(_break_level));
+			}
+			
+			bool canJump() const override {
+				return true;
 			}
 		};
 		
@@ -109,23 +114,31 @@ namespace cobalt {
 		public:
 			continue_statement() = default;
 			
-			flow execute(runtimeContext&) override {
-				return flow::continueFlow();
+			void execute(runtimeContext& context) override {
+				context.setFlow(flow::continueFlow());
+			}
+			
+			bool canJump() const override {
+				return true;
 			}
 		};
 		
 		class return_statement: public statement {
 		private:
-			expression<lvalue>::ptr _expr;
+			expression<void>::ptr _expr;
 		public:
-			return_statement(expression<lvalue>::ptr expr) :
+			return_statement(expression<void>::ptr expr) :
 				_expr(std::move(expr))
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
-				context.retval() = _expr->evaluate(context);
-				return flow::returnFlow();
+			void execute(runtimeContext& context) override {
+				_expr->evaluate(context);
+				context.setFlow(flow::returnFlow());
+			}
+			
+			bool canJump() const override {
+				return true;
 			}
 		};
 		
@@ -133,8 +146,12 @@ namespace cobalt {
 		public:
 			return_void_statement() = default;
 			
-			flow execute(runtimeContext&) override {
-				return flow::returnFlow();
+			void execute(runtimeContext& context) override {
+				context.setFlow(flow::returnFlow());
+			}
+			
+			bool canJump() const override {
+				return true;
 			}
 		};
 		
@@ -142,29 +159,36 @@ namespace cobalt {
 		private:
 			std::vector<expression<number>::ptr> _exprs;
 			std::vector<statement_ptr> _statements;
+			bool _can_jump;
 		public:
 			if_statement(std::vector<expression<number>::ptr> exprs, std::vector<statement_ptr> statements):
 				_exprs(std::move(exprs)),
-				_statements(std::move(statements))
+				_statements(std::move(statements)),
+				_can_jump(anyCanJump(_statements))
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
+			void execute(runtimeContext& context) override {
 				for (size_t i = 0; i < _exprs.size(); ++i) {
 					if (_exprs[i]->evaluate(context)) {
-						return _statements[i]->execute(context);
+						_statements[i]->execute(context);
+						return;
 					}
 				}
-				return _statements.back()->execute(context);
+				_statements.back()->execute(context);
+			}
+			
+			bool canJump() const override {
+				return _can_jump;
 			}
 		};
 		
 		class if_declare_statement: public if_statement {
 		private:
-			std::vector<expression<lvalue>::ptr> _decls;
+			std::vector<expression<void>::ptr> _decls;
 		public:
 			if_declare_statement(
-				std::vector<expression<lvalue>::ptr> decls,
+				std::vector<expression<void>::ptr> decls,
 				std::vector<expression<number>::ptr> exprs,
 				std::vector<statement_ptr> statements
 			):
@@ -173,81 +197,234 @@ namespace cobalt {
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
-				auto _ = context.enterScope();
+			void execute(runtimeContext& context) override {
+				for (const expression<void>::ptr& decl : _decls) {
+					decl->evaluate(context);
+				}
 				
-				for (const expression<lvalue>::ptr& decl : _decls) {
-					context.push(decl->evaluate(context));
+				if_statement::execute(context);
+			}
+		};
+		
+		class jump_table {
+		private:
+			number _base;
+			std::vector<size_t> _targets;
+			size_t _dflt;
+		public:
+			jump_table(const std::vector<std::pair<number, size_t> >& cases, size_t dflt):
+				_base(0),
+				_dflt(dflt)
+			{
+				if (cases.empty()) {
+					return;
 				}
 				
-				return if_statement::execute(context);
+				number last = cases[0].first;
+				_base = cases[0].first;
+				for (const std::pair<number, size_t>& c : cases) {
+					_base = std::min(_base, c.first);
+					last = std::max(last, c.first);
+				}
+				
+				_targets.assign(size_t(last - _base) + 1, dflt);
+				for (const std::pair<number, size_t>& c : cases) {
+					_targets[size_t(c.first - _base)] = c.second;
+				}
+			}
+			
+			size_t find(number n) const {
+				number offset = n - _base;
+				if (offset >= 0 && offset < _targets.size()) {
+					size_t idx = size_t(offset);
+					if (idx == offset) {
+						return _targets[idx];
+					}
+				}
+				return _dflt;
 			}
 		};
 		
+		class binary_search_table {
+		private:
+			std::vector<number> _keys;
+			std::vector<size_t> _targets;
+			size_t _dflt;
+		public:
+			binary_search_table(std::vector<std::pair<number, size_t> > cases, size_t dflt):
+				_dflt(dflt)
+			{
+				std::sort(cases.begin(), cases.end());
+				
+				_keys.reserve(cases.size());
+				_targets.reserve(cases.size());
+				
+				for (const std::pair<number, size_t>& c : cases) {
+					_keys.push_back(c.first);
+					_targets.push_back(c.second);
+				}
+			}
+			
+			size_t find(number n) const {
+				if (_keys.empty()) {
+					return _dflt;
+				}
+				
+				//The loop runs a fixed number of iterations for a given table size and
+				//the conditional move keeps it free of unpredictable branches.
+				const number* base = _keys.data();
+				for (size_t len = _keys.size(); len > 1;) {
+					size_t half = len / 2;
+					base = (base[half] <= n) ? base + half : base;
+					len -= half;
+				}
+				
+				return *base == n ? _targets[base - _keys.data()] : _dflt;
+			}
+		};
+		
+		class hash_table {
+		private:
+			std::unordered_map<number, size_t> _cases;
+			size_t _dflt;
+		public:
+			hash_table(const std::vector<std::pair<number, size_t> >& cases, size_t dflt):
+				_cases(cases.begin(), cases.end()),
+				_dflt(dflt)
+			{
+			}
+			
+			size_t find(number n) const {
+				auto it = _cases.find(n);
+				return it == _cases.end() ? _dflt : it->second;
+			}
+		};
+		
+		template<typename Table, bool Jumps>
 		class switch_statement: public statement {
 		private:
 			expression<number>::ptr _expr;
 			std::vector<statement_ptr> _statements;
-			std::unordered_map<number, size_t> _cases;
-			size_t _dflt;
+			Table _table;
 		public:
 			switch_statement(
 				expression<number>::ptr expr,
 				std::vector<statement_ptr> statements,
-				std::unordered_map<number, size_t> cases,
-				size_t dflt
+				Table table
 			):
 				_expr(std::move(expr)),
 				_statements(std::move(statements)),
-				_cases(std::move(cases)),
-				_dflt(dflt)
+				_table(std::move(table))
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
-				auto it = _cases.find(_expr->evaluate(context));
-				for (size_t idx = (it == _cases.end() ? _dflt : it->second); idx < _statements.size(); ++idx) {
-					switch (flow f = _statements[idx]->execute(context); f.type()) {
-						case flow_type::f_normal:
-							break;
-						case flow_type::f_break:
-							return f.consumeBreak();
-						default:
-							return f;
+			void execute(runtimeContext& context) override {
+				for (size_t idx = _table.find(_expr->evaluate(context)); idx < _statements.size(); ++idx) {
+					_statements[idx]->execute(context);
+					if constexpr(Jumps) {
+						if (flow f = context.pendingFlow(); f.type() != flow_type::f_normal) {
+							if (f.type() == flow_type::f_break) {
+								context.setFlow(f.consumeBreak());
+							}
+							return;
+						}
 					}
 				}
-				
-				return flow::normalFlow();
+			}
+			
+			bool canJump() const override {
+				return Jumps;
 			}
 		};
 		
-		class switch_declare_statement: public switch_statement {
+		template<typename Table, bool Jumps>
+		class switch_declare_statement: public switch_statement<Table, Jumps> {
 		private:
-			std::vector<expression<lvalue>::ptr> _decls;
+			std::vector<expression<void>::ptr> _decls;
 		public:
 			switch_declare_statement(
-				std::vector<expression<lvalue>::ptr> decls,
+				std::vector<expression<void>::ptr> decls,
 				expression<number>::ptr expr,
 				std::vector<statement_ptr> statements,
-				std::unordered_map<number, size_t> cases,
-				size_t dflt
+				Table table
 			):
-				_decls(std::move(decls)),
-				switch_statement(std::move(expr), std::move(statements), std::move(cases), dflt)
+				switch_statement<Table, Jumps>(std::move(expr), std::move(statements), std::move(table)),
+				_decls(std::move(decls))
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
-				auto _ = context.enterScope();
-			
-				for (const expression<lvalue>::ptr& decl : _decls) {
-					context.push(decl->evaluate(context));
+			void execute(runtimeContext& context) override {
+				for (const expression<void>::ptr& decl : _decls) {
+					decl->evaluate(context);
 				}
 				
-				return switch_statement::execute(context);
+				switch_statement<Table, Jumps>::execute(context);
 			}
 		};
 		
+		template<typename Table, bool Jumps>
+		statement_ptr create_switch_statement(
+			std::vector<expression<void>::ptr> decls,
+			expression<number>::ptr expr,
+			std::vector<statement_ptr> statements,
+			Table table
+		) {
+			if (!decls.empty()) {
+				return std::make_unique<switch_declare_statement<Table, Jumps> >(
+					std::move(decls),
+					std::move(expr),
+					std::move(statements),
+					std::move(table)
+				);
+			} else {
+				return std::make_unique<switch_statement<Table, Jumps> >(
+					std::move(expr),
+					std::move(statements),
+					std::move(table)
+				);
+			}
+		}
+		
+		template<typename Table>
+		statement_ptr create_switch_statement(
+			std::vector<expression<void>::ptr> decls,
+			expression<number>::ptr expr,
+			std::vector<statement_ptr> statements,
+			Table table
+		) {
+			if (anyCanJump(statements)) {
+				return create_switch_statement<Table, true>(
+					std::move(decls), std::move(expr), std::move(statements), std::move(table)
+				);
+			} else {
+				return create_switch_statement<Table, false>(
+					std::move(decls), std::move(expr), std::move(statements), std::move(table)
+				);
+			}
+		}
+		
+		class profiled_statement: public statement {
+		private:
+			size_t _function_index;
+			statement_ptr _statement;
+		public:
+			profiled_statement(size_t functionIndex, statement_ptr statement):
+				_function_index(functionIndex),
+				_statement(std::move(statement))
+			{
+			}
+			
+			void execute(runtimeContext& context) override {
+				context.profile(_function_index);
+				_statement->execute(context);
+			}
+			
+			bool canJump() const override {
+				return _statement->canJump();
+			}
+		};
+		
+		template<bool Jumps>
 		class while_statement: public statement {
 		private:
 			expression<number>::ptr _expr;
@@ -259,23 +436,23 @@ namespace cobalt {
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
+			void execute(runtimeContext& context) override {
 				while (_expr->evaluate(context)) {
-					switch (flow f = _statement->execute(context); f.type()) {
-						case flow_type::f_normal:
-						case flow_type::f_continue:
-							break;
-						case flow_type::f_break:
-							return f.consumeBreak();
-						case flow_type::f_return:
-							return f;
+					_statement->execute(context);
+					if constexpr(Jumps) {
+						if (context.pendingFlow().type() != flow_type::f_normal && leaveLoop(context)) {
+							return;
+						}
 					}
 				}
-				
-				return flow::normalFlow();
+			}
+			
+			bool canJump() const override {
+				return Jumps;
 			}
 		};
 		
+		template<bool Jumps>
 		class do_statement: public statement {
 		private:
 			expression<number>::ptr _expr;
@@ -287,23 +464,23 @@ namespace cobalt {
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
+			void execute(runtimeContext& context) override {
 				do {
-					switch (flow f = _statement->execute(context); f.type()) {
-						case flow_type::f_normal:
-						case flow_type::f_continue:
-							break;
-						case flow_type::f_break:
-							return f.consumeBreak();
-						case flow_type::f_return:
-							return f;
+					_statement->execute(context);
+					if constexpr(Jumps) {
+						if (context.pendingFlow().type() != flow_type::f_normal && leaveLoop(context)) {
+							return;
+						}
 					}
 				} while (_expr->evaluate(context));
-				
-				return flow::normalFlow();
+			}
+			
+			bool canJump() const override {
+				return Jumps;
 			}
 		};
 		
+		template<bool Jumps>
 		class for_statement_base: public statement {
 		private:
 			expression<number>::ptr _expr2;
@@ -321,24 +498,24 @@ namespace cobalt {
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
+			void execute(runtimeContext& context) override {
 				for (; _expr2->evaluate(context); _expr3->evaluate(context)) {
-					switch (flow f = _statement->execute(context); f.type()) {
-						case flow_type::f_normal:
-						case flow_type::f_continue:
-							break;
-						case flow_type::f_break:
-							return f.consumeBreak();
-						case flow_type::f_return:
-							return f;
+					_statement->execute(context);
+					if constexpr(Jumps) {
+						if (context.pendingFlow().type() != flow_type::f_normal && leaveLoop(context)) {
+							return;
+						}
 					}
 				}
-				
-				return flow::normalFlow();
+			}
+			
+			bool canJump() const override {
+				return Jumps;
 			}
 		};
 		
-		class for_statement: public for_statement_base {
+		template<bool Jumps>
+		class for_statement: public for_statement_base<Jumps> {
 		private:
 			expression<void>::ptr _expr1;
 		public:
@@ -348,62 +525,122 @@ namespace cobalt {
 				expression<void>::ptr expr3,
 				statement_ptr statement
 			):
-				for_statement_base(std::move(expr2), std::move(expr3), std::move(statement)),
+				for_statement_base<Jumps>(std::move(expr2), std::move(expr3), std::move(statement)),
 				_expr1(std::move(expr1))
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
+			void execute(runtimeContext& context) override {
 				_expr1->evaluate(context);
 				
-				return for_statement_base::execute(context);
+				for_statement_base<Jumps>::execute(context);
 			}
 		};
 		
-		class for_declare_statement: public for_statement_base {
+		template<bool Jumps>
+		class for_declare_statement: public for_statement_base<Jumps> {
 		private:
-			std::vector<expression<lvalue>::ptr> _decls;
-			expression<number>::ptr _expr2;
-			expression<void>::ptr _expr3;
-			statement_ptr _statement;
+			std::vector<expression<void>::ptr> _decls;
 		public:
 			for_declare_statement(
-				std::vector<expression<lvalue>::ptr> decls,
+				std::vector<expression<void>::ptr> decls,
 				expression<number>::ptr expr2,
 				expression<void>::ptr expr3,
 				statement_ptr statement
 			):
-				for_statement_base(std::move(expr2), std::move(expr3), std::move(statement)),
+				for_statement_base<Jumps>(std::move(expr2), std::move(expr3), std::move(statement)),
 				_decls(std::move(decls))
 			{
 			}
 			
-			flow execute(runtimeContext& context) override {
-				auto _ = context.enterScope();
-				
-				for (const expression<lvalue>::ptr& decl : _decls) {
-					context.push(decl->evaluate(context));
+			void execute(runtimeContext& context) override {
+				for (const expression<void>::ptr& decl : _decls) {
+					decl->evaluate(context);
 				}
 
-				return for_statement_base::execute(context);
+				for_statement_base<Jumps>::execute(context);
+			}
+		};
+		
+		template<bool Jumps>
+		class for_in_statement: public statement {
+		private:
+			size_t _idx;
+			expression<lvalue>::ptr _gen;
+			statement_ptr _statement;
+		public:
+			for_in_statement(size_t idx, expression<lvalue>::ptr gen, statement_ptr statement):
+				_idx(idx),
+				_gen(std::move(gen)),
+				_statement(std::move(statement))
+			{
+			}
+			
+			void execute(runtimeContext& context) override {
+				//a copy, so the generator lives on if the body assigns the variable it came from
+				function next = static_cast<variableImpl<function>*>(_gen->evaluate(context).get())->value;
+				
+				while (variablePtr value = context.call(next, {})) {
+					context.local(int(_idx)) = std::move(value);
+					_statement->execute(context);
+					if constexpr(Jumps) {
+						if (context.pendingFlow().type() != flow_type::f_normal && leaveLoop(context)) {
+							return;
+						}
+					}
+				}
+			}
+			
+			bool canJump() const override {
+				return Jumps;
 			}
 		};
+		
+		class yield_statement: public statement {
+		private:
+			expression<lvalue>::ptr _expr;
+		public:
+			yield_statement(expression<lvalue>::ptr expr):
+				_expr(std::move(expr))
+			{
+			}
+			
+			void execute(runtimeContext& context) override {
+				generatorState::yield(_expr->evaluate(context));
+			}
+		};
+		
+		//Instantiates S<true> if any of the inner statements can leave a control
+		//transfer pending, and the check-free S<false> otherwise.
+		template<template<bool> typename S, typename... Args>
+		statement_ptr create_jump_aware(bool jumps, Args&&... args) {
+			if (jumps) {
+				return std::make_unique<S<true> >(std::forward<Args>(args)...);
+			} else {
+				return std::make_unique<S<false> >(std::forward<Args>(args)...);
+			}
+		}
 	}
 	
 	statement_ptr createSimpleStatement(expression<void>::ptr expr) {
 		return std::make_unique<simple_statement>(std::move(expr));
 	}
 	
-	statement_ptr createLocalDeclarationState(std::vector<expression<lvalue>::ptr> decls) {
+	statement_ptr createLocalDeclarationState(std::vector<expression<void>::ptr> decls) {
 		return std::make_unique<local_declaration_statement>(std::move(decls));
 	}
 	
 	statement_ptr createBlockStatement(std::vector<statement_ptr> statements) {
-		return std::make_unique<block_statement>(std::move(statements));
+		bool jumps = anyCanJump(statements);
+		return create_jump_aware<block_statement>(jumps, std::move(statements));
 	}
 	
 	shared_statement_ptr createSharedBlockStatement(std::vector<statement_ptr> statements) {
-		return std::make_shared<block_statement>(std::move(statements));
+		if (anyCanJump(statements)) {
+			return std::make_shared<block_statement<true> >(std::move(statements));
+		} else {
+			return std::make_shared<block_statement<false> >(std::move(statements));
+		}
 	}
 
 	statement_ptr createBreakStatement(int breakLevel) {
@@ -414,7 +651,7 @@ namespace cobalt {
 		return std::make_unique<continue_statement>();
 	}
 	
-	statement_ptr createReturnStatement(expression<lvalue>::ptr expr) {
+	statement_ptr createReturnStatement(expression<void>::ptr expr) {
 		return std::make_unique<return_statement>(std::move(expr));
 	}
 	
@@ -423,7 +660,7 @@ namespace cobalt {
 	}
 	
 	statement_ptr createIfStatement(
-		std::vector<expression<lvalue>::ptr> decls,
+		std::vector<expression<void>::ptr> decls,
 		std::vector<expression<number>::ptr> exprs,
 		std::vector<statement_ptr> statements
 	) {
@@ -435,35 +672,43 @@ namespace cobalt {
 	}
 	
 	statement_ptr createSwitchStatement(
-		std::vector<expression<lvalue>::ptr> decls,
+		std::vector<expression<void>::ptr> decls,
 		expression<number>::ptr expr,
 		std::vector<statement_ptr> statements,
-		std::unordered_map<number, size_t> cases,
-		size_t dflt
+		std::vector<std::pair<number, size_t> > cases,
+		size_t dflt,
+		switch_lowering lowering
 	) {
-		if (!decls.empty()) {
-			return std::make_unique<switch_declare_statement>(
-				std::move(decls),
-				std::move(expr),
-				std::move(statements),
-				std::move(cases), dflt
-			);
-		} else {
-			return std::make_unique<switch_statement>(
-				std::move(expr),
-				std::move(statements),
-				std::move(cases), dflt
-			);
+		switch (lowering) {
+			case switch_lowering::jump_table:
+				return create_switch_statement(
+					std::move(decls), std::move(expr), std::move(statements), jump_table(cases, dflt)
+				);
+			case switch_lowering::binary_search:
+				return create_switch_statement(
+					std::move(decls), std::move(expr), std::move(statements), binary_search_table(std::move(cases), dflt)
+				);
+			case switch_lowering::hash_table:
+			default:
+				return create_switch_statement(
+					std::move(decls), std::move(expr), std::move(statements), hash_table(cases, dflt)
+				);
 		}
 	}
 	
 	
+	statement_ptr createProfiledStatement(size_t functionIndex, statement_ptr statement) {
+		return std::make_unique<profiled_statement>(functionIndex, std::move(statement));
+	}
+	
 	statement_ptr createWhileStatement(expression<number>::ptr expr, statement_ptr statement) {
-		return std::make_unique<while_statement>(std::move(expr), std::move(statement));
+		bool jumps = statement->canJump();
+		return create_jump_aware<while_statement>(jumps, std::move(expr), std::move(statement));
 	}
 	
 	statement_ptr createDoStatement(expression<number>::ptr expr, statement_ptr statement) {
-		return std::make_unique<do_statement>(std::move(expr), std::move(statement));
+		bool jumps = statement->canJump();
+		return create_jump_aware<do_statement>(jumps, std::move(expr), std::move(statement));
 	}
 	
 	statement_ptr createForStatement(
@@ -472,15 +717,30 @@ namespace cobalt {
 		expression<void>::ptr expr3,
 		statement_ptr statement
 	) {
-		return std::make_unique<for_statement>(std::move(expr1), std::move(expr2), std::move(expr3), std::move(statement));
+		bool jumps = statement->canJump();
+		return create_jump_aware<for_statement>(
+			jumps, std::move(expr1), std::move(expr2), std::move(expr3), std::move(statement)
+		);
 	}
 	
 	statement_ptr createForStatement(
-		std::vector<expression<lvalue>::ptr> decls,
+		std::vector<expression<void>::ptr> decls,
 		expression<number>::ptr expr2,
 		expression<void>::ptr expr3,
 		statement_ptr statement
 	) {
-		return std::make_unique<for_declare_statement>(std::move(decls), std::move(expr2), std::move(expr3), std::move(statement));
+		bool jumps = statement->canJump();
+		return create_jump_aware<for_declare_statement>(
+			jumps, std::move(decls), std::move(expr2), std::move(expr3), std::move(statement)
+		);
+	}
+	
+	statement_ptr createForInStatement(size_t idx, expression<lvalue>::ptr gen, statement_ptr statement) {
+		bool jumps = statement->canJump();
+		return create_jump_aware<for_in_statement>(jumps, idx, std::move(gen), std::move(statement));
+	}
+	
+	statement_ptr createYieldStatement(expression<lvalue>::ptr expr) {
+		return std::make_unique<yield_statement>(std::move(expr));
 	}
 }
@@ -2,31 +2,14 @@
 #define statement_hpp
 #include <memory>
 #include <vector>
-#include <unordered_map>
+#include <utility>
 #include "expression.hpp"
 
 namespace cobalt {
-	enum struct flow_type{
-		f_normal,
-		f_break,
-		f_continue,
-		f_return,
-	};
-	
-	class flow {
-	private:
-		flow_type _type;
-		int _break_level;
-		flow(flow_type type, int breakLevel);
-	public:
-		flow_type type() const;
-		int breakLevel() const;
-		
-		static flow normalFlow();
-		static flow breakFlow(int breakLevel);
-		static flow continueFlow();
-		static flow returnFlow();
-		flow consumeBreak();
+	enum struct switch_lowering{
+		jump_table,
+		binary_search,
+		hash_table,
 	};
 	
 	class runtimeContext;
@@ -37,7 +20,13 @@ namespace cobalt {
 	protected:
 		statement() = default;
 	public:
-		virtual flow execute(runtimeContext& context) = 0;
+		virtual void execute(runtimeContext& context) = 0;
+		
+		//True if executing the statement may leave a break, continue or return
+		//pending in the runtime context. Statements that can't are run without
+		//inspecting the context afterwards.
+		virtual bool canJump() const;
+		
 		virtual ~statement() = default;
 	};
 	
@@ -46,7 +35,7 @@ namespace cobalt {
 	
 	statement_ptr createSimpleStatement(expression<void>::ptr expr);
 	
-	statement_ptr createLocalDeclarationState(std::vector<expression<lvalue>::ptr> decls);
+	statement_ptr createLocalDeclarationState(std::vector<expression<void>::ptr> decls);
 	
 	statement_ptr createBlockStatement(std::vector<statement_ptr> statements);
 	shared_statement_ptr createSharedBlockStatement(std::vector<statement_ptr> statements);
@@ -55,25 +44,29 @@ namespace cobalt {
 	
 	statement_ptr createContinueStatement();
 	
-	statement_ptr createReturnStatement(expression<lvalue>::ptr expr);
+	statement_ptr createReturnStatement(expression<void>::ptr expr);
 	
 	statement_ptr createReturnVoidStatement();
 	
 	statement_ptr createIfStatement(
-		std::vector<expression<lvalue>::ptr> decls,
+		std::vector<expression<void>::ptr> decls,
 		std::vector<expression<number>::ptr> exprs,
 		std::vector<statement_ptr> statements
 	);
 	
 	statement_ptr createSwitchStatement(
-		std::vector<expression<lvalue>::ptr> decls,
+		std::vector<expression<void>::ptr> decls,
 		expression<number>::ptr expr,
 		std::vector<statement_ptr> statements,
-		std::unordered_map<number, size_t> cases,
-		size_t dflt
+		std::vector<std::pair<number, size_t> > cases,
+		size_t dflt,
+		switch_lowering lowering
 	);
 	
 	
+	//Runs statement after counting it in the runtime profile of the function.
+	statement_ptr createProfiledStatement(size_t functionIndex, statement_ptr statement);
+	
 	statement_ptr createWhileStatement(expression<number>::ptr expr, statement_ptr statement);
 	
 	statement_ptr createDoStatement(expression<number>::ptr expr, statement_ptr statement);
@@ -86,11 +79,16 @@ namespace cobalt {
 	);
 	
 	statement_ptr createForStatement(
-		std::vector<expression<lvalue>::ptr> decls,
+		std::vector<expression<void>::ptr> decls,
 		expression<number>::ptr expr2,
 		expression<void>::ptr expr3,
 		statement_ptr statement
 	);
+	
+	//Assigns local idx each value of the generator gen in turn, and runs statement.
+	statement_ptr createForInStatement(size_t idx, expression<lvalue>::ptr gen, statement_ptr statement);
+	
+	statement_ptr createYieldStatement(expression<lvalue>::ptr expr);
 }
 
 
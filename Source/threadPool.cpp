@@ -0,0 +1,179 @@
+#include "threadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <limits>
+
+namespace cobalt {
+	namespace {
+		const size_t no_slot = std::numeric_limits<size_t>::max();
+		
+		//Slot of the pool worker running on this thread, if any.
+		thread_local size_t worker_slot = no_slot;
+	}
+	
+	struct threadPool::job {
+		struct queue {
+			std::mutex mutex;
+			std::deque<size_t> indices;
+		};
+		
+		const std::function<void(size_t, size_t)>& task;
+		std::vector<queue> queues;
+		std::atomic<size_t> unclaimed;
+		std::atomic<size_t> remaining;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::exception_ptr error;
+		size_t error_index;
+		
+		job(size_t count, size_t slots, const std::function<void(size_t, size_t)>& task):
+			task(task),
+			queues(slots),
+			unclaimed(count),
+			remaining(count),
+			error_index(std::numeric_limits<size_t>::max())
+		{
+			for (size_t slot = 0; slot < slots; ++slot) {
+				size_t first = count * slot / slots;
+				size_t last = count * (slot + 1) / slots;
+				for (size_t i = first; i < last; ++i) {
+					queues[slot].indices.push_back(i);
+				}
+			}
+		}
+		
+		//Takes an index from the own queue of the slot, or steals one from the back
+		//of another queue.
+		bool claim(size_t slot, size_t& idx) {
+			for (size_t i = 0; i < queues.size(); ++i) {
+				queue& q = queues[(slot + i) % queues.size()];
+				std::lock_guard<std::mutex> lock(q.mutex);
+				if (!q.indices.empty()) {
+					if (i == 0) {
+						idx = q.indices.front();
+						q.indices.pop_front();
+					} else {
+						idx = q.indices.back();
+						q.indices.pop_back();
+					}
+					--unclaimed;
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		//Runs tasks with the slot until none is left to claim.
+		void help(size_t slot) {
+			size_t idx;
+			while (claim(slot, idx)) {
+				try {
+					task(idx, slot);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock(mutex);
+					if (idx < error_index) {
+						error_index = idx;
+						error = std::current_exception();
+					}
+				}
+				
+				if (--remaining == 0) {
+					std::lock_guard<std::mutex> lock(mutex);
+					done.notify_all();
+				}
+			}
+		}
+	};
+	
+	threadPool::threadPool(size_t threads):
+		_stopping(false)
+	{
+		for (size_t slot = 0; slot < threads; ++slot) {
+			_threads.emplace_back([this, slot](){
+				worker_slot = slot;
+				work(slot);
+			});
+		}
+	}
+	
+	threadPool::~threadPool() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stopping = true;
+		}
+		_work.notify_all();
+		
+		for (std::thread& t : _threads) {
+			t.join();
+		}
+	}
+	
+	threadPool& threadPool::shared() {
+		static threadPool pool(std::max<size_t>(std::thread::hardware_concurrency(), 1) - 1);
+		return pool;
+	}
+	
+	size_t threadPool::slots() const {
+		return _threads.size() + 1;
+	}
+	
+	void threadPool::work(size_t slot) {
+		std::unique_lock<std::mutex> lock(_mutex);
+		
+		while (true) {
+			auto it = std::find_if(_jobs.begin(), _jobs.end(), [](const std::shared_ptr<job>& j){
+				return j->unclaimed > 0;
+			});
+			
+			if (it != _jobs.end()) {
+				std::shared_ptr<job> j = *it;
+				lock.unlock();
+				j->help(slot);
+				lock.lock();
+			} else if (_stopping) {
+				return;
+			} else {
+				_work.wait(lock);
+			}
+		}
+	}
+	
+	void threadPool::run(size_t count, const std::function<void(size_t, size_t)>& task) {
+		if (count == 0) {
+			return;
+		}
+		
+		//A worker that submits a job keeps its own slot, so a nested job can not share
+		//a slot with a task it is part of. Any other thread takes the last slot.
+		size_t slot = worker_slot == no_slot ? _threads.size() : worker_slot;
+		
+		std::shared_ptr<job> j = std::make_shared<job>(count, slots(), task);
+		
+		std::list<std::shared_ptr<job> >::iterator it;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			it = _jobs.insert(_jobs.end(), j);
+		}
+		_work.notify_all();
+		
+		j->help(slot);
+		
+		{
+			std::unique_lock<std::mutex> lock(j->mutex);
+			j->done.wait(lock, [&j](){
+				return j->remaining == 0;
+			});
+		}
+		
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_jobs.erase(it);
+		}
+		
+		if (j->error) {
+			std::rethrow_exception(j->error);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef threadPool_hpp
+#define threadPool_hpp
+
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cobalt {
+	//Runs the tasks of a job on worker threads and on the thread that submits it.
+	//Each thread taking part has its own queue of tasks, starting with a contiguous
+	//share of them, and steals from the others when it runs out.
+	class threadPool {
+		threadPool(const threadPool&) = delete;
+		void operator=(const threadPool&) = delete;
+	private:
+		struct job;
+		
+		std::vector<std::thread> _threads;
+		std::list<std::shared_ptr<job> > _jobs;
+		std::mutex _mutex;
+		std::condition_variable _work;
+		bool _stopping;
+		
+		void work(size_t slot);
+	public:
+		explicit threadPool(size_t threads);
+		~threadPool();
+		
+		//Pool shared by the process, with a worker for each hardware thread but one.
+		static threadPool& shared();
+		
+		//Number of threads that can run tasks of one job at once. They are told apart
+		//by a slot below this number.
+		size_t slots() const;
+		
+		//Runs task(index, slot) for every index below count and returns when all
+		//have run. Two tasks of the job never run at once with the same slot. If tasks
+		//throw, the exception of the lowest index is rethrown.
+		void run(size_t count, const std::function<void(size_t, size_t)>& task);
+	};
+}
+
+#endif /* threadPool_hpp */
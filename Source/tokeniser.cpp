@@ -29,7 +29,7 @@ namespace cobalt {
 			return character_type::punct;
 		}
 		
-		token fetch_word(push_back_stream& stream) {
+		token fetch_word(push_back_stream& stream, symbolTable& symbols) {
 			size_t lineNumber = stream.lineNumber();
 			size_t charIndex = stream.charIndex();
 
@@ -71,7 +71,7 @@ namespace cobalt {
 					}
 					return token(num, lineNumber, charIndex);
 				} else {
-					return token(identifier{std::move(word)}, lineNumber, charIndex);
+					return token(symbols.intern(std::move(word)), lineNumber, charIndex);
 				}
 			}
 		}
@@ -169,7 +169,7 @@ namespace cobalt {
 			throw parsingError("Expected closing '*/'", stream.lineNumber(), stream.charIndex());
 		}
 	
-		token tokenize(push_back_stream& stream) {
+		token tokenize(push_back_stream& stream, symbolTable& symbols) {
 			while (true) {
 				size_t lineNumber = stream.lineNumber();
 				size_t charIndex = stream.charIndex();
@@ -181,7 +181,7 @@ namespace cobalt {
 						continue;
 					case character_type::alphanum:
 						stream.push_back(c);
-						return fetch_word(stream);
+						return fetch_word(stream, symbols);
 					case character_type::punct:
 						switch (c) {
 							case '"':
@@ -210,10 +210,10 @@ namespace cobalt {
 		}
 	}
 	
-	tokensIterator::tokensIterator(push_back_stream& stream):
+	tokensIterator::tokensIterator(push_back_stream& stream, symbolTable& symbols):
 		_current(eof(), 0, 0),
-		_get_next_token([&stream](){
-			return tokenize(stream);
+		_get_next_token([&stream, &symbols](){
+			return tokenize(stream, symbols);
 		})
 	{
 		++(*this);
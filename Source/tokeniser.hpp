@@ -19,7 +19,7 @@ namespace cobalt {
 		std::function<token()> _get_next_token;
 		token _current;
 	public:
-		tokensIterator(push_back_stream& stream);
+		tokensIterator(push_back_stream& stream, symbolTable& symbols);
 		tokensIterator(std::deque<token>& tokens);
 		
 		const token& operator*() const;
@@ -99,15 +99,26 @@ namespace cobalt {
 			{"public", reservedToken::kw_public}
 		};
 		
+		//Keywords added after scripts could already use them as names. They are
+		//read as identifiers, which the parser takes for the keyword where it fits.
+		const lookup<std::string_view, reservedToken> contextual_keyword_token_map {
+			{"keysof", reservedToken::kw_keysof},
+			{"in", reservedToken::kw_in},
+			{"yield", reservedToken::kw_yield},
+		};
+		
 		const lookup<reservedToken, std::string_view> token_string_map = ([](){
 			std::vector<std::pair<reservedToken, std::string_view>> container;
-			container.reserve(operator_token_map.size() + keyword_token_map.size());
+			container.reserve(operator_token_map.size() + keyword_token_map.size() + contextual_keyword_token_map.size());
 			for (const auto& p : operator_token_map) {
 				container.emplace_back(p.second, p.first);
 			}
 			for (const auto& p : keyword_token_map) {
 				container.emplace_back(p.second, p.first);
 			}
+			for (const auto& p : contextual_keyword_token_map) {
+				container.emplace_back(p.second, p.first);
+			}
 			return lookup<reservedToken, std::string_view>(std::move(container));
 		})();
 	}
@@ -231,12 +242,42 @@ namespace cobalt {
 		return _value == value;
 	}
 	
+	bool token::isContextualKeyword(reservedToken keyword) const {
+		if (!isIdentifier()) {
+			return false;
+		}
+		auto it = contextual_keyword_token_map.find(getIdentifier().name);
+		return it != contextual_keyword_token_map.end() && it->second == keyword;
+	}
+	
 	bool operator==(const identifier& id1, const identifier& id2) {
-		return id1.name == id2.name;
+		return id1.id == id2.id;
 	}
 	
 	bool operator!=(const identifier& id1, const identifier& id2) {
-		return id1.name != id2.name;
+		return id1.id != id2.id;
+	}
+	
+	symbolTable::symbolTable() {
+	}
+	
+	identifier symbolTable::intern(std::string name) {
+		if (auto it = _ids.find(name); it != _ids.end()) {
+			return identifier{it->second, it->first};
+		}
+		
+		symbolId id = _names.size();
+		std::string_view view = _names.emplace_back(std::move(name));
+		_ids.emplace(view, id);
+		return identifier{id, view};
+	}
+	
+	std::string_view symbolTable::name(symbolId id) const {
+		return _names[id];
+	}
+	
+	size_t symbolTable::size() const {
+		return _names.size();
 	}
 	
 	bool operator==(const eof&, const eof&) {
@@ -266,7 +307,7 @@ namespace std {
 				return str;
 			},
 			[](const identifier& id) {
-				return id.name;
+				return std::string(id.name);
 			},
 			[](eof) {
 				return std::string("<EOF>");
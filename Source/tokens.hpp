@@ -2,9 +2,12 @@
 #define tokens_hpp
 
 #include <optional>
+#include <string>
 #include <string_view>
 #include <ostream>
 #include <variant>
+#include <deque>
+#include <unordered_map>
 
 namespace cobalt {
 	enum struct reservedToken {
@@ -71,6 +74,8 @@ namespace cobalt {
 		
 		kw_sizeof,
 		kw_tostring,
+		kw_keysof,
+		kw_in,
 		
 		kw_if,
 		kw_else,
@@ -87,6 +92,7 @@ namespace cobalt {
 		kw_break,
 		kw_continue,
 		kw_return,
+		kw_yield,
 
 		kw_function,
 		
@@ -105,8 +111,27 @@ namespace cobalt {
 	
 	std::optional<reservedToken> getOperator(push_back_stream& stream);
 	
+	using symbolId = size_t;
+	
 	struct identifier{
-		std::string name;
+		symbolId id;
+		std::string_view name;
+	};
+	
+	class symbolTable {
+		symbolTable(const symbolTable&) = delete;
+		void operator=(const symbolTable&) = delete;
+	private:
+		std::deque<std::string> _names;
+		std::unordered_map<std::string_view, symbolId> _ids;
+	public:
+		symbolTable();
+		
+		identifier intern(std::string name);
+		
+		std::string_view name(symbolId id) const;
+		
+		size_t size() const;
 	};
 	
 	bool operator==(const identifier& id1, const identifier& id2);
@@ -144,6 +169,9 @@ namespace cobalt {
 		size_t getCharIndex() const;
 
 		bool hasValue(const tokenValue& value) const;
+		
+		//Whether the token is an identifier spelled as the contextual keyword.
+		bool isContextualKeyword(reservedToken keyword) const;
 	};
 }
 
@@ -0,0 +1,1259 @@
+#include "transpiler.hpp"
+#include "compiler.hpp"
+#include "compilerContext.hpp"
+#include "errors.hpp"
+#include "expressionTree.hpp"
+#include "expressionTreeParser.hpp"
+#include "helpers.hpp"
+#include "incompleteFunction.hpp"
+#include "tokeniser.hpp"
+#include <cmath>
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cobalt {
+	namespace {
+		error unexpected_syntax(const tokensIterator& it) {
+			return unexpectedSyntaxError(std::to_string(it->getValue()), it->getLineNumber(), it->getCharIndex());
+		}
+		
+		error unsupported(const node_ptr& np, std::string_view what) {
+			return semanticError(std::string(what) + " is not supported by the transpiler", np->getLineNumber(), np->getCharIndex());
+		}
+		
+		std::string cpp_type(typeHandle t) {
+			return std::visit(overloaded{
+				[](simpleType st) -> std::string {
+					switch (st) {
+						case simpleType::number:
+							return "cobalt::number";
+						case simpleType::string:
+							return "cobalt::string";
+						default:
+							return "void";
+					}
+				},
+				[](const functionType&) -> std::string {
+					return "cobalt::function";
+				},
+				[](const dictionaryType&) -> std::string {
+					return "cobalt::dictionary";
+				},
+				[](const auto&) -> std::string {
+					return "cobalt::array";
+				}
+			}, *t);
+		}
+		
+		//Arrays, tuples and dictionaries are copied deeply, as in the interpreter.
+		bool is_container(typeHandle t) {
+			return !std::holds_alternative<simpleType>(*t) && !std::holds_alternative<functionType>(*t);
+		}
+		
+		std::string number_literal(double d) {
+			if (std::isnan(d)) {
+				return "std::numeric_limits<cobalt::number>::quiet_NaN()";
+			}
+			if (std::isinf(d)) {
+				return d > 0 ? "std::numeric_limits<cobalt::number>::infinity()" : "(-std::numeric_limits<cobalt::number>::infinity())";
+			}
+			
+			std::ostringstream s;
+			s << std::setprecision(17) << d;
+			std::string ret = s.str();
+			
+			if (ret.find_first_of(".e") == std::string::npos) {
+				ret += ".0";
+			}
+			
+			return d < 0 ? "(" + ret + ")" : ret;
+		}
+		
+		std::string string_literal(std::string_view str) {
+			std::string ret = "\"";
+			for (char c : str) {
+				switch (c) {
+					case '"':
+						ret += "\\\"";
+						break;
+					case '\\':
+						ret += "\\\\";
+						break;
+					case '\n':
+						ret += "\\n";
+						break;
+					case '\t':
+						ret += "\\t";
+						break;
+					default:
+						if (c >= ' ' && c <= '~') {
+							ret += c;
+						} else {
+							char escaped[8];
+							std::snprintf(escaped, sizeof(escaped), "\\%03o", unsigned(static_cast<unsigned char>(c)));
+							ret += escaped;
+						}
+						break;
+				}
+			}
+			ret += '"';
+			return ret;
+		}
+		
+		bool has_side_effects(const node_ptr& np) {
+			if (np->is_node_operation()) {
+				switch (np->getNodeOperation()) {
+					case nodeOperation::preinc:
+					case nodeOperation::predec:
+					case nodeOperation::postinc:
+					case nodeOperation::postdec:
+					case nodeOperation::assign:
+					case nodeOperation::add_assign:
+					case nodeOperation::sub_assign:
+					case nodeOperation::mul_assign:
+					case nodeOperation::div_assign:
+					case nodeOperation::idiv_assign:
+					case nodeOperation::mod_assign:
+					case nodeOperation::band_assign:
+					case nodeOperation::bor_assign:
+					case nodeOperation::bxor_assign:
+					case nodeOperation::bsl_assign:
+					case nodeOperation::bsr_assign:
+					case nodeOperation::concat_assign:
+					case nodeOperation::call:
+						return true;
+					default:
+						break;
+				}
+			}
+			for (const node_ptr& child : np->getChildren()) {
+				if (has_side_effects(child)) {
+					return true;
+				}
+			}
+			return false;
+		}
+		
+		std::string join(const std::vector<std::string>& strs) {
+			std::string ret;
+			for (const std::string& s : strs) {
+				if (!ret.empty()) {
+					ret += ", ";
+				}
+				ret += s;
+			}
+			return ret;
+		}
+		
+		//String literals are constants shared by all the generated functions.
+		class stringPool {
+		private:
+			std::unordered_map<std::string, size_t> _indices;
+			std::vector<const std::string*> _strings;
+		public:
+			std::string name(const std::string& str) {
+				auto it = _indices.emplace(str, _indices.size()).first;
+				if (it->second == _strings.size()) {
+					_strings.push_back(&it->first);
+				}
+				return "s_" + std::to_string(it->second);
+			}
+			
+			void write(std::ostream& out) const {
+				for (size_t i = 0; i < _strings.size(); ++i) {
+					out << "\tconst cobalt::string s_" << i << " = std::make_shared<std::string>("
+					    << string_literal(*_strings[i]) << ", " << _strings[i]->size() << ");\n";
+				}
+				if (!_strings.empty()) {
+					out << "\n";
+				}
+			}
+		};
+		
+		std::string parameter_type(const functionType::param& param) {
+			if (param.by_ref) {
+				return "std::shared_ptr<cobalt::variableImpl<" + cpp_type(param.typeID) + "> >";
+			}
+			return cpp_type(param.typeID);
+		}
+		
+		//Script functions become C++ functions that take and return values, which
+		//they call directly. Their local variables are C++ variables of the value
+		//types, except for the ones passed by reference somewhere, which need a
+		//variable to refer to. Those are only known once the whole body is read,
+		//so functions are translated twice, the second time boxing the locals that
+		//the first one found.
+		class functionTranspiler {
+		private:
+			struct localInfo {
+				std::string name;
+				size_t ordinal;
+				bool boxed;
+			};
+			
+			struct breakTarget {
+				size_t id;
+				bool loop;
+				bool used;
+			};
+			
+			compilerContext& _ctx;
+			stringPool& _strings;
+			const std::unordered_set<size_t>& _boxed;
+			std::unordered_set<size_t> _referenced;
+			std::unordered_map<const identifierInfo*, localInfo> _locals;
+			std::vector<breakTarget> _targets;
+			std::ostringstream _out;
+			int _indent;
+			size_t _declarations;
+			size_t _labels;
+			size_t _externals;
+			size_t _index;
+			std::vector<std::string> _params;
+			bool _tail;
+			typeHandle _return_type_id;
+			
+			void line(const std::string& str) {
+				_out << std::string(_indent, '\t') << str << '\n';
+			}
+			
+			const identifierInfo* find(const node_ptr& np) const {
+				return _ctx.find(std::get<identifier>(np->getValue()).id);
+			}
+			
+			std::string default_value(typeHandle t) {
+				return std::visit(overloaded{
+					[](simpleType st) -> std::string {
+						return st == simpleType::string ? "cobalt::native::defaultValue<cobalt::string>()" : "0.0";
+					},
+					[&](const tupleType& tt) -> std::string {
+						std::vector<std::string> elements;
+						for (typeHandle it : tt.inner_type_id) {
+							elements.push_back("cobalt::native::box<" + cpp_type(it) + ">(" + default_value(it) + ")");
+						}
+						return "cobalt::array{" + join(elements) + "}";
+					},
+					[&](const auto&) -> std::string {
+						return cpp_type(t) + "()";
+					}
+				}, *t);
+			}
+			
+			//Reads a value that is used without being stored, so containers are not copied.
+			std::string operand(const node_ptr& np) {
+				return np->is_lvalue() ? reference(np) : value(np);
+			}
+			
+			std::string comma(const node_ptr& np, const std::string& last) {
+				std::string ret = "(";
+				for (size_t i = 0; i + 1 < np->getChildren().size(); ++i) {
+					ret += "(void)(" + discard(np->getChildren()[i]) + "), ";
+				}
+				return ret + last + ")";
+			}
+			
+			//Operands of built-in operators that both change and read a variable are
+			//undefined behavior, so they are passed to a function instead.
+			std::string binary(const node_ptr& np, const char* op, const char* name) {
+				if (has_side_effects(np)) {
+					return helper(np, name);
+				}
+				return "(" + value(np->getChildren()[0]) + " " + op + " " + value(np->getChildren()[1]) + ")";
+			}
+			
+			std::string helper(const node_ptr& np, const char* name) {
+				const node_ptr& c1 = np->getChildren()[0];
+				const node_ptr& c2 = np->getChildren()[1];
+				return ordered(np, c1->getTypeID(), value(c1), [&](const std::string& first) {
+					return std::string("cobalt::native::") + name + "(" + first + ", " + value(c2) + ")";
+				});
+			}
+			
+			std::string comparison(const node_ptr& np, const char* name) {
+				const node_ptr& c1 = np->getChildren()[0];
+				const node_ptr& c2 = np->getChildren()[1];
+				if (c1->getTypeID() == typeRegistry::getNumberHandle() && c2->getTypeID() == typeRegistry::getNumberHandle()) {
+					return ordered(np, c1->getTypeID(), value(c1), [&](const std::string& first) {
+						return std::string("cobalt::native::") + name + "(" + first + ", " + value(c2) + ")";
+					});
+				}
+				typeHandle t = typeRegistry::getStringHandle();
+				return ordered(np, t, convert(c1, t), [&](const std::string& first) {
+					return std::string("cobalt::native::") + name + "(" + first + ", " + convert(c2, t) + ")";
+				});
+			}
+			
+			std::string compound_assign(const node_ptr& np, const char* op) {
+				return "(" + reference(np->getChildren()[0]) + " " + op + " " + value(np->getChildren()[1]) + ")";
+			}
+			
+			std::string compound_helper(const node_ptr& np, const char* name) {
+				return std::string("cobalt::native::") + name + "(" + reference(np->getChildren()[0]) + ", " + value(np->getChildren()[1]) + ")";
+			}
+			
+			//The variable holding the element, from an expression of the container.
+			std::string element(const node_ptr& np, const std::string& container) {
+				const node_ptr& key = np->getChildren()[1];
+				typeHandle t = np->getChildren()[0]->getTypeID();
+				std::string T = cpp_type(np->getTypeID());
+				
+				if (std::holds_alternative<arrayType>(*t)) {
+					return "cobalt::native::element<" + T + ">(" + container + ", " + convert(key, typeRegistry::getNumberHandle()) + ")";
+				} else if (std::holds_alternative<tupleType>(*t)) {
+					return container + "[" + std::to_string(size_t(key->getNumber())) + "]";
+				} else {
+					return "cobalt::native::entry<" + T + ">(" + container + ", " + convert(key, std::get<dictionaryType>(*t).key_type_id) + ")";
+				}
+			}
+			
+			std::string call_function(const node_ptr& np) {
+				const node_ptr& f = np->getChildren()[0];
+				if (f->isIdentifier() && find(f)->getScope() == identifierScope::function) {
+					return "ctx.get_function(" + std::to_string(find(f)->index()) + ")";
+				}
+				return operand(f);
+			}
+			
+			std::string call_arguments(const node_ptr& np) {
+				const functionType* ft = std::get_if<functionType>(np->getChildren()[0]->getTypeID());
+				
+				std::vector<std::string> arguments;
+				for (size_t i = 1; i < np->getChildren().size(); ++i) {
+					const node_ptr& child = np->getChildren()[i];
+					if (child->is_node_operation() && child->getNodeOperation() == nodeOperation::param) {
+						typeHandle t = ft->param_type_id[i-1].typeID;
+						arguments.push_back("cobalt::native::box<" + cpp_type(t) + ">(" + convert(child->getChildren()[0], t) + ")");
+					} else {
+						arguments.push_back(box(child));
+					}
+				}
+				return "{" + join(arguments) + "}";
+			}
+			
+			//The function of the module that a call runs by its name, if any.
+			const identifier* direct_callee(const node_ptr& np) const {
+				const node_ptr& f = np->getChildren()[0];
+				if (f->isIdentifier()) {
+					const identifierInfo* info = find(f);
+					if (info->getScope() == identifierScope::function && info->index() >= _externals) {
+						return &std::get<identifier>(f->getValue());
+					}
+				}
+				return nullptr;
+			}
+			
+			//Types and expressions of the arguments of a direct call: values, or variables
+			//for the ones passed by reference.
+			std::vector<std::pair<std::string, std::string> > direct_arguments(const node_ptr& np) {
+				const functionType* ft = std::get_if<functionType>(np->getChildren()[0]->getTypeID());
+				
+				std::vector<std::pair<std::string, std::string> > arguments;
+				for (size_t i = 1; i < np->getChildren().size(); ++i) {
+					const node_ptr& child = np->getChildren()[i];
+					const functionType::param& param = ft->param_type_id[i-1];
+					if (child->is_node_operation() && child->getNodeOperation() == nodeOperation::param) {
+						arguments.emplace_back(parameter_type(param), convert(child->getChildren()[0], param.typeID));
+					} else if (child->isIdentifier() && find(child)->getScope() == identifierScope::local_variable) {
+						arguments.emplace_back(parameter_type(param), box(child));
+					} else {
+						arguments.emplace_back(parameter_type(param), "cobalt::native::ref<" + cpp_type(param.typeID) + ">(" + box(child) + ")");
+					}
+				}
+				return arguments;
+			}
+			
+			//Arguments of C++ calls are not evaluated from left to right, as they are
+			//for script calls, so they are stored first if the order can matter.
+			std::string direct_call(const node_ptr& np) {
+				std::string f = "n_" + std::string(direct_callee(np)->name);
+				std::vector<std::pair<std::string, std::string> > arguments = direct_arguments(np);
+				
+				bool ordered = false;
+				for (size_t i = 1; i < np->getChildren().size(); ++i) {
+					ordered = ordered || (arguments.size() > 1 && has_side_effects(np->getChildren()[i]));
+				}
+				
+				std::vector<std::string> expressions{"ctx"};
+				std::string stores;
+				
+				for (size_t i = 0; i < arguments.size(); ++i) {
+					if (ordered) {
+						stores += arguments[i].first + " t" + std::to_string(i) + " = " + arguments[i].second + "; ";
+						expressions.push_back("std::move(t" + std::to_string(i) + ")");
+					} else {
+						expressions.push_back(arguments[i].second);
+					}
+				}
+				
+				if (ordered) {
+					return "[&]() { " + stores + "return " + f + "(" + join(expressions) + "); }()";
+				}
+				return f + "(" + join(expressions) + ")";
+			}
+			
+			std::string call(const node_ptr& np) {
+				if (direct_callee(np)) {
+					return direct_call(np);
+				}
+				return "ctx.call(" + call_function(np) + ", " + call_arguments(np) + ")";
+			}
+			
+			//The interpreter evaluates operands from left to right. C++ does not, so the
+			//first one is stored first if the order can matter.
+			std::string ordered(
+				const node_ptr& np,
+				typeHandle t,
+				const std::string& first,
+				const std::function<std::string(const std::string&)>& rest
+			) {
+				if (!has_side_effects(np)) {
+					return rest(first);
+				}
+				return "[&]() { " + cpp_type(t) + " t = " + first + "; return " + rest("t") + "; }()";
+			}
+			
+			//Expression of type cpp_type(np->getTypeID()), a copy of the value for lvalues.
+			std::string value(const node_ptr& np) {
+				typeHandle t = np->getTypeID();
+				
+				if (np->is_lvalue()) {
+					if (is_container(t)) {
+						return "cobalt::cloneVariableValue(" + reference(np) + ")";
+					}
+					return cpp_type(t) + "(" + reference(np) + ")";
+				}
+				
+				return std::visit(overloaded{
+					[&](const std::string& str) {
+						return _strings.name(str);
+					},
+					[&](double d) {
+						return number_literal(d);
+					},
+					[&](const identifier&) {
+						return "cobalt::function(ctx.get_function(" + std::to_string(find(np)->index()) + "))";
+					},
+					[&](const lambda_ptr&) -> std::string {
+						throw unsupported(np, "Lambda");
+					},
+					[&](nodeOperation op) {
+						const std::vector<node_ptr>& children = np->getChildren();
+						switch (op) {
+							case nodeOperation::param:
+								return value(children[0]);
+							case nodeOperation::postinc:
+								return "(" + reference(children[0]) + "++)";
+							case nodeOperation::postdec:
+								return "(" + reference(children[0]) + "--)";
+							case nodeOperation::positive:
+								return "(+" + value(children[0]) + ")";
+							case nodeOperation::negative:
+								return "(-" + value(children[0]) + ")";
+							case nodeOperation::bnot:
+								return "cobalt::number(~int(" + value(children[0]) + "))";
+							case nodeOperation::lnot:
+								return "cobalt::number(!" + value(children[0]) + ")";
+							case nodeOperation::size:
+								if (
+									std::holds_alternative<arrayType>(*children[0]->getTypeID()) ||
+									std::holds_alternative<dictionaryType>(*children[0]->getTypeID())
+								) {
+									return "cobalt::number(" + operand(children[0]) + ".size())";
+								}
+								return std::string("cobalt::number(1)");
+							case nodeOperation::tostring:
+								return "cobalt::convertToString(" + operand(children[0]) + ")";
+							case nodeOperation::keys:
+								return "cobalt::native::keys(" + operand(children[0]) + ")";
+							case nodeOperation::add:
+								return binary(np, "+", "add");
+							case nodeOperation::sub:
+								return binary(np, "-", "sub");
+							case nodeOperation::mul:
+								return binary(np, "*", "mul");
+							case nodeOperation::div:
+								return binary(np, "/", "div");
+							case nodeOperation::idiv:
+								return helper(np, "idiv");
+							case nodeOperation::mod:
+								return helper(np, "mod");
+							case nodeOperation::band:
+								return helper(np, "band");
+							case nodeOperation::bor:
+								return helper(np, "bor");
+							case nodeOperation::bxor:
+								return helper(np, "bxor");
+							case nodeOperation::bsl:
+								return helper(np, "bsl");
+							case nodeOperation::bsr:
+								return helper(np, "bsr");
+							case nodeOperation::concat:
+								return ordered(np, typeRegistry::getStringHandle(), convert(children[0], typeRegistry::getStringHandle()), [&](const std::string& first) {
+									return "cobalt::native::append(" + first + ", " + convert(children[1], typeRegistry::getStringHandle()) + ")";
+								});
+							case nodeOperation::eq:
+								return comparison(np, "eq");
+							case nodeOperation::ne:
+								return comparison(np, "ne");
+							case nodeOperation::lt:
+								return comparison(np, "lt");
+							case nodeOperation::gt:
+								return comparison(np, "gt");
+							case nodeOperation::le:
+								return comparison(np, "le");
+							case nodeOperation::ge:
+								return comparison(np, "ge");
+							case nodeOperation::contains:
+								return "cobalt::native::contains(" +
+									convert(children[0], std::get<dictionaryType>(*children[1]->getTypeID()).key_type_id) + ", " +
+									operand(children[1]) + ")";
+							case nodeOperation::comma:
+								return comma(np, value(children.back()));
+							case nodeOperation::land:
+								return "cobalt::number(" + value(children[0]) + " && " + value(children[1]) + ")";
+							case nodeOperation::lor:
+								return "cobalt::number(" + value(children[0]) + " || " + value(children[1]) + ")";
+							case nodeOperation::index:
+								return cpp_type(t) + "(cobalt::native::value<" + cpp_type(t) + ">(" + element(np, value(children[0])) + "))";
+							case nodeOperation::ternary:
+								return "(" + value(children[0]) + " ? " + convert(children[1], t) + " : " + convert(children[2], t) + ")";
+							case nodeOperation::call:
+								if (direct_callee(np)) {
+									return direct_call(np);
+								}
+								return "cobalt::native::unbox<" + cpp_type(t) + ">(" + call(np) + ")";
+							case nodeOperation::init:
+								{
+									std::vector<std::string> elements;
+									for (const node_ptr& child : children) {
+										elements.push_back("cobalt::native::box<" + cpp_type(child->getTypeID()) + ">(" + value(child) + ")");
+									}
+									return "cobalt::array{" + join(elements) + "}";
+								}
+							default:
+								throw unsupported(np, "Expression");
+						}
+					}
+				}, np->getValue());
+			}
+			
+			//C++ lvalue of type cpp_type(np->getTypeID()) that np refers to.
+			std::string reference(const node_ptr& np) {
+				if (np->isIdentifier()) {
+					const identifierInfo* info = find(np);
+					if (info->getScope() == identifierScope::global_variable) {
+						return "cobalt::native::value<" + cpp_type(info->typeID()) + ">(ctx.global(" + std::to_string(info->index()) + "))";
+					}
+					const localInfo& local = _locals.at(info);
+					return local.boxed ? local.name + "->value" : local.name;
+				}
+				
+				const std::vector<node_ptr>& children = np->getChildren();
+				
+				switch (np->getNodeOperation()) {
+					case nodeOperation::preinc:
+						return "(++" + reference(children[0]) + ")";
+					case nodeOperation::predec:
+						return "(--" + reference(children[0]) + ")";
+					case nodeOperation::assign:
+						return "(" + reference(children[0]) + " = " + convert(children[1], np->getTypeID()) + ")";
+					case nodeOperation::add_assign:
+						return compound_assign(np, "+=");
+					case nodeOperation::sub_assign:
+						return compound_assign(np, "-=");
+					case nodeOperation::mul_assign:
+						return compound_assign(np, "*=");
+					case nodeOperation::div_assign:
+						return compound_assign(np, "/=");
+					case nodeOperation::idiv_assign:
+						return compound_helper(np, "idiv_assign");
+					case nodeOperation::mod_assign:
+						return compound_helper(np, "mod_assign");
+					case nodeOperation::band_assign:
+						return compound_helper(np, "band_assign");
+					case nodeOperation::bor_assign:
+						return compound_helper(np, "bor_assign");
+					case nodeOperation::bxor_assign:
+						return compound_helper(np, "bxor_assign");
+					case nodeOperation::bsl_assign:
+						return compound_helper(np, "bsl_assign");
+					case nodeOperation::bsr_assign:
+						return compound_helper(np, "bsr_assign");
+					case nodeOperation::concat_assign:
+						return "cobalt::native::append_assign(" +
+							reference(children[0]) + ", " + convert(children[1], typeRegistry::getStringHandle()) + ")";
+					case nodeOperation::comma:
+						return comma(np, reference(children.back()));
+					case nodeOperation::index:
+						return "cobalt::native::value<" + cpp_type(np->getTypeID()) + ">(" + element(np, reference(children[0])) + ")";
+					case nodeOperation::ternary:
+						return "(" + value(children[0]) + " ? " + reference(children[1]) + " : " + reference(children[2]) + ")";
+					default:
+						throw unsupported(np, "Expression");
+				}
+			}
+			
+			//Variable that np refers to, for passing it by reference.
+			std::string box(const node_ptr& np) {
+				if (np->isIdentifier()) {
+					const identifierInfo* info = find(np);
+					if (info->getScope() == identifierScope::global_variable) {
+						return "ctx.global(" + std::to_string(info->index()) + ")";
+					}
+					const localInfo& local = _locals.at(info);
+					if (!local.boxed) {
+						_referenced.insert(local.ordinal);
+					}
+					return local.name;
+				}
+				
+				const std::vector<node_ptr>& children = np->getChildren();
+				
+				switch (np->getNodeOperation()) {
+					case nodeOperation::preinc:
+					case nodeOperation::predec:
+					case nodeOperation::assign:
+					case nodeOperation::add_assign:
+					case nodeOperation::sub_assign:
+					case nodeOperation::mul_assign:
+					case nodeOperation::div_assign:
+					case nodeOperation::idiv_assign:
+					case nodeOperation::mod_assign:
+					case nodeOperation::band_assign:
+					case nodeOperation::bor_assign:
+					case nodeOperation::bxor_assign:
+					case nodeOperation::bsl_assign:
+					case nodeOperation::bsr_assign:
+					case nodeOperation::concat_assign:
+						if (!children[0]->isIdentifier()) {
+							throw unsupported(np, "Passing an assignment to an element by reference");
+						}
+						return "((void)(" + reference(np) + "), cobalt::variablePtr(" + box(children[0]) + "))";
+					case nodeOperation::comma:
+						return comma(np, "cobalt::variablePtr(" + box(children.back()) + ")");
+					case nodeOperation::index:
+						return element(np, reference(children[0]));
+					case nodeOperation::ternary:
+						return "(" + value(children[0]) + " ? cobalt::variablePtr(" + box(children[1]) + ") : cobalt::variablePtr(" + box(children[2]) + "))";
+					default:
+						throw unsupported(np, "Expression");
+				}
+			}
+			
+			//Expression of type cpp_type(t), for initializing a variable of type t.
+			std::string convert(const node_ptr& np, typeHandle t) {
+				if (t == typeRegistry::getVoidHandle()) {
+					return discard(np);
+				}
+				
+				if (np->getTypeID() == t) {
+					return value(np);
+				}
+				
+				if (std::holds_alternative<initListType>(*np->getTypeID())) {
+					const std::vector<node_ptr>& children = np->getChildren();
+					switch (np->getNodeOperation()) {
+						case nodeOperation::init:
+							{
+								std::vector<std::string> elements;
+								for (size_t i = 0; i < children.size(); ++i) {
+									typeHandle et = std::holds_alternative<arrayType>(*t) ?
+										std::get<arrayType>(*t).inner_type_id :
+										std::get<tupleType>(*t).inner_type_id[i];
+									elements.push_back("cobalt::native::box<" + cpp_type(et) + ">(" + convert(children[i], et) + ")");
+								}
+								return "cobalt::array{" + join(elements) + "}";
+							}
+						case nodeOperation::param:
+							return convert(children[0], t);
+						case nodeOperation::comma:
+							return comma(np, convert(children.back(), t));
+						case nodeOperation::ternary:
+							return "(" + value(children[0]) + " ? " + convert(children[1], t) + " : " + convert(children[2], t) + ")";
+						default:
+							throw unsupported(np, "Expression");
+					}
+				}
+				
+				if (np->getTypeID() == typeRegistry::getNumberHandle() && t == typeRegistry::getStringHandle()) {
+					return "cobalt::convertToString(" + value(np) + ")";
+				}
+				
+				throw wrongTypeError(std::to_string(np->getTypeID()), std::to_string(t), false, np->getLineNumber(), np->getCharIndex());
+			}
+			
+			//Expression evaluated only for its side effects.
+			std::string discard(const node_ptr& np) {
+				if (np->is_node_operation()) {
+					const std::vector<node_ptr>& children = np->getChildren();
+					switch (np->getNodeOperation()) {
+						case nodeOperation::call:
+							return call(np);
+						case nodeOperation::comma:
+							return comma(np, discard(children.back()));
+						case nodeOperation::ternary:
+							return "(" + value(children[0]) + " ? (void)(" + discard(children[1]) + ") : (void)(" + discard(children[2]) + "))";
+						default:
+							break;
+					}
+				}
+				return operand(np);
+			}
+			
+			void expression_statement(const node_ptr& np) {
+				if (!np) {
+					return;
+				}
+				if (np->is_node_operation() && np->getNodeOperation() != nodeOperation::comma) {
+					line(discard(np) + ";");
+				} else {
+					line("(void)(" + discard(np) + ");");
+				}
+			}
+			
+			std::string declare(const identifierInfo* info, std::string_view name) {
+				size_t ordinal = _declarations++;
+				std::string cpp_name = name.empty() || name[0] == '@' ? "v_" : "v_" + std::string(name) + "_";
+				cpp_name += std::to_string(ordinal);
+				_locals[info] = localInfo{cpp_name, ordinal, _boxed.count(ordinal) > 0};
+				return cpp_name;
+			}
+			
+			void declaration(tokensIterator& it) {
+				parseVariableDeclaration(_ctx, it, [&](typeHandle t, const identifier& name, bool initialized) {
+					std::string init = initialized ? convert(parseExpressionTree(_ctx, it, t, false), t) : default_value(t);
+					
+					const identifierInfo* info = _ctx.createIdentifier(name.id, t);
+					std::string cpp_name = declare(info, name.name);
+					
+					if (_locals[info].boxed) {
+						line("auto " + cpp_name + " = cobalt::native::box<" + cpp_type(t) + ">(" + init + ");");
+					} else {
+						line(cpp_type(t) + " " + cpp_name + " = " + init + ";");
+					}
+				});
+			}
+			
+			void label(const breakTarget& target) {
+				if (target.used) {
+					line("brk_" + std::to_string(target.id) + ":;");
+				}
+			}
+			
+			void statement(tokensIterator& it, bool in_switch) {
+				if (it->isReservedToken()) {
+					switch (it->getReservedToken()) {
+						case reservedToken::kw_for:
+							return for_statement(it);
+						case reservedToken::kw_while:
+							return while_statement(it);
+						case reservedToken::kw_do:
+							return do_statement(it);
+						case reservedToken::kw_if:
+							return if_statement(it);
+						case reservedToken::kw_switch:
+							return switch_statement(it);
+						case reservedToken::kw_break:
+							return break_statement(it);
+						case reservedToken::kw_continue:
+							return continue_statement(it);
+						case reservedToken::kw_return:
+							return return_statement(it);
+						default:
+							break;
+					}
+				}
+				
+				if (isTypename(it)) {
+					if (in_switch) {
+						throw syntaxError("Declarations in switch block are not allowed", it->getLineNumber(), it->getCharIndex());
+					}
+					declaration(it);
+					parseTokenValue(_ctx, it, reservedToken::semicolon);
+					return;
+				}
+				
+				if (it->hasValue(reservedToken::open_curly)) {
+					return block(it);
+				}
+				
+				expression_statement(parseExpressionTree(_ctx, it, typeRegistry::getVoidHandle(), true));
+				parseTokenValue(_ctx, it, reservedToken::semicolon);
+			}
+			
+			void loop_body(tokensIterator& it) {
+				_targets.push_back(breakTarget{_labels++, true, false});
+				block(it);
+			}
+			
+			void for_statement(tokensIterator& it) {
+				auto _ = _ctx.scope();
+				
+				parseTokenValue(_ctx, it, reservedToken::kw_for);
+				parseTokenValue(_ctx, it, reservedToken::open_round);
+				
+				line("{");
+				++_indent;
+				
+				if (isTypename(it)) {
+					declaration(it);
+					if (it->isContextualKeyword(reservedToken::kw_in)) {
+						throw syntaxError("Generators are not supported by the transpiler", it->getLineNumber(), it->getCharIndex());
+					}
+				} else {
+					expression_statement(parseExpressionTree(_ctx, it, typeRegistry::getVoidHandle(), true));
+				}
+				parseTokenValue(_ctx, it, reservedToken::semicolon);
+				
+				std::string cond = value(parseExpressionTree(_ctx, it, typeRegistry::getNumberHandle(), true));
+				parseTokenValue(_ctx, it, reservedToken::semicolon);
+				
+				node_ptr step = parseExpressionTree(_ctx, it, typeRegistry::getVoidHandle(), true);
+				parseTokenValue(_ctx, it, reservedToken::close_round);
+				
+				line("for (; " + cond + "; " + (step ? discard(step) : std::string()) + ")");
+				loop_body(it);
+				label(_targets.back());
+				_targets.pop_back();
+				
+				--_indent;
+				line("}");
+			}
+			
+			void while_statement(tokensIterator& it) {
+				auto _ = _ctx.scope();
+				
+				parseTokenValue(_ctx, it, reservedToken::kw_while);
+				
+				parseTokenValue(_ctx, it, reservedToken::open_round);
+				std::string cond = value(parseExpressionTree(_ctx, it, typeRegistry::getNumberHandle(), true));
+				parseTokenValue(_ctx, it, reservedToken::close_round);
+				
+				line("while (" + cond + ")");
+				loop_body(it);
+				label(_targets.back());
+				_targets.pop_back();
+			}
+			
+			void do_statement(tokensIterator& it) {
+				parseTokenValue(_ctx, it, reservedToken::kw_do);
+				
+				line("do");
+				loop_body(it);
+				
+				parseTokenValue(_ctx, it, reservedToken::kw_while);
+				
+				parseTokenValue(_ctx, it, reservedToken::open_round);
+				line("while (" + value(parseExpressionTree(_ctx, it, typeRegistry::getNumberHandle(), true)) + ");");
+				parseTokenValue(_ctx, it, reservedToken::close_round);
+				
+				label(_targets.back());
+				_targets.pop_back();
+			}
+			
+			void if_statement(tokensIterator& it) {
+				auto _ = _ctx.scope();
+				parseTokenValue(_ctx, it, reservedToken::kw_if);
+				
+				parseTokenValue(_ctx, it, reservedToken::open_round);
+				
+				bool decls = isTypename(it);
+				
+				if (decls) {
+					line("{");
+					++_indent;
+					declaration(it);
+					parseTokenValue(_ctx, it, reservedToken::semicolon);
+				}
+				
+				line("if (" + value(parseExpressionTree(_ctx, it, typeRegistry::getNumberHandle(), true)) + ")");
+				parseTokenValue(_ctx, it, reservedToken::close_round);
+				block(it);
+				
+				while (it->hasValue(reservedToken::kw_elif)) {
+					++it;
+					parseTokenValue(_ctx, it, reservedToken::open_round);
+					line("else if (" + value(parseExpressionTree(_ctx, it, typeRegistry::getNumberHandle(), true)) + ")");
+					parseTokenValue(_ctx, it, reservedToken::close_round);
+					block(it);
+				}
+				
+				if (it->hasValue(reservedToken::kw_else)) {
+					++it;
+					line("else");
+					block(it);
+				}
+				
+				if (decls) {
+					--_indent;
+					line("}");
+				}
+			}
+			
+			//Cases become labels that a chain of comparisons jumps to, and break out of
+			//the switch a jump past its end.
+			void switch_statement(tokensIterator& it) {
+				auto _ = _ctx.scope();
+				parseTokenValue(_ctx, it, reservedToken::kw_switch);
+				
+				parseTokenValue(_ctx, it, reservedToken::open_round);
+				
+				line("{");
+				++_indent;
+				
+				if (isTypename(it)) {
+					declaration(it);
+					parseTokenValue(_ctx, it, reservedToken::semicolon);
+				}
+				
+				size_t id = _labels++;
+				std::string prefix = "case_" + std::to_string(id) + "_";
+				
+				line("const cobalt::number sw_" + std::to_string(id) + " = " +
+					value(parseExpressionTree(_ctx, it, typeRegistry::getNumberHandle(), true)) + ";");
+				parseTokenValue(_ctx, it, reservedToken::close_round);
+				
+				std::vector<std::pair<number, size_t> > cases;
+				std::unordered_set<number> labels;
+				size_t dflt = size_t(-1);
+				size_t next_label = 0;
+				
+				std::ostringstream body;
+				_out.swap(body);
+				_targets.push_back(breakTarget{id, false, false});
+				
+				parseTokenValue(_ctx, it, reservedToken::open_curly);
+				
+				while (!it->hasValue(reservedToken::close_curly)) {
+					if (isSwitchLabel(it)) {
+						if (std::optional<number> label = parseSwitchLabel(_ctx, it)) {
+							if (labels.insert(*label).second) {
+								cases.emplace_back(*label, next_label);
+								line(prefix + std::to_string(next_label++) + ":;");
+							}
+						} else {
+							dflt = next_label;
+							line(prefix + std::to_string(next_label++) + ":;");
+						}
+					} else {
+						statement(it, true);
+					}
+				}
+				
+				++it;
+				
+				_out.swap(body);
+				
+				for (const std::pair<number, size_t>& c : cases) {
+					line(
+						"if (sw_" + std::to_string(id) + " == " + number_literal(c.first) + ") goto " +
+						prefix + std::to_string(c.second) + ";"
+					);
+				}
+				
+				if (dflt == size_t(-1)) {
+					_targets.back().used = true;
+					line("goto brk_" + std::to_string(id) + ";");
+				} else {
+					line("goto " + prefix + std::to_string(dflt) + ";");
+				}
+				
+				_out << body.str();
+				
+				label(_targets.back());
+				_targets.pop_back();
+				
+				--_indent;
+				line("}");
+			}
+			
+			void break_statement(tokensIterator& it) {
+				size_t breakLevel = parseBreakStatement(_ctx, it, _targets.size());
+				
+				breakTarget& target = _targets[_targets.size() - breakLevel];
+				
+				if (breakLevel == 1 && target.loop) {
+					line("break;");
+				} else {
+					target.used = true;
+					line("goto brk_" + std::to_string(target.id) + ";");
+				}
+			}
+			
+			void continue_statement(tokensIterator& it) {
+				bool in_loop = false;
+				for (const breakTarget& target : _targets) {
+					in_loop = in_loop || target.loop;
+				}
+				
+				if (!in_loop) {
+					throw unexpected_syntax(it);
+				}
+				
+				parseTokenValue(_ctx, it, reservedToken::kw_continue);
+				parseTokenValue(_ctx, it, reservedToken::semicolon);
+				
+				line("continue;");
+			}
+			
+			//A call of the function itself, returning exactly its return type, replaces
+			//the parameters and starts over, so it runs in constant stack space as in the
+			//interpreter.
+			void return_statement(tokensIterator& it) {
+				parseTokenValue(_ctx, it, reservedToken::kw_return);
+				
+				if (_return_type_id == typeRegistry::getVoidHandle()) {
+					parseTokenValue(_ctx, it, reservedToken::semicolon);
+					line("return;");
+					return;
+				}
+				
+				node_ptr np = parseExpressionTree(_ctx, it, _return_type_id, true);
+				parseTokenValue(_ctx, it, reservedToken::semicolon);
+				
+				if (
+					np->is_node_operation() &&
+					np->getNodeOperation() == nodeOperation::call &&
+					np->getTypeID() == _return_type_id &&
+					direct_callee(np) &&
+					find(np->getChildren()[0])->index() == _index
+				) {
+					std::vector<std::pair<std::string, std::string> > arguments = direct_arguments(np);
+					line("{");
+					++_indent;
+					for (size_t i = 0; i < arguments.size(); ++i) {
+						line(arguments[i].first + " t" + std::to_string(i) + " = " + arguments[i].second + ";");
+					}
+					for (size_t i = 0; i < arguments.size(); ++i) {
+						line(_params[i] + " = std::move(t" + std::to_string(i) + ");");
+					}
+					line("goto tail;");
+					--_indent;
+					line("}");
+					_tail = true;
+				} else {
+					line("return " + convert(np, _return_type_id) + ";");
+				}
+			}
+			
+			void block_contents(tokensIterator& it) {
+				if (it->hasValue(reservedToken::open_curly)) {
+					parseTokenValue(_ctx, it, reservedToken::open_curly);
+					
+					while (!it->hasValue(reservedToken::close_curly)) {
+						statement(it, false);
+					}
+					
+					parseTokenValue(_ctx, it, reservedToken::close_curly);
+				} else {
+					statement(it, false);
+				}
+			}
+			
+			void block(tokensIterator& it) {
+				auto _ = _ctx.scope();
+				line("{");
+				++_indent;
+				block_contents(it);
+				--_indent;
+				line("}");
+			}
+		public:
+			functionTranspiler(
+				compilerContext& ctx,
+				stringPool& strings,
+				const std::unordered_set<size_t>& boxed,
+				size_t externals
+			):
+				_ctx(ctx),
+				_strings(strings),
+				_boxed(boxed),
+				_indent(2),
+				_declarations(0),
+				_labels(0),
+				_externals(externals),
+				_index(0),
+				_tail(false),
+				_return_type_id(nullptr)
+			{
+			}
+			
+			//Definition of the function, named n_<name>, that takes the runtime context
+			//and the parameters.
+			std::string transpile(const incompleteFunction& f) {
+				auto _ = _ctx.function();
+				
+				const functionDeclaration& decl = f.getDecl();
+				const functionType* ft = std::get_if<functionType>(decl.typeID);
+				_return_type_id = ft->return_type_id;
+				_index = _ctx.find(decl.name.id)->index();
+				
+				std::vector<std::string> params{"cobalt::runtimeContext& ctx"};
+				
+				for (int i = 0; i < int(decl.params.size()); ++i) {
+					const functionType::param& param = ft->param_type_id[i];
+					const identifierInfo* info = _ctx.createParam(decl.params[i].id, param.typeID, param.by_ref);
+					std::string cpp_name = declare(info, decl.params[i].name);
+					
+					if (param.by_ref) {
+						_locals[info].boxed = true;
+						_params.push_back(cpp_name);
+					} else if (_locals[info].boxed) {
+						_params.push_back("a_" + std::to_string(i));
+						line("auto " + cpp_name + " = cobalt::native::box<" + cpp_type(param.typeID) + ">(std::move(" + _params.back() + "));");
+					} else {
+						_params.push_back(cpp_name);
+					}
+					
+					params.push_back(parameter_type(param) + " " + _params.back());
+				}
+				
+				std::deque<token> tokens = f.getTokens();
+				tokensIterator it(tokens);
+				
+				block_contents(it);
+				
+				if (_return_type_id != typeRegistry::getVoidHandle()) {
+					line("return " + default_value(_return_type_id) + ";");
+				}
+				
+				return
+					"\t" + cpp_type(_return_type_id) + " n_" + std::string(decl.name.name) + "(" + join(params) + ") {\n" +
+					(_tail ? "\ttail:;\n" : "") +
+					_out.str() +
+					"\t}\n\n";
+			}
+			
+			//Locals that have to be boxed, as they are passed by reference.
+			const std::unordered_set<size_t>& referenced() const {
+				return _referenced;
+			}
+		};
+	}
+	
+	void transpile(
+		tokensIterator& it,
+		symbolTable& symbols,
+		const std::vector<std::pair<std::string, function> >& external_functions,
+		std::ostream& out
+	) {
+		compilerContext ctx(symbols);
+		
+		std::string layout;
+		
+		for (const functionDeclaration& decl : declareExternalFunctions(ctx, symbols, external_functions)) {
+			layout += layoutLine(decl.typeID, decl.name.name);
+		}
+		
+		std::vector<incompleteFunction> incomplete_functions;
+		
+		while (it) {
+			if (!std::holds_alternative<reservedToken>(it->getValue())) {
+				throw unexpected_syntax(it);
+			}
+			
+			switch (it->getReservedToken()) {
+				case reservedToken::kw_public:
+					if (!(++it)->hasValue(reservedToken::kw_function)) {
+						throw unexpected_syntax(it);
+					}
+				case reservedToken::kw_function:
+					{
+						const incompleteFunction& f = incomplete_functions.emplace_back(ctx, it);
+						if (std::holds_alternative<generatorType>(*std::get<functionType>(*f.getDecl().typeID).return_type_id)) {
+							const token& body = f.getTokens().front();
+							throw syntaxError("Generators are not supported by the transpiler", body.getLineNumber(), body.getCharIndex());
+						}
+						layout += layoutLine(f.getDecl().typeID, f.getDecl().name.name);
+						break;
+					}
+				default:
+					{
+						//Globals are initialized by the interpreter, only their indices matter.
+						parseVariableDeclaration(ctx, it, [&](typeHandle typeID, const identifier& name, bool initialized) {
+							if (initialized) {
+								parseExpressionTree(ctx, it, typeID, false);
+							}
+							
+							ctx.createIdentifier(name.id, typeID);
+							layout += layoutLine(typeID, "");
+						});
+						
+						parseTokenValue(ctx, it, reservedToken::semicolon);
+					}
+					break;
+			}
+		}
+		
+		stringPool strings;
+		std::ostringstream prototypes;
+		std::ostringstream functions;
+		std::ostringstream entries;
+		
+		for (const incompleteFunction& f : incomplete_functions) {
+			std::unordered_set<size_t> boxed;
+			{
+				functionTranspiler first_pass(ctx, strings, boxed, external_functions.size());
+				first_pass.transpile(f);
+				boxed = first_pass.referenced();
+			}
+			
+			functionTranspiler transpiler(ctx, strings, boxed, external_functions.size());
+			
+			functions << transpiler.transpile(f);
+			
+			//The entry that the interpreter calls takes the parameters from the stack.
+			const functionDeclaration& decl = f.getDecl();
+			const functionType* ft = std::get_if<functionType>(decl.typeID);
+			
+			std::vector<std::string> params{"cobalt::runtimeContext& ctx"};
+			std::vector<std::string> arguments{"ctx"};
+			for (size_t i = 0; i < ft->param_type_id.size(); ++i) {
+				const functionType::param& param = ft->param_type_id[i];
+				params.push_back(parameter_type(param));
+				arguments.push_back(
+					std::string(param.by_ref ? "cobalt::native::ref<" : "cobalt::native::unbox<") +
+					cpp_type(param.typeID) + ">(ctx.local(" + std::to_string(-1 - int(i)) + "))"
+				);
+			}
+			
+			std::string call = "n_" + std::string(decl.name.name) + "(" + join(arguments) + ")";
+			if (ft->return_type_id != typeRegistry::getVoidHandle()) {
+				call = "ctx.retval() = cobalt::native::box<" + cpp_type(ft->return_type_id) + ">(" + call + ")";
+			}
+			
+			prototypes << "\t" << cpp_type(ft->return_type_id) << " n_" << decl.name.name << "(" << join(params) << ");\n";
+			
+			entries << "\tvoid f_" << decl.name.name << "(cobalt::runtimeContext& ctx) {\n"
+			        << "\t\t" << call << ";\n"
+			        << "\t}\n\n";
+		}
+		
+		out << "//Native code of a cobalt module, generated by cobalt::module::transpile.\n"
+		    << "#include \"native.hpp\"\n\n"
+		    << "namespace {\n";
+		
+		strings.write(out);
+		
+		out << prototypes.str() << "\n"
+		    << functions.str()
+		    << entries.str()
+		    << "\tconst cobalt::nativeFunction functions[] = {\n";
+		
+		for (const incompleteFunction& f : incomplete_functions) {
+			std::string_view name = f.getDecl().name.name;
+			out << "\t\t{" << string_literal(name) << ", f_" << name << "},\n";
+		}
+		
+		out << "\t\t{nullptr, nullptr}\n"
+		    << "\t};\n"
+		    << "}\n\n"
+		    << "extern \"C\" COBALT_NATIVE_EXPORT const cobalt::nativeModule cobalt_native_module = {\n"
+		    << "\t" << string_literal(layout) << ",\n"
+		    << "\tfunctions\n"
+		    << "};\n";
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef transpiler_hpp
+#define transpiler_hpp
+
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cobalt {
+	class runtimeContext;
+	class symbolTable;
+	class tokensIterator;
+	
+	using function = std::function<void(runtimeContext&)>;
+	
+	//Writes C++ source that implements the script functions of a module with the
+	//given external functions. It defines a nativeModule, see native.hpp.
+	void transpile(
+		tokensIterator& it,
+		symbolTable& symbols,
+		const std::vector<std::pair<std::string, function> >& external_functions,
+		std::ostream& out
+	);
+}
+
+#endif /* transpiler_hpp */
@@ -70,6 +70,18 @@ namespace cobalt {
 				}
 				return false;
 			}
+			case 5:
+			{
+				const dictionaryType& dt1 = std::get<5>(t1);
+				const dictionaryType& dt2 = std::get<5>(t2);
+				
+				if (dt1.key_type_id != dt2.key_type_id) {
+					return dt1.key_type_id < dt2.key_type_id;
+				}
+				return dt1.inner_type_id < dt2.inner_type_id;
+			}
+			case 6:
+				return std::get<6>(t1).inner_type_id < std::get<6>(t2).inner_type_id;
 		}
 		
 		return false;
@@ -149,6 +161,12 @@ namespace std {
 				}
 				ret += "}";
 				return ret;
+			},
+			[](const dictionaryType& dt) {
+				return to_string(dt.inner_type_id) + "[" + to_string(dt.key_type_id) + "]";
+			},
+			[](const generatorType& gt) {
+				return to_string(gt.inner_type_id) + "*";
 			}
 		}, *t);
 	}
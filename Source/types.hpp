@@ -16,8 +16,10 @@ namespace cobalt {
 	struct functionType;
 	struct tupleType;
 	struct initListType;
+	struct dictionaryType;
+	struct generatorType;
 	
-	using type = std::variant<simpleType, arrayType, functionType, tupleType, initListType>;
+	using type = std::variant<simpleType, arrayType, functionType, tupleType, initListType, dictionaryType, generatorType>;
 	using typeHandle = const type*;
 	
 	struct arrayType {
@@ -41,6 +43,15 @@ namespace cobalt {
 		std::vector<typeHandle> inner_type_id;
 	};
 	
+	struct dictionaryType {
+		typeHandle key_type_id;
+		typeHandle inner_type_id;
+	};
+	
+	struct generatorType {
+		typeHandle inner_type_id;
+	};
+	
 	class typeRegistry {
 	private:
 		struct typesLess{
@@ -1,16 +1,127 @@
 #include "variable.hpp"
+#include "memoryAccount.hpp"
+#include <typeinfo>
 
 namespace cobalt {
 	namespace {
 		string from_std_string(std::string str) {
-			return std::make_shared<std::string>(std::move(str));
+			return accountedString(std::move(str));
 		}
+		
+		//Bytes charged for a variable: the object, the control block that shares it,
+		//and the pointer in the frame, array or dictionary that holds it.
+		template<typename T>
+		const size_t variable_footprint = sizeof(variableImpl<T>) + 2 * sizeof(void*) + sizeof(variablePtr);
+		
+		//Deletes an accounted string and credits what was charged for it.
+		struct stringCharge {
+			memoryAccount* account;
+			size_t charged;
+			
+			void operator()(std::string* str) const {
+				delete str;
+				account->credit(charged);
+			}
+		};
+		
+		//Variables that the arrays, dictionaries and function states destroyed on
+		//this thread held. They are released one at a time, rather than from the
+		//destructors of their holders, so that deeply nested values do not exhaust
+		//the stack.
+		struct releaseQueue {
+			std::vector<variablePtr> pending;
+			bool draining = false;
+		};
+		
+		releaseQueue& release_queue() {
+			thread_local releaseQueue queue;
+			return queue;
+		}
+		
+		//Queues v if it is the last reference to a container or function.
+		void deferRelease(releaseQueue& queue, variablePtr& v) {
+			if (v && v.use_count() == 1) {
+				const std::type_info& type = typeid(*v);
+				if (
+					type == typeid(variableImpl<array>) ||
+					type == typeid(variableImpl<dictionary>) ||
+					type == typeid(variableImpl<function>)
+				) {
+					queue.pending.push_back(std::move(v));
+				}
+			}
+		}
+		
+		void drainReleases(releaseQueue& queue) {
+			if (queue.draining) {
+				return;
+			}
+			
+			queue.draining = true;
+			while (!queue.pending.empty()) {
+				variablePtr v = std::move(queue.pending.back());
+				queue.pending.pop_back();
+			}
+			queue.draining = false;
+		}
+		
+		template<typename T>
+		void releaseNested(T&) {
+		}
+		
+		void releaseNested(array& value) {
+			releaseQueue& queue = release_queue();
+			for (variablePtr& v : value) {
+				deferRelease(queue, v);
+			}
+			drainReleases(queue);
+		}
+		
+		void releaseNested(dictionary& value) {
+			if (value.size() == 0) {
+				return;
+			}
+			
+			std::vector<dictionary::entry> entries = value.takeEntries();
+			releaseQueue& queue = release_queue();
+			for (dictionary::entry& e : entries) {
+				deferRelease(queue, e.value);
+			}
+			drainReleases(queue);
+		}
+	}
+	
+	void releaseVariables(std::vector<variablePtr>& variables) {
+		releaseQueue& queue = release_queue();
+		for (variablePtr& v : variables) {
+			deferRelease(queue, v);
+		}
+		variables.clear();
+		drainReleases(queue);
+	}
+	
+	variable::variable():
+		_account(nullptr)
+	{
 	}
 	
 	template<typename T>
 	variableImpl<T>::variableImpl(T value):
 		value(std::move(value))
 	{
+		if (memoryAccount* account = memoryAccount::active()) {
+			account->charge(variable_footprint<T>);
+			_account = account;
+		}
+	}
+	
+	template<typename T>
+	variableImpl<T>::~variableImpl() {
+		releaseNested(value);
+		
+		if (_account) {
+			_account->credit(variable_footprint<T>);
+		}
 	}
 	
 	template<typename T>
@@ -27,6 +138,35 @@ namespace cobalt {
 	template class variableImpl<string>;
 	template class variableImpl<function>;
 	template class variableImpl<array>;
+	template class variableImpl<dictionary>;
+	
+	string accountedString(std::string value) {
+		memoryAccount* account = memoryAccount::active();
+		
+		if (!account) {
+			return std::make_shared<std::string>(std::move(value));
+		}
+		
+		size_t charged = sizeof(std::string) + 2 * sizeof(void*) + value.capacity();
+		account->charge(charged);
+		
+		try {
+			return string(new std::string(std::move(value)), stringCharge{account, charged});
+		} catch (...) {
+			account->credit(charged);
+			throw;
+		}
+	}
+	
+	void chargeStringGrowth(const string& value) {
+		if (stringCharge* charge = std::get_deleter<stringCharge>(value)) {
+			size_t charged = sizeof(std::string) + 2 * sizeof(void*) + value->capacity();
+			if (charged > charge->charged) {
+				charge->account->charge(charged - charge->charged);
+				charge->charged = charged;
+			}
+		}
+	}
 	
 	number cloneVariableValue(number value) {
 		return value;
@@ -48,6 +188,10 @@ namespace cobalt {
 		return ret;
 	}
 	
+	dictionary cloneVariableValue(const dictionary& value) {
+		return value.clone();
+	}
+	
 	string convertToString(number value) {
 		if (value == int(value)) {
 			return from_std_string(std::to_string(int(value)));
@@ -76,6 +220,24 @@ namespace cobalt {
 		return from_std_string(std::move(ret));
 	}
 	
+	string convertToString(const dictionary& value) {
+		std::string ret = "{";
+		const char* separator = "";
+		for (const dictionary::entry& e : value.entries()) {
+			ret += separator;
+			if (const number* n = std::get_if<number>(&e.k)) {
+				ret += *convertToString(*n);
+			} else {
+				ret += std::get<std::string>(e.k);
+			}
+			ret += ": ";
+			ret += *(e.value->to_string());
+			separator = ", ";
+		}
+		ret += "}";
+		return from_std_string(std::move(ret));
+	}
+	
 	string convertToString(const lvalue& var) {
 		return var->to_string();
 	}
@@ -6,6 +6,7 @@
 #include <vector>
 #include <functional>
 #include <string>
+#include "dictionary.hpp"
 
 namespace cobalt {
 
@@ -17,6 +18,7 @@ namespace cobalt {
 	class variableImpl;
 	
 	class runtimeContext;
+	class memoryAccount;
 	
 	using number = double;
 	using string = std::shared_ptr<std::string>;
@@ -31,13 +33,17 @@ namespace cobalt {
 	using larray = std::shared_ptr<variableImpl<array> >;
 	using lfunction = std::shared_ptr<variableImpl<function> >;
 	using ltuple = std::shared_ptr<variableImpl<tuple> >;
+	using ldictionary = std::shared_ptr<variableImpl<dictionary> >;
 
 	class variable: public std::enable_shared_from_this<variable> {
 	private:
 		variable(const variable&) = delete;
 		void operator=(const variable&) = delete;
 	protected:
-		variable() = default;
+		//Account charged for the variable, if it was created by a running context.
+		memoryAccount* _account;
+		
+		variable();
 	public:
 		virtual ~variable() = default;
 
@@ -61,6 +67,7 @@ namespace cobalt {
 		valueType value;
 		
 		variableImpl(valueType value);
+		~variableImpl() override;
 		
 		variablePtr clone() const override;
 	
@@ -71,6 +78,7 @@ namespace cobalt {
 	string cloneVariableValue(const string& value);
 	function cloneVariableValue(const function& value);
 	array cloneVariableValue(const array& value);
+	dictionary cloneVariableValue(const dictionary& value);
 	
 	template <class T>
 	T cloneVariableValue(const std::shared_ptr<variableImpl<T> >& v) {
@@ -81,7 +89,19 @@ namespace cobalt {
 	string convertToString(const string& value);
 	string convertToString(const function& value);
 	string convertToString(const array& value);
+	string convertToString(const dictionary& value);
 	string convertToString(const lvalue& var);
+	
+	//String charged to the account of the running context, if any, by capacity.
+	string accountedString(std::string value);
+	
+	//Charges the growth of a string changed in place since it was last charged.
+	void chargeStringGrowth(const string& value);
+	
+	//Empties variables, releasing the values that only they hold one at a time on
+	//this thread. Function states call it from their destructors, so that a long
+	//chain of closures or generators does not exhaust the stack.
+	void releaseVariables(std::vector<variablePtr>& variables);
 }
 
 #endif /* variable_hpp */
@@ -0,0 +1,390 @@
+#include "vectorKernels.hpp"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define COBALT_X86_64
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define COBALT_TARGET_AVX2
+	#else
+		#define COBALT_TARGET_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+namespace cobalt {
+	namespace kernels {
+		namespace {
+			struct kernelTable {
+				const char* name;
+				double (*sum)(const double* x, size_t n);
+				double (*min)(const double* x, size_t n);
+				double (*max)(const double* x, size_t n);
+				double (*dot)(const double* x, const double* y, size_t n);
+				void (*axpy)(double a, const double* x, double* y, size_t n);
+				void (*prefixSum)(double* x, size_t n);
+				void (*binIndices)(const double* x, size_t n, double lo, double scale, long long* idx);
+			};
+			
+			double sum_scalar(const double* x, size_t n) {
+				double ret = 0;
+				for (size_t i = 0; i < n; ++i) {
+					ret += x[i];
+				}
+				return ret;
+			}
+			
+			double min_scalar(const double* x, size_t n) {
+				double ret = x[0];
+				for (size_t i = 1; i < n; ++i) {
+					ret = x[i] < ret ? x[i] : ret;
+				}
+				return ret;
+			}
+			
+			double max_scalar(const double* x, size_t n) {
+				double ret = x[0];
+				for (size_t i = 1; i < n; ++i) {
+					ret = x[i] > ret ? x[i] : ret;
+				}
+				return ret;
+			}
+			
+			double dot_scalar(const double* x, const double* y, size_t n) {
+				double ret = 0;
+				for (size_t i = 0; i < n; ++i) {
+					ret += x[i] * y[i];
+				}
+				return ret;
+			}
+			
+			void axpy_scalar(double a, const double* x, double* y, size_t n) {
+				for (size_t i = 0; i < n; ++i) {
+					y[i] += a * x[i];
+				}
+			}
+			
+			void prefixSum_scalar(double* x, size_t n) {
+				for (size_t i = 1; i < n; ++i) {
+					x[i] += x[i-1];
+				}
+			}
+			
+			long long binIndex(double x, double lo, double scale) {
+				double idx = std::floor((x - lo) * scale);
+				//NaN and out of range values map to -1, the caller filters them out
+				return idx >= 0 && idx < 2147483647.0 ? (long long)idx : -1;
+			}
+			
+			void binIndices_scalar(const double* x, size_t n, double lo, double scale, long long* idx) {
+				for (size_t i = 0; i < n; ++i) {
+					idx[i] = binIndex(x[i], lo, scale);
+				}
+			}
+			
+			const kernelTable scalar_kernels = {
+				"scalar",
+				sum_scalar,
+				min_scalar,
+				max_scalar,
+				dot_scalar,
+				axpy_scalar,
+				prefixSum_scalar,
+				binIndices_scalar,
+			};
+			
+#ifdef COBALT_X86_64
+			//SSE2 is part of the x86-64 baseline, so it needs no runtime check.
+			
+			double sum_sse2(const double* x, size_t n) {
+				__m128d acc0 = _mm_setzero_pd();
+				__m128d acc1 = _mm_setzero_pd();
+				size_t i = 0;
+				for (; i + 4 <= n; i += 4) {
+					acc0 = _mm_add_pd(acc0, _mm_loadu_pd(x + i));
+					acc1 = _mm_add_pd(acc1, _mm_loadu_pd(x + i + 2));
+				}
+				double lanes[2];
+				_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+				return lanes[0] + lanes[1] + sum_scalar(x + i, n - i);
+			}
+			
+			double min_sse2(const double* x, size_t n) {
+				if (n < 2) {
+					return min_scalar(x, n);
+				}
+				__m128d acc = _mm_loadu_pd(x);
+				size_t i = 2;
+				for (; i + 2 <= n; i += 2) {
+					acc = _mm_min_pd(_mm_loadu_pd(x + i), acc);
+				}
+				double lanes[2];
+				_mm_storeu_pd(lanes, acc);
+				double ret = lanes[1] < lanes[0] ? lanes[1] : lanes[0];
+				return i < n && x[i] < ret ? x[i] : ret;
+			}
+			
+			double max_sse2(const double* x, size_t n) {
+				if (n < 2) {
+					return max_scalar(x, n);
+				}
+				__m128d acc = _mm_loadu_pd(x);
+				size_t i = 2;
+				for (; i + 2 <= n; i += 2) {
+					acc = _mm_max_pd(_mm_loadu_pd(x + i), acc);
+				}
+				double lanes[2];
+				_mm_storeu_pd(lanes, acc);
+				double ret = lanes[1] > lanes[0] ? lanes[1] : lanes[0];
+				return i < n && x[i] > ret ? x[i] : ret;
+			}
+			
+			double dot_sse2(const double* x, const double* y, size_t n) {
+				__m128d acc0 = _mm_setzero_pd();
+				__m128d acc1 = _mm_setzero_pd();
+				size_t i = 0;
+				for (; i + 4 <= n; i += 4) {
+					acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+					acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+				}
+				double lanes[2];
+				_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+				return lanes[0] + lanes[1] + dot_scalar(x + i, y + i, n - i);
+			}
+			
+			void axpy_sse2(double a, const double* x, double* y, size_t n) {
+				__m128d va = _mm_set1_pd(a);
+				size_t i = 0;
+				for (; i + 2 <= n; i += 2) {
+					_mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(va, _mm_loadu_pd(x + i))));
+				}
+				axpy_scalar(a, x + i, y + i, n - i);
+			}
+			
+			void prefixSum_sse2(double* x, size_t n) {
+				__m128d carry = _mm_setzero_pd();
+				size_t i = 0;
+				for (; i + 2 <= n; i += 2) {
+					__m128d v = _mm_loadu_pd(x + i);
+					v = _mm_add_pd(v, _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(v), 8)));
+					v = _mm_add_pd(v, carry);
+					_mm_storeu_pd(x + i, v);
+					carry = _mm_unpackhi_pd(v, v);
+				}
+				for (; i < n; ++i) {
+					x[i] += i ? x[i-1] : 0;
+				}
+			}
+			
+			const kernelTable sse2_kernels = {
+				"sse2",
+				sum_sse2,
+				min_sse2,
+				max_sse2,
+				dot_sse2,
+				axpy_sse2,
+				prefixSum_sse2,
+				binIndices_scalar,
+			};
+			
+			COBALT_TARGET_AVX2 double horizontal_sum_avx2(__m256d v) {
+				__m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+				return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+			}
+			
+			COBALT_TARGET_AVX2 double sum_avx2(const double* x, size_t n) {
+				__m256d acc0 = _mm256_setzero_pd();
+				__m256d acc1 = _mm256_setzero_pd();
+				size_t i = 0;
+				for (; i + 8 <= n; i += 8) {
+					acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(x + i));
+					acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(x + i + 4));
+				}
+				return horizontal_sum_avx2(_mm256_add_pd(acc0, acc1)) + sum_scalar(x + i, n - i);
+			}
+			
+			COBALT_TARGET_AVX2 double min_avx2(const double* x, size_t n) {
+				if (n < 4) {
+					return min_scalar(x, n);
+				}
+				__m256d acc = _mm256_loadu_pd(x);
+				size_t i = 4;
+				for (; i + 4 <= n; i += 4) {
+					acc = _mm256_min_pd(_mm256_loadu_pd(x + i), acc);
+				}
+				double lanes[4];
+				_mm256_storeu_pd(lanes, acc);
+				double ret = min_scalar(lanes, 4);
+				for (; i < n; ++i) {
+					ret = x[i] < ret ? x[i] : ret;
+				}
+				return ret;
+			}
+			
+			COBALT_TARGET_AVX2 double max_avx2(const double* x, size_t n) {
+				if (n < 4) {
+					return max_scalar(x, n);
+				}
+				__m256d acc = _mm256_loadu_pd(x);
+				size_t i = 4;
+				for (; i + 4 <= n; i += 4) {
+					acc = _mm256_max_pd(_mm256_loadu_pd(x + i), acc);
+				}
+				double lanes[4];
+				_mm256_storeu_pd(lanes, acc);
+				double ret = max_scalar(lanes, 4);
+				for (; i < n; ++i) {
+					ret = x[i] > ret ? x[i] : ret;
+				}
+				return ret;
+			}
+			
+			COBALT_TARGET_AVX2 double dot_avx2(const double* x, const double* y, size_t n) {
+				__m256d acc0 = _mm256_setzero_pd();
+				__m256d acc1 = _mm256_setzero_pd();
+				size_t i = 0;
+				for (; i + 8 <= n; i += 8) {
+					acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+					acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+				}
+				return horizontal_sum_avx2(_mm256_add_pd(acc0, acc1)) + dot_scalar(x + i, y + i, n - i);
+			}
+			
+			COBALT_TARGET_AVX2 void axpy_avx2(double a, const double* x, double* y, size_t n) {
+				__m256d va = _mm256_set1_pd(a);
+				size_t i = 0;
+				for (; i + 4 <= n; i += 4) {
+					_mm256_storeu_pd(
+						y + i,
+						_mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_mul_pd(va, _mm256_loadu_pd(x + i)))
+					);
+				}
+				axpy_scalar(a, x + i, y + i, n - i);
+			}
+			
+			COBALT_TARGET_AVX2 void prefixSum_avx2(double* x, size_t n) {
+				__m256d carry = _mm256_setzero_pd();
+				__m256d zero = _mm256_setzero_pd();
+				size_t i = 0;
+				for (; i + 4 <= n; i += 4) {
+					__m256d v = _mm256_loadu_pd(x + i);
+					//[a, b, c, d] + [0, a, b, c]
+					v = _mm256_add_pd(v, _mm256_blend_pd(_mm256_permute4x64_pd(v, 0x90), zero, 0x1));
+					//[a, ab, bc, cd] + [0, 0, a, ab]
+					v = _mm256_add_pd(v, _mm256_permute2f128_pd(v, v, 0x08));
+					v = _mm256_add_pd(v, carry);
+					_mm256_storeu_pd(x + i, v);
+					carry = _mm256_permute4x64_pd(v, 0xFF);
+				}
+				for (; i < n; ++i) {
+					x[i] += i ? x[i-1] : 0;
+				}
+			}
+			
+			COBALT_TARGET_AVX2 void binIndices_avx2(const double* x, size_t n, double lo, double scale, long long* idx) {
+				__m256d vlo = _mm256_set1_pd(lo);
+				__m256d vscale = _mm256_set1_pd(scale);
+				__m256d zero = _mm256_setzero_pd();
+				__m256d limit = _mm256_set1_pd(2147483647.0);
+				size_t i = 0;
+				for (; i + 4 <= n; i += 4) {
+					__m256d b = _mm256_floor_pd(_mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(x + i), vlo), vscale));
+					//ordered comparisons are false for NaN, so NaN lands in the invalid lanes
+					__m256d valid = _mm256_and_pd(_mm256_cmp_pd(b, zero, _CMP_GE_OQ), _mm256_cmp_pd(b, limit, _CMP_LT_OQ));
+					__m128i bins = _mm256_cvttpd_epi32(_mm256_blendv_pd(_mm256_set1_pd(-1), b, valid));
+					_mm256_storeu_si256((__m256i*)(idx + i), _mm256_cvtepi32_epi64(bins));
+				}
+				binIndices_scalar(x + i, n - i, lo, scale, idx + i);
+			}
+			
+			const kernelTable avx2_kernels = {
+				"avx2",
+				sum_avx2,
+				min_avx2,
+				max_avx2,
+				dot_avx2,
+				axpy_avx2,
+				prefixSum_avx2,
+				binIndices_avx2,
+			};
+			
+			bool cpu_has_avx2() {
+#ifdef _MSC_VER
+				int info[4];
+				__cpuid(info, 1);
+				bool osxsave = (info[2] & (1 << 27)) != 0;
+				bool avx = (info[2] & (1 << 28)) != 0;
+				if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+					return false;
+				}
+				__cpuidex(info, 7, 0);
+				return (info[1] & (1 << 5)) != 0;
+#else
+				__builtin_cpu_init();
+				return __builtin_cpu_supports("avx2");
+#endif
+			}
+#endif
+			
+			const kernelTable& select_kernels() {
+#ifdef COBALT_X86_64
+				return cpu_has_avx2() ? avx2_kernels : sse2_kernels;
+#else
+				return scalar_kernels;
+#endif
+			}
+			
+			const kernelTable& active_kernels() {
+				static const kernelTable& ret = select_kernels();
+				return ret;
+			}
+		}
+		
+		double sum(const double* x, size_t n) {
+			return active_kernels().sum(x, n);
+		}
+		
+		double min(const double* x, size_t n) {
+			return active_kernels().min(x, n);
+		}
+		
+		double max(const double* x, size_t n) {
+			return active_kernels().max(x, n);
+		}
+		
+		double dot(const double* x, const double* y, size_t n) {
+			return active_kernels().dot(x, y, n);
+		}
+		
+		void axpy(double a, const double* x, double* y, size_t n) {
+			active_kernels().axpy(a, x, y, n);
+		}
+		
+		void prefixSum(double* x, size_t n) {
+			active_kernels().prefixSum(x, n);
+		}
+		
+		void histogram(const double* x, size_t n, double lo, double hi, size_t* counts, size_t bins) {
+			const size_t block_size = 256;
+			long long idx[block_size];
+			double scale = bins / (hi - lo);
+			
+			for (size_t i = 0; i < n; i += block_size) {
+				size_t count = n - i < block_size ? n - i : block_size;
+				active_kernels().binIndices(x + i, count, lo, scale, idx);
+				for (size_t j = 0; j < count; ++j) {
+					if (idx[j] >= 0 && size_t(idx[j]) < bins) {
+						++counts[idx[j]];
+					} else if (x[i + j] == hi) {
+						//the upper bound belongs to the last bin
+						++counts[bins - 1];
+					}
+				}
+			}
+		}
+		
+		const char* instructionSet() {
+			return active_kernels().name;
+		}
+	}
+}
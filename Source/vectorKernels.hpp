@@ -0,0 +1,20 @@
+#ifndef vectorKernels_hpp
+#define vectorKernels_hpp
+
+#include <cstddef>
+
+namespace cobalt {
+	namespace kernels {
+		double sum(const double* x, size_t n);
+		double min(const double* x, size_t n);
+		double max(const double* x, size_t n);
+		double dot(const double* x, const double* y, size_t n);
+		void axpy(double a, const double* x, double* y, size_t n);
+		void prefixSum(double* x, size_t n);
+		void histogram(const double* x, size_t n, double lo, double hi, size_t* counts, size_t bins);
+		
+		const char* instructionSet();
+	}
+}
+
+#endif /* vectorKernels_hpp */